@@ -0,0 +1,220 @@
+#include "adjustmentstack.h"
+#include "profiler.h"
+
+QVector<Adjustment> AdjustmentStack::adjustments() const
+{
+    QVector<Adjustment> result;
+    result.reserve(stages.size());
+    for (const Stage &stage : stages)
+        result.append(stage.adjustment);
+    return result;
+}
+
+void AdjustmentStack::setAdjustments(const QVector<Adjustment> &adjustments)
+{
+    int kept = 0;
+    while (kept < stages.size() && kept < adjustments.size() && stages.at(kept).adjustment.sameAs(adjustments.at(kept)))
+        ++kept;
+    stages.resize(kept);
+    // Копия в рабочем потоке считает старый список операций
+    snapshotId = 0;
+    changes.clear();
+    for (int i = 0; i < adjustments.size(); ++i) {
+        if (i < kept) {
+            stages[i].adjustment = adjustments.at(i);
+        } else {
+            Stage stage;
+            stage.adjustment = adjustments.at(i);
+            stages.append(stage);
+        }
+    }
+}
+
+void AdjustmentStack::invalidate(const QRect &rect)
+{
+    if (snapshotId != 0 && !rect.isEmpty())
+        changes.append(rect);
+    QRect area = rect;
+    for (int i = 0; i < stages.size() && !area.isEmpty(); ++i) {
+        const int halo = stages.at(i).adjustment.haloFor();
+        if (halo < 0) {
+            // Результат этой операции зависит от всего документа, как и результаты всех следующих
+            for (int j = i; j < stages.size(); ++j)
+                stages[j].valid.fill(false);
+            return;
+        }
+        area.adjust(-halo, -halo, halo, halo);
+        invalidateStage(i, area);
+    }
+}
+
+void AdjustmentStack::invalidateStage(int stage, const QRect &rect)
+{
+    Stage &target = stages[stage];
+    if (target.cache.isNull())
+        return;
+    const QRect range = target.cache.tilesIn(rect);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column)
+            target.valid[row * target.cache.tileColumns() + column] = false;
+    }
+}
+
+void AdjustmentStack::reset()
+{
+    snapshotId = 0;
+    changes.clear();
+    for (Stage &stage : stages) {
+        stage.cache = TiledImage();
+        stage.valid.clear();
+    }
+}
+
+QRect AdjustmentStack::evaluate(const TiledImage &source, const QRect &rect, int count)
+{
+    const int last = (count < 0 ? stages.size() : qMin(count, stages.size())) - 1;
+    if (last < 0 || source.isNull())
+        return QRect();
+    TRACE_SCOPE("AdjustmentStack::evaluate");
+    return ensure(source, last, source.tilesIn(rect));
+}
+
+const TiledImage &AdjustmentStack::output(const TiledImage &source, int count) const
+{
+    const int last = (count < 0 ? stages.size() : qMin(count, stages.size())) - 1;
+    // Пока операция ни разу не вычислялась, показывается ее вход
+    for (int stage = last; stage >= 0; --stage) {
+        if (!stages.at(stage).cache.isNull())
+            return stages.at(stage).cache;
+    }
+    return source;
+}
+
+bool AdjustmentStack::isEvaluated(const TiledImage &source, const QRect &rect, int count) const
+{
+    const int last = (count < 0 ? stages.size() : qMin(count, stages.size())) - 1;
+    const QRect tiles = source.tilesIn(rect);
+    if (last < 0 || tiles.isEmpty())
+        return true;
+    const Stage &stage = stages.at(last);
+    if (stage.cache.isNull() || stage.cache.size() != source.size())
+        return false;
+    for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            if (!stage.valid.at(row * source.tileColumns() + column))
+                return false;
+        }
+    }
+    return true;
+}
+
+AdjustmentStack AdjustmentStack::snapshot()
+{
+    snapshotId = ++snapshotCount;
+    changes.clear();
+    AdjustmentStack copy = *this;
+    copy.snapshotId = snapshotId;
+    return copy;
+}
+
+bool AdjustmentStack::merge(const AdjustmentStack &evaluated, QRect *adopted)
+{
+    *adopted = QRect();
+    if (snapshotId == 0 || evaluated.snapshotId != snapshotId || evaluated.stages.size() != stages.size())
+        return false;
+    for (int i = 0; i < stages.size(); ++i) {
+        Stage &target = stages[i];
+        const Stage &done = evaluated.stages.at(i);
+        if (done.cache.isNull())
+            continue;
+        const bool last = i == stages.size() - 1;
+        if (target.cache.size() != done.cache.size() || target.cache.format() != done.cache.format()
+                || target.cache.background() != done.cache.background()) {
+            // Кэш сменил формат (или еще не создан): берется целиком из копии
+            target.cache = done.cache;
+            target.valid = done.valid;
+            if (last)
+                *adopted = done.cache.rect();
+            continue;
+        }
+        const int columns = done.cache.tileColumns();
+        for (int index = 0; index < done.valid.size(); ++index) {
+            if (target.valid.at(index) || !done.valid.at(index))
+                continue;
+            const int column = index % columns;
+            const int row = index / columns;
+            target.cache.setTile(column, row, done.cache.tile(column, row));
+            target.valid[index] = true;
+            if (last)
+                *adopted |= done.cache.tileRect(column, row);
+        }
+    }
+    // Изменения документа, пришедшие во время досчета, снова делают недосчитанными затронутые тайлы
+    const QVector<QRect> pending = changes;
+    snapshotId = 0;
+    changes.clear();
+    for (const QRect &rect : pending)
+        invalidate(rect);
+    return true;
+}
+
+QRect AdjustmentStack::ensure(const TiledImage &source, int stage, const QRect &tiles)
+{
+    if (stage < 0 || tiles.isEmpty())
+        return QRect();
+    {
+        // Эффекты не меняют размер документа, поэтому сетка тайлов у всех операций общая
+        Stage &target = stages[stage];
+        if (target.cache.size() != source.size()) {
+            target.cache = TiledImage();
+            target.valid.clear();
+        }
+    }
+    const Stage &current = stages.at(stage);
+    const int columns = source.tileColumns();
+    const QRect grid(0, 0, columns, source.tileRows());
+    QRect stale;
+    for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            if (current.cache.isNull() || !current.valid.at(row * columns + column))
+                stale |= QRect(column, row, 1, 1);
+        }
+    }
+    if (stale.isEmpty())
+        return QRect();
+
+    const Adjustment adjustment = current.adjustment;
+    const int halo = adjustment.haloFor();
+    QRect input;
+    if (halo < 0) {
+        stale = grid;
+        input = grid;
+    } else {
+        const int margin = (halo + TiledImage::TileSize - 1) / TiledImage::TileSize;
+        input = stale.adjusted(-margin, -margin, margin, margin) & grid;
+    }
+    ensure(source, stage - 1, input);
+
+    // Область выровнена по тайлам: вход операции разделяет тайлы предыдущей без копирования
+    const TiledImage &previous = stage == 0 ? source : stages.at(stage - 1).cache;
+    const QRect area = source.tileRect(input.left(), input.top()) | source.tileRect(input.right(), input.bottom());
+    const TiledImage region = area == source.rect() ? previous : previous.copyRegion(area);
+    const TiledImage result = adjustment.effect(region, adjustment.values, 1, std::function<bool(int, int)>());
+    if (result.size() != region.size())
+        return QRect();
+
+    Stage &target = stages[stage];
+    if (target.cache.isNull() || target.cache.format() != result.format()
+            || target.cache.background() != result.background()) {
+        // Остальные тайлы кэша будут посчитаны заново при следующем запросе
+        target.cache = TiledImage(source.size(), result.format(), result.background());
+        target.valid = QVector<bool>(columns * source.tileRows(), false);
+    }
+    for (int row = stale.top(); row <= stale.bottom(); ++row) {
+        for (int column = stale.left(); column <= stale.right(); ++column) {
+            target.cache.setTile(column, row, result.tile(column - input.left(), row - input.top()));
+            target.valid[row * columns + column] = true;
+        }
+    }
+    return source.tileRect(stale.left(), stale.top()) | source.tileRect(stale.right(), stale.bottom());
+}
@@ -0,0 +1,129 @@
+#ifndef ADJUSTMENTSTACK_H
+#define ADJUSTMENTSTACK_H
+
+#include <QRect>
+#include <QString>
+#include <QVector>
+#include <functional>
+#include "filterplugin.h"
+#include "tiledimage.h"
+
+/*!
+ * \brief The Adjustment struct одна операция неразрушающего редактирования: эффект и значения его слайдеров
+ */
+struct Adjustment
+{
+    /*!
+     * \brief Effect эффект со значениями слайдеров values, вычисляемый на документе, уменьшенном в scale раз
+     */
+    typedef std::function<TiledImage(const TiledImage &source, const QVector<int> &values, int scale,
+                                      const std::function<bool(int, int)> &progress)> Effect;
+    /*!
+     * \brief Halo сколько пикселей соседей с каждой стороны нужно эффекту при значениях values;
+     * отрицательное число - эффекту нужен весь документ (например, эквализация гистограммы)
+     */
+    typedef std::function<int(const QVector<int> &values)> Halo;
+
+    QString name;   //!< постоянное имя эффекта (используется в ключах кэша результатов)
+    QString title;  //!< название для списка операций
+    Effect effect;
+    Halo halo;      //!< пустая функция - попиксельный эффект
+    QVector<int> values;
+    QVector<FilterParameter> parameters; //!< параметры для окна эффектов (пусто для встроенных эффектов)
+    bool adjustable = true;              //!< true, если эффект управляется слайдером
+
+    /*!
+     * \brief sameAs true, если операции дают одинаковый результат (функции эффектов не сравниваются)
+     */
+    bool sameAs(const Adjustment &other) const { return name == other.name && values == other.values; }
+    int haloFor() const { return halo ? halo(values) : 0; }
+};
+
+/*!
+ * \brief The AdjustmentStack class упорядоченный список операций, применяемых к документу без изменения его пикселей.
+ *
+ * Результат каждой операции кэшируется по тайлам. Тайл считается лениво - только когда он попадает
+ * в запрошенную область (обычно видимую часть окна). Для операции с окрестностью (размытие) берется
+ * область предыдущей операции, расширенная до целых тайлов, поэтому входные тайлы разделяются без копирования.
+ * Изменение операции сбрасывает кэш только ее и последующих операций, а изменение пикселей документа -
+ * только тайлов, до которых это изменение доходит через окрестности операций.
+ *
+ * Чтобы не считать операции в потоке интерфейса, тайлы досчитываются в копии списка (snapshot)
+ * в рабочем потоке и забираются обратно merge; тайлы разделяются без копирования.
+ */
+class AdjustmentStack
+{
+public:
+    AdjustmentStack() = default;
+
+    bool isEmpty() const { return stages.isEmpty(); }
+    int count() const { return stages.size(); }
+    QVector<Adjustment> adjustments() const;
+    /*!
+     * \brief setAdjustments заменяет список операций. Кэш общего начала старого и нового списков сохраняется.
+     */
+    void setAdjustments(const QVector<Adjustment> &adjustments);
+    /*!
+     * \brief invalidate сообщает об изменении пикселей документа в прямоугольнике rect
+     */
+    void invalidate(const QRect &rect);
+    /*!
+     * \brief reset сбрасывает кэш всех операций (документ заменен целиком)
+     */
+    void reset();
+    /*!
+     * \brief evaluate досчитывает тайлы, пересекающие rect, у первых count операций
+     * \param source документ, к которому применяются операции
+     * \param rect область в координатах документа
+     * \param count число операций; -1 - все
+     * \return область результата, тайлы которой были пересчитаны (для перерисовки)
+     */
+    QRect evaluate(const TiledImage &source, const QRect &rect, int count = -1);
+    /*!
+     * \brief output результат первых count операций (-1 - всех). Актуальны только тайлы, уже досчитанные evaluate.
+     */
+    const TiledImage &output(const TiledImage &source, int count = -1) const;
+    /*!
+     * \brief isEvaluated true, если у первых count операций (-1 - всех) досчитаны все тайлы, пересекающие rect
+     */
+    bool isEvaluated(const TiledImage &source, const QRect &rect, int count = -1) const;
+    /*!
+     * \brief snapshot копия для досчета тайлов в рабочем потоке. Изменения документа после снятия копии
+     * запоминаются и учитываются в merge; предыдущие копии после этого не принимаются.
+     */
+    AdjustmentStack snapshot();
+    /*!
+     * \brief merge забирает тайлы, досчитанные в последней копии snapshot. Тайлы, устаревшие после снятия копии, остаются недосчитанными.
+     * \param adopted сюда записывается область документа, тайлы последней операции в которой стали актуальными
+     * \return false, если копия устарела (список операций сменился или снята более новая копия)
+     */
+    bool merge(const AdjustmentStack &evaluated, QRect *adopted);
+
+private:
+    struct Stage
+    {
+        Adjustment adjustment;
+        TiledImage cache;
+        QVector<bool> valid;
+    };
+
+    /*!
+     * \brief ensure досчитывает тайлы tiles (в координатах сетки тайлов) операции stage
+     * \return область пересчитанных тайлов в координатах документа
+     */
+    QRect ensure(const TiledImage &source, int stage, const QRect &tiles);
+    void invalidateStage(int stage, const QRect &rect);
+
+    QVector<Stage> stages;
+    /*!
+     * \brief snapshotId номер последней копии snapshot; 0 - копия не ждет merge
+     */
+    int snapshotId = 0;
+    int snapshotCount = 0;
+    /*!
+     * \brief changes прямоугольники invalidate, пришедшие после снятия копии
+     */
+    QVector<QRect> changes;
+};
+
+#endif // ADJUSTMENTSTACK_H
@@ -0,0 +1,130 @@
+#include "batchprocessor.h"
+
+#include <QColorSpace>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <opencv2/core.hpp>
+#include <atomic>
+
+namespace {
+
+void writeReport(QTextStream &log, const char *prefix, int done, int total, qint64 pixels, qint64 elapsedMs)
+{
+    const double seconds = qMax<qint64>(elapsedMs, 1) / 1000.0;
+    log << prefix << done << "/" << total << " files, "
+        << QString::number(done / seconds, 'f', 2) << " files/s, "
+        << QString::number(pixels / seconds / 1e6, 'f', 1) << " MP/s" << Qt::endl;
+}
+
+}
+
+BatchProcessor::BatchProcessor(const Recipe &recipe, const QString &outputDirectory)
+    : recipe(recipe), outputDirectory(outputDirectory)
+{
+}
+
+QStringList BatchProcessor::imageFiles(const QString &directory)
+{
+    QStringList filters;
+    for (const QByteArray &format : QImageReader::supportedImageFormats())
+        filters.append(QStringLiteral("*.") + QString::fromLatin1(format));
+    QStringList files;
+    const QDir dir(directory);
+    for (const QString &name : dir.entryList(filters, QDir::Files, QDir::Name))
+        files.append(dir.filePath(name));
+    return files;
+}
+
+BatchProcessor::Statistics BatchProcessor::run(const QStringList &files, QTextStream &log)
+{
+    const int threads = threadCount > 0 ? threadCount : QThread::idealThreadCount();
+    const int queueSize = maxInFlight > 0 ? maxInFlight : threads * 2;
+    // Параллельность по файлам; вложенный parallel_for_ в фильтрах только создавал бы лишние переключения
+    const int openCvThreads = cv::getNumThreads();
+    if (threads > 1)
+        cv::setNumThreads(1);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QSemaphore inFlight(queueSize);
+    QMutex logMutex;
+    std::atomic<int> processed(0);
+    std::atomic<int> failed(0);
+    std::atomic<qint64> pixels(0);
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+
+    for (const QString &fileName : files) {
+        inFlight.acquire();
+        pool.start([&, fileName]() {
+            QString error;
+            const qint64 count = processFile(fileName, &error);
+            if (count < 0) {
+                ++failed;
+                QMutexLocker locker(&logMutex);
+                log << "error: " << QDir::toNativeSeparators(fileName) << ": " << error << Qt::endl;
+            } else {
+                pixels += count;
+                ++processed;
+            }
+            {
+                QMutexLocker locker(&logMutex);
+                const qint64 elapsed = timer.elapsed();
+                if (elapsed - lastReport >= 1000) {
+                    lastReport = elapsed;
+                    writeReport(log, "progress: ", processed + failed, files.size(), pixels, elapsed);
+                }
+            }
+            inFlight.release();
+        });
+    }
+    pool.waitForDone();
+    cv::setNumThreads(openCvThreads);
+
+    Statistics statistics;
+    statistics.processed = processed;
+    statistics.failed = failed;
+    statistics.pixels = pixels;
+    statistics.elapsedMs = timer.elapsed();
+    writeReport(log, "done: ", statistics.processed, files.size(), statistics.pixels, statistics.elapsedMs);
+    if (statistics.failed > 0)
+        log << statistics.failed << " files failed" << Qt::endl;
+    return statistics;
+}
+
+qint64 BatchProcessor::processFile(const QString &fileName, QString *error) const
+{
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+    QImage image = reader.read();
+    if (image.isNull()) {
+        *error = reader.errorString();
+        return -1;
+    }
+    if (image.colorSpace().isValid())
+        image.convertToColorSpace(QColorSpace::SRgb);
+    const qint64 count = qint64(image.width()) * image.height();
+
+    const TiledImage result = recipe.apply(TiledImage::fromImage(image));
+    image = QImage();
+    if (result.isNull()) {
+        *error = QStringLiteral("processing failed");
+        return -1;
+    }
+
+    ImageSaver::Target target;
+    target.fileName = QDir(outputDirectory).filePath(QFileInfo(fileName).fileName());
+    QString writeError;
+    if (!ImageSaver::write(result.toImage(), target, saveSettings, &writeError)) {
+        *error = QStringLiteral("cannot write %1: %2").arg(QDir::toNativeSeparators(target.fileName), writeError);
+        return -1;
+    }
+    return count;
+}
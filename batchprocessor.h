@@ -0,0 +1,74 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include "imagesaver.h"
+#include "recipe.h"
+
+/*!
+ * \brief The BatchProcessor class применяет рецепт к списку файлов без интерфейса.
+ *
+ * Каждый файл проходит декодирование, обработку и кодирование в одном из рабочих потоков,
+ * так что разные файлы одновременно находятся на разных стадиях. Число файлов в работе
+ * ограничено (maxInFlight): следующий файл берется в работу только после завершения одного из текущих,
+ * поэтому потребление памяти не зависит от количества файлов.
+ */
+class BatchProcessor
+{
+public:
+    /*!
+     * \brief The Statistics struct итоги обработки
+     */
+    struct Statistics
+    {
+        int processed = 0;      //!< успешно обработано файлов
+        int failed = 0;         //!< файлов с ошибками
+        qint64 pixels = 0;      //!< суммарное число пикселей обработанных файлов
+        qint64 elapsedMs = 0;   //!< время работы в миллисекундах
+    };
+
+    /*!
+     * \brief BatchProcessor
+     * \param recipe применяемая цепочка эффектов
+     * \param outputDirectory каталог для результатов; имена файлов сохраняются
+     */
+    BatchProcessor(const Recipe &recipe, const QString &outputDirectory);
+    /*!
+     * \brief setThreadCount число рабочих потоков (по умолчанию - число ядер)
+     */
+    void setThreadCount(int count) { threadCount = count; }
+    /*!
+     * \brief setMaxInFlight максимальное число файлов в работе одновременно (по умолчанию - вдвое больше потоков)
+     */
+    void setMaxInFlight(int count) { maxInFlight = count; }
+    /*!
+     * \brief setSaveSettings параметры кодировщиков для результатов
+     */
+    void setSaveSettings(const ImageSaver::Settings &settings) { saveSettings = settings; }
+    /*!
+     * \brief run обрабатывает файлы и блокирует вызывающий поток до завершения.
+     * Ошибки и периодический отчет о прогрессе пишутся в log.
+     */
+    Statistics run(const QStringList &files, QTextStream &log);
+    /*!
+     * \brief imageFiles список файлов изображений в каталоге (без вложенных), которые умеет читать Qt
+     */
+    static QStringList imageFiles(const QString &directory);
+
+private:
+    /*!
+     * \brief processFile декодирует, обрабатывает и кодирует один файл
+     * \return число пикселей изображения или -1 при ошибке (описание - в error)
+     */
+    qint64 processFile(const QString &fileName, QString *error) const;
+
+    Recipe recipe;
+    QString outputDirectory;
+    int threadCount = 0;
+    int maxInFlight = 0;
+    ImageSaver::Settings saveSettings;
+};
+
+#endif // BATCHPROCESSOR_H
@@ -0,0 +1,358 @@
+#include <QColorSpace>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QtMath>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+#include "colormanager.h"
+#include "convert.h"
+#include "filters.h"
+#include "imagesaver.h"
+#include "layerstack.h"
+#include "profiler.h"
+#include "tiledimage.h"
+
+// Замеры всех операций редактора: cmakeImageEditor_bench [--sizes 1,12,50,100] [--threads 1,8]
+// [--formats rgb32,rgb888,gray8,rgba64] [--ops gaussian,sepia] [--repeat 3] [--output result.json]
+
+namespace {
+
+struct FormatInfo
+{
+    const char *name;
+    QImage::Format format;
+};
+
+const FormatInfo Formats[] = {
+    { "rgb32", QImage::Format_RGB32 },
+    { "argb32", QImage::Format_ARGB32 },
+    { "rgb888", QImage::Format_RGB888 },
+    { "gray8", QImage::Format_Grayscale8 },
+    { "rgba64", QImage::Format_RGBA64 },
+};
+
+// Значение ползунка окна эффектов, для которого меряются размытия
+const int KernelLength = 9;
+
+/*!
+ * \brief The Input struct исходные данные одного замера; то, что операции не нужно, не заполняется
+ */
+struct Input
+{
+    QImage image;
+    TiledImage document;
+    cv::Mat mat;
+    QString encodedFile;
+};
+
+/*!
+ * \brief The Operation struct операция и данные, которые она требует
+ */
+struct Operation
+{
+    const char *name;
+    bool needsDocument;
+    bool needsMat;
+    bool needsEncodedFile;
+    // Возвращает false, если операция не поддерживает формат
+    std::function<bool(const Input &)> run;
+};
+
+QImage testImage(const QSize &size, QImage::Format format)
+{
+    QImage image(size, format);
+    if (image.isNull())
+        return image;
+    const int bytesPerLine = image.width() * image.depth() / 8;
+    quint32 state = 2463534242u;
+    for (int y = 0; y < image.height(); ++y) {
+        uchar *line = image.scanLine(y);
+        // Градиент с шумом: фильтрам и кодировщикам нужна не однотонная картинка
+        for (int x = 0; x < bytesPerLine; ++x) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            line[x] = static_cast<uchar>(((x + y) >> 3) + (state & 31));
+        }
+    }
+    return image;
+}
+
+QVector<Operation> operations(const QString &directory)
+{
+    QVector<Operation> result;
+    result.append({ "brightness", true, false, false, [](const Input &in) {
+        return !Filters::brightness(in.document, 1.8, 40).isNull();
+    } });
+    result.append({ "sepia", true, false, false, [](const Input &in) {
+        return !Filters::sepia(in.document).isNull();
+    } });
+    result.append({ "equalize", true, false, false, [](const Input &in) {
+        return !Filters::histogramEqualization(in.document).isNull();
+    } });
+    result.append({ "homogeneous", true, false, false, [](const Input &in) {
+        return !Filters::homogeneous(in.document, KernelLength).isNull();
+    } });
+    result.append({ "gaussian", true, false, false, [](const Input &in) {
+        return !Filters::gaussian(in.document, KernelLength).isNull();
+    } });
+    result.append({ "median", true, false, false, [](const Input &in) {
+        return !Filters::median(in.document, KernelLength).isNull();
+    } });
+    result.append({ "bilateral", true, false, false, [](const Input &in) {
+        return !Filters::bilateral(in.document, KernelLength).isNull();
+    } });
+    result.append({ "crop", true, false, false, [](const Input &in) {
+        // Невыровненная по тайлам область, как при выделении мышью
+        const QRect area = in.document.rect().adjusted(in.document.width() / 7, in.document.height() / 9,
+                                                       -in.document.width() / 5, -in.document.height() / 6);
+        return !in.document.copyRegion(area).toImage().isNull();
+    } });
+    result.append({ "stroke", true, false, false, [](const Input &in) {
+        // 200 отрезков кисти через весь документ, как их рисует ImageViewer::paintPoint
+        TiledImage document = in.document;
+        QPen pen(Qt::red, 10, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+        const int segments = 200;
+        for (int i = 0; i < segments; ++i) {
+            const QPoint begin(document.width() * i / segments, document.height() / 2 + (i % 2) * 40);
+            const QPoint end(document.width() * (i + 1) / segments, document.height() / 2 + ((i + 1) % 2) * 40);
+            const int margin = pen.width() / 2 + 2;
+            document.paint(QRect(begin, end).normalized().adjusted(-margin, -margin, margin, margin),
+                           [&](QPainter &painter) {
+                painter.setRenderHint(QPainter::Antialiasing);
+                painter.setPen(pen);
+                painter.drawLine(begin, end);
+            });
+        }
+        return true;
+    } });
+    result.append({ "composite", true, false, false, [](const Input &in) {
+        // 12 слоев со всеми режимами наложения: на каждом полупрозрачная полоса через весь документ
+        QVector<Layer> list;
+        for (int i = 0; i < 12; ++i) {
+            Layer layer = Layer::create(QString::number(i), in.document.size());
+            layer.mode = static_cast<Layer::BlendMode>(i % Layer::BlendModeCount);
+            layer.opacity = 160;
+            const QRect band(0, in.document.height() * i / 12, in.document.width(), in.document.height() / 6);
+            layer.image.paint(band, [&](QPainter &painter) {
+                painter.fillRect(band, QColor(40 * i % 256, 255 - 20 * i, 128, 200));
+            });
+            list.append(layer);
+        }
+        LayerStack stack;
+        stack.setLayers(list);
+        return !stack.composite(in.document, in.document.rect()).isEmpty();
+    } });
+    result.append({ "color_transform", false, false, false, [](const Input &in) {
+        // Перевод Display P3 -> sRGB таблицей, как при показе документа широкого охвата (с копированием)
+        const std::shared_ptr<const ColorLut> lut = ColorManager::instance().transform(
+                    QColorSpace(QColorSpace::DisplayP3), QColorSpace(QColorSpace::SRgb));
+        QImage image = in.image.copy();
+        return lut->apply(image);
+    } });
+    result.append({ "lut", true, false, false, [](const Input &in) {
+        // Таблица 65^3, как у таблиц цветокоррекции наибольшего обычного размера
+        static const std::shared_ptr<const ColorLut> lut = ColorLut::fromColorSpaces(
+                    QColorSpace(QColorSpace::AdobeRgb), QColorSpace(QColorSpace::SRgb), 65);
+        return !Filters::colorLut(in.document, *lut).isNull();
+    } });
+    result.append({ "qimage_to_mat", false, false, false, [](const Input &in) {
+        // Вид без копирования не считается: меряется получение собственного буфера, как при обработке
+        const cv::Mat mat = Convert::QImageToCvMat(in.image);
+        return !mat.empty() && !mat.clone().empty();
+    } });
+    result.append({ "mat_to_qimage", false, true, false, [](const Input &in) {
+        const QImage image = Convert::cvMatToQImage(in.mat);
+        return !image.isNull() && !image.copy().isNull();
+    } });
+    result.append({ "save_jpeg", false, false, false, [directory](const Input &in) {
+        ImageSaver::Target target;
+        target.fileName = QDir(directory).filePath(QStringLiteral("save.jpg"));
+        QString error;
+        return ImageSaver::write(in.image, target, ImageSaver::Settings(), &error);
+    } });
+    result.append({ "save_png", false, false, false, [directory](const Input &in) {
+        ImageSaver::Target target;
+        target.fileName = QDir(directory).filePath(QStringLiteral("save.png"));
+        QString error;
+        return ImageSaver::write(in.image, target, ImageSaver::Settings(), &error);
+    } });
+    result.append({ "load_png", false, false, true, [](const Input &in) {
+        QImageReader reader(in.encodedFile);
+        return !reader.read().isNull();
+    } });
+    return result;
+}
+
+QList<int> intList(const QString &text)
+{
+    QList<int> result;
+    for (const QString &item : text.split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const int value = item.trimmed().toInt(&ok);
+        if (ok && value > 0)
+            result.append(value);
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    // QPainter и кодировщикам нужен QGuiApplication; окна не создаются
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    QTextStream err(stderr);
+    // Замеры не должны включать запись событий профилировщика
+    Profiler::instance().setEnabled(false);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Benchmarks every image operation of the editor and prints JSON."));
+    parser.addHelpOption();
+    const QCommandLineOption sizesOption(QStringLiteral("sizes"),
+            QStringLiteral("Image sizes in megapixels (default: 1,12,50,100)."), QStringLiteral("list"));
+    const QCommandLineOption threadsOption(QStringLiteral("threads"),
+            QStringLiteral("Thread counts (default: 1 and the number of cores)."), QStringLiteral("list"));
+    const QCommandLineOption formatsOption(QStringLiteral("formats"),
+            QStringLiteral("Pixel formats: rgb32, argb32, rgb888, gray8, rgba64 (default: rgb32,rgb888)."), QStringLiteral("list"));
+    const QCommandLineOption opsOption(QStringLiteral("ops"),
+            QStringLiteral("Operations to run (default: all)."), QStringLiteral("list"));
+    const QCommandLineOption repeatOption(QStringLiteral("repeat"),
+            QStringLiteral("Runs per measurement (default: 3)."), QStringLiteral("n"));
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+            QStringLiteral("Write JSON to a file instead of stdout."), QStringLiteral("file"));
+    parser.addOptions({ sizesOption, threadsOption, formatsOption, opsOption, repeatOption, outputOption });
+    parser.process(app);
+
+    const QList<int> sizes = parser.isSet(sizesOption) ? intList(parser.value(sizesOption)) : QList<int>{ 1, 12, 50, 100 };
+    QList<int> threads = intList(parser.value(threadsOption));
+    if (threads.isEmpty()) {
+        threads.append(1);
+        if (QThread::idealThreadCount() > 1)
+            threads.append(QThread::idealThreadCount());
+    }
+    const QStringList formatNames = parser.value(formatsOption).isEmpty()
+            ? QStringList{ QStringLiteral("rgb32"), QStringLiteral("rgb888") }
+            : parser.value(formatsOption).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    const QStringList selected = parser.value(opsOption).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    const int repeat = qMax(1, parser.value(repeatOption).toInt() > 0 ? parser.value(repeatOption).toInt() : 3);
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        err << "cannot create a temporary directory" << Qt::endl;
+        return 2;
+    }
+    QVector<Operation> all = operations(directory.path());
+    QVector<Operation> ops;
+    for (const Operation &op : all) {
+        if (selected.isEmpty() || selected.contains(QLatin1String(op.name)))
+            ops.append(op);
+    }
+
+    QJsonArray results;
+    for (const QString &formatName : formatNames) {
+        const FormatInfo *info = std::find_if(std::begin(Formats), std::end(Formats), [&](const FormatInfo &f) {
+            return formatName.trimmed() == QLatin1String(f.name);
+        });
+        if (info == std::end(Formats)) {
+            err << "unknown format " << formatName << Qt::endl;
+            return 2;
+        }
+        for (int megapixels : sizes) {
+            const int width = qRound(qSqrt(megapixels * 1e6 * 4 / 3));
+            const QSize size(width, qRound(megapixels * 1e6 / width));
+            Input input;
+            input.image = testImage(size, info->format);
+            if (input.image.isNull()) {
+                err << "cannot allocate " << megapixels << " MP " << info->name << Qt::endl;
+                continue;
+            }
+            bool inputsReady = false;
+
+            for (int threadCount : threads) {
+                cv::setNumThreads(threadCount);
+                for (const Operation &op : ops) {
+                    // Документ, матрица и файл готовятся один раз на размер и формат
+                    if (!inputsReady && (op.needsDocument || op.needsMat || op.needsEncodedFile)) {
+                        input.document = TiledImage::fromImage(input.image);
+                        input.mat = Convert::QImageToCvMat(input.image).clone();
+                        ImageSaver::Target target;
+                        target.fileName = QDir(directory.path()).filePath(QStringLiteral("input.png"));
+                        QString error;
+                        ImageSaver::Settings fast;
+                        fast.pngCompression = 1;
+                        if (ImageSaver::write(input.image, target, fast, &error))
+                            input.encodedFile = target.fileName;
+                        inputsReady = true;
+                    }
+                    if ((op.needsMat && input.mat.empty()) || (op.needsEncodedFile && input.encodedFile.isEmpty()))
+                        continue;
+
+                    QVector<double> times;
+                    bool supported = true;
+                    for (int i = 0; i < repeat && supported; ++i) {
+                        QElapsedTimer timer;
+                        timer.start();
+                        supported = op.run(input);
+                        times.append(timer.nsecsElapsed() / 1e6);
+                    }
+                    std::sort(times.begin(), times.end());
+                    QJsonObject entry;
+                    entry.insert(QStringLiteral("operation"), QLatin1String(op.name));
+                    entry.insert(QStringLiteral("format"), QLatin1String(info->name));
+                    entry.insert(QStringLiteral("megapixels"), megapixels);
+                    entry.insert(QStringLiteral("width"), size.width());
+                    entry.insert(QStringLiteral("height"), size.height());
+                    entry.insert(QStringLiteral("threads"), threadCount);
+                    if (!supported) {
+                        entry.insert(QStringLiteral("error"), QStringLiteral("unsupported"));
+                    } else {
+                        const double pixels = double(size.width()) * size.height();
+                        entry.insert(QStringLiteral("runs"), times.size());
+                        entry.insert(QStringLiteral("min_ms"), times.first());
+                        entry.insert(QStringLiteral("median_ms"), times.at(times.size() / 2));
+                        entry.insert(QStringLiteral("mp_per_s"), pixels / 1e6 / (times.first() / 1000));
+                    }
+                    results.append(entry);
+                    err << op.name << " " << info->name << " " << megapixels << " MP x" << threadCount << ": "
+                        << (supported ? QString::number(times.first(), 'f', 1) + QStringLiteral(" ms") : QStringLiteral("unsupported"))
+                        << Qt::endl;
+                }
+            }
+        }
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("schema"), 1);
+    report.insert(QStringLiteral("qt"), QLatin1String(qVersion()));
+    report.insert(QStringLiteral("opencv"), QLatin1String(CV_VERSION));
+    report.insert(QStringLiteral("cores"), QThread::idealThreadCount());
+    report.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            err << "cannot write " << file.fileName() << ": " << file.errorString() << Qt::endl;
+            return 2;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
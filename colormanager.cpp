@@ -0,0 +1,319 @@
+#include "colormanager.h"
+#include "profiler.h"
+
+#include <QColorTransform>
+#include <QGlobalStatic>
+#include <QMutexLocker>
+#include <QRgba64>
+#include <limits>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+Q_GLOBAL_STATIC(ColorManager, globalColorManager)
+
+namespace {
+
+// Вспомогательные функции для скаляров и для векторов по 4 значения: одна и та же функция
+// интерполяции компилируется для хвоста строки и для векторного цикла.
+
+inline void splat(float value, float &out) { out = value; }
+inline void splat(int value, int &out) { out = value; }
+inline float largest(float a, float b) { return a > b ? a : b; }
+inline float smallest(float a, float b) { return a < b ? a : b; }
+inline int floorIndex(float x, int last) { return qMin(int(x), last); }
+inline float toFloat(int x) { return float(x); }
+inline int pick(bool mask, int a, int b) { return mask ? a : b; }
+inline float fetch(const float *table, int index) { return table[index]; }
+
+#if CV_SIMD128
+inline void splat(float value, cv::v_float32x4 &out) { out = cv::v_setall_f32(value); }
+inline void splat(int value, cv::v_int32x4 &out) { out = cv::v_setall_s32(value); }
+inline cv::v_float32x4 largest(const cv::v_float32x4 &a, const cv::v_float32x4 &b) { return cv::v_max(a, b); }
+inline cv::v_float32x4 smallest(const cv::v_float32x4 &a, const cv::v_float32x4 &b) { return cv::v_min(a, b); }
+inline cv::v_int32x4 floorIndex(const cv::v_float32x4 &x, int last) { return cv::v_min(cv::v_floor(x), cv::v_setall_s32(last)); }
+inline cv::v_float32x4 toFloat(const cv::v_int32x4 &x) { return cv::v_cvt_f32(x); }
+inline cv::v_int32x4 pick(const cv::v_float32x4 &mask, const cv::v_int32x4 &a, const cv::v_int32x4 &b)
+{
+    return cv::v_select(cv::v_reinterpret_as_s32(mask), a, b);
+}
+inline cv::v_float32x4 fetch(const float *table, const cv::v_int32x4 &index) { return cv::v_lut(table, index); }
+#endif
+
+/*
+ * Тетраэдрическая интерполяция в точке (red, green, blue), заданной в координатах сетки 0..size-1.
+ * Доли f внутри куба сортируются: f1 >= f2 >= f3. Путь из младшей вершины куба в старшую идет сначала
+ * по оси с наибольшей долей (вершина A), затем по средней (вершина B); результат -
+ * (1 - f1) * V000 + (f1 - f2) * A + (f2 - f3) * B + f3 * V111.
+ * Ось наибольшей доли и ось наименьшей выбираются сравнениями, поэтому ветвлений нет и в векторном коде.
+ */
+template <typename F, typename I>
+inline void interpolate(const float *table, int size, const F &red, const F &green, const F &blue,
+                        F &outRed, F &outGreen, F &outBlue)
+{
+    F one;
+    splat(1.0f, one);
+    I redStep, greenStep, blueStep, diagonal;
+    splat(3, redStep);
+    splat(3 * size, greenStep);
+    splat(3 * size * size, blueStep);
+    splat(3 + 3 * size + 3 * size * size, diagonal);
+
+    const I r0 = floorIndex(red, size - 2);
+    const I g0 = floorIndex(green, size - 2);
+    const I b0 = floorIndex(blue, size - 2);
+    const F fr = red - toFloat(r0);
+    const F fg = green - toFloat(g0);
+    const F fb = blue - toFloat(b0);
+    // Индекс считается в целых: в float он точен только до 2^24, то есть до сетки примерно из 177 узлов
+    const I base = r0 * redStep + g0 * greenStep + b0 * blueStep;
+
+    const I stepMax = pick((fr >= fg) & (fr >= fb), redStep, pick(fg >= fb, greenStep, blueStep));
+    const I stepMin = pick((fb <= fr) & (fb <= fg), blueStep, pick(fg <= fr, greenStep, redStep));
+    const F f1 = largest(largest(fr, fg), fb);
+    const F f3 = smallest(smallest(fr, fg), fb);
+    const F f2 = fr + fg + fb - f1 - f3;
+    const F w0 = one - f1;
+    const F w1 = f1 - f2;
+    const F w2 = f2 - f3;
+
+    const I vertexA = base + stepMax;
+    const I vertexB = base + diagonal - stepMin;
+    const I vertexEnd = base + diagonal;
+    F *outputs[3] = { &outRed, &outGreen, &outBlue };
+    for (int c = 0; c < 3; ++c) {
+        const float *channel = table + c;
+        *outputs[c] = fetch(channel, base) * w0 + fetch(channel, vertexA) * w1
+                + fetch(channel, vertexB) * w2 + fetch(channel, vertexEnd) * f3;
+    }
+}
+
+#if CV_SIMD128
+inline void loadPlanes(const uchar *pixels, cv::v_uint8x16 *planes, int channels)
+{
+    if (channels == 4)
+        cv::v_load_deinterleave(pixels, planes[0], planes[1], planes[2], planes[3]);
+    else
+        cv::v_load_deinterleave(pixels, planes[0], planes[1], planes[2]);
+}
+inline void loadPlanes(const ushort *pixels, cv::v_uint16x8 *planes, int channels)
+{
+    if (channels == 4)
+        cv::v_load_deinterleave(pixels, planes[0], planes[1], planes[2], planes[3]);
+    else
+        cv::v_load_deinterleave(pixels, planes[0], planes[1], planes[2]);
+}
+inline void storePlanes(uchar *pixels, const cv::v_uint8x16 *planes, int channels)
+{
+    if (channels == 4)
+        cv::v_store_interleave(pixels, planes[0], planes[1], planes[2], planes[3]);
+    else
+        cv::v_store_interleave(pixels, planes[0], planes[1], planes[2]);
+}
+// Вектор из элементов типа T для applyRow
+template <typename T> struct Vector;
+template <> struct Vector<uchar> { typedef cv::v_uint8x16 Type; };
+template <> struct Vector<ushort> { typedef cv::v_uint16x8 Type; };
+
+inline void storePlanes(ushort *pixels, const cv::v_uint16x8 *planes, int channels)
+{
+    if (channels == 4)
+        cv::v_store_interleave(pixels, planes[0], planes[1], planes[2], planes[3]);
+    else
+        cv::v_store_interleave(pixels, planes[0], planes[1], planes[2]);
+}
+
+// Расширение канала до чисел с плавающей точкой по 4 значения и обратное сужение с насыщением
+inline void widen(const cv::v_uint16x8 &plane, cv::v_float32x4 *out)
+{
+    cv::v_uint32x4 low, high;
+    cv::v_expand(plane, low, high);
+    out[0] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(low));
+    out[1] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(high));
+}
+inline void widen(const cv::v_uint8x16 &plane, cv::v_float32x4 *out)
+{
+    cv::v_uint16x8 low, high;
+    cv::v_expand(plane, low, high);
+    widen(low, out);
+    widen(high, out + 2);
+}
+inline void narrow(const cv::v_float32x4 *in, cv::v_uint16x8 &plane)
+{
+    plane = cv::v_pack_u(cv::v_round(in[0]), cv::v_round(in[1]));
+}
+inline void narrow(const cv::v_float32x4 *in, cv::v_uint8x16 &plane)
+{
+    cv::v_uint16x8 low, high;
+    narrow(in, low);
+    narrow(in + 2, high);
+    plane = cv::v_pack(low, high);
+}
+#endif
+
+/*
+ * Строка из width пикселей по Channels каналов типа T. Каналы R и B стоят
+ * на местах red и 2 - red; четвертый канал (альфа или заполнитель) не меняется.
+ */
+template <typename T, int Channels>
+void applyRow(const float *table, int size, T *row, int width, int red)
+{
+    const float maximum = std::numeric_limits<T>::max();
+    const float toGrid = (size - 1) / maximum;
+    const int blue = 2 - red;
+    int x = 0;
+#if CV_SIMD128
+    typedef typename Vector<T>::Type V;
+    const int lanes = V::nlanes;
+    const cv::v_float32x4 gridScale = cv::v_setall_f32(toGrid);
+    const cv::v_float32x4 outputScale = cv::v_setall_f32(maximum);
+    for (; x <= width - lanes; x += lanes) {
+        V planes[4];
+        loadPlanes(row + x * Channels, planes, Channels);
+        cv::v_float32x4 r[lanes / 4], g[lanes / 4], b[lanes / 4];
+        widen(planes[red], r);
+        widen(planes[1], g);
+        widen(planes[blue], b);
+        for (int i = 0; i < lanes / 4; ++i) {
+            interpolate<cv::v_float32x4, cv::v_int32x4>(table, size, r[i] * gridScale, g[i] * gridScale,
+                                                         b[i] * gridScale, r[i], g[i], b[i]);
+            r[i] = r[i] * outputScale;
+            g[i] = g[i] * outputScale;
+            b[i] = b[i] * outputScale;
+        }
+        narrow(r, planes[red]);
+        narrow(g, planes[1]);
+        narrow(b, planes[blue]);
+        storePlanes(row + x * Channels, planes, Channels);
+    }
+#endif
+    for (; x < width; ++x) {
+        T *pixel = row + x * Channels;
+        float r, g, b;
+        interpolate<float, int>(table, size, pixel[red] * toGrid, pixel[1] * toGrid, pixel[blue] * toGrid, r, g, b);
+        pixel[red] = static_cast<T>(qBound(0.0f, r, 1.0f) * maximum + 0.5f);
+        pixel[1] = static_cast<T>(qBound(0.0f, g, 1.0f) * maximum + 0.5f);
+        pixel[blue] = static_cast<T>(qBound(0.0f, b, 1.0f) * maximum + 0.5f);
+    }
+}
+
+}
+
+ColorLut::ColorLut(int size, std::vector<float> values)
+    : gridSize(size), table(std::move(values))
+{
+    Q_ASSERT(size >= 2 && table.size() == size_t(size) * size * size * 3);
+}
+
+std::shared_ptr<const ColorLut> ColorLut::fromColorSpaces(const QColorSpace &source, const QColorSpace &target, int size)
+{
+    TRACE_SCOPE("ColorLut::fromColorSpaces");
+    const QColorTransform transform = source.transformationToColorSpace(target);
+    std::vector<float> table(size_t(size) * size * size * 3);
+    float *entry = table.data();
+    for (int b = 0; b < size; ++b) {
+        for (int g = 0; g < size; ++g) {
+            for (int r = 0; r < size; ++r) {
+                const QRgba64 color = transform.map(QRgba64::fromRgba64(quint16(r * 65535 / (size - 1)),
+                                                                        quint16(g * 65535 / (size - 1)),
+                                                                        quint16(b * 65535 / (size - 1)), 65535));
+                *entry++ = color.red() / 65535.0f;
+                *entry++ = color.green() / 65535.0f;
+                *entry++ = color.blue() / 65535.0f;
+            }
+        }
+    }
+    return std::make_shared<const ColorLut>(size, std::move(table));
+}
+
+bool ColorLut::supports(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGB888:
+    case QImage::Format_BGR888:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBX64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ColorLut::apply(QImage &image, int begin, int end) const
+{
+    if (!supports(image.format()))
+        return false;
+    const QImage::Format format = image.format();
+    const int width = image.width();
+    for (int y = qMax(0, begin); y < qMin(end, image.height()); ++y) {
+        uchar *line = image.scanLine(y);
+        switch (format) {
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+            // В памяти B, G, R, A
+            applyRow<uchar, 4>(table.data(), gridSize, line, width, 2);
+            break;
+        case QImage::Format_RGBA8888:
+        case QImage::Format_RGBX8888:
+            applyRow<uchar, 4>(table.data(), gridSize, line, width, 0);
+            break;
+        case QImage::Format_RGB888:
+            applyRow<uchar, 3>(table.data(), gridSize, line, width, 0);
+            break;
+        case QImage::Format_BGR888:
+            applyRow<uchar, 3>(table.data(), gridSize, line, width, 2);
+            break;
+        default:
+            applyRow<ushort, 4>(table.data(), gridSize, reinterpret_cast<ushort *>(line), width, 0);
+            break;
+        }
+    }
+    return true;
+}
+
+ColorManager &ColorManager::instance()
+{
+    return *globalColorManager();
+}
+
+QColorSpace ColorManager::displayColorSpace() const
+{
+    QMutexLocker locker(&mutex);
+    return display;
+}
+
+void ColorManager::setDisplayColorSpace(const QColorSpace &space)
+{
+    QMutexLocker locker(&mutex);
+    display = space.isValid() ? space : QColorSpace(QColorSpace::SRgb);
+}
+
+std::shared_ptr<const ColorLut> ColorManager::displayTransform(const QColorSpace &source)
+{
+    return transform(source, displayColorSpace());
+}
+
+std::shared_ptr<const ColorLut> ColorManager::transform(const QColorSpace &source, const QColorSpace &target)
+{
+    if (!source.isValid() || !target.isValid() || source == target)
+        return nullptr;
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i < cache.size(); ++i) {
+        if (cache.at(i).source == source && cache.at(i).target == target) {
+            const Entry entry = cache.takeAt(i);
+            cache.prepend(entry);
+            return entry.lut;
+        }
+    }
+    Entry entry;
+    entry.source = source;
+    entry.target = target;
+    entry.lut = ColorLut::fromColorSpaces(source, target, GridSize);
+    cache.prepend(entry);
+    if (cache.size() > MaxEntries)
+        cache.removeLast();
+    return entry.lut;
+}
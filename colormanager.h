@@ -0,0 +1,111 @@
+#ifndef COLORMANAGER_H
+#define COLORMANAGER_H
+
+#include <QColorSpace>
+#include <QImage>
+#include <QMutex>
+#include <QVector>
+#include <memory>
+#include <vector>
+
+/*!
+ * \brief The ColorLut class трехмерная таблица преобразования цвета (3D LUT).
+ *
+ * Таблица задает выходной цвет в узлах равномерной сетки size x size x size входных цветов,
+ * между узлами цвет интерполируется тетраэдрически: куб сетки делится на шесть тетраэдров,
+ * и результат - взвешенная сумма четырех вершин (вместо восьми у трилинейной интерполяции).
+ * Пиксели обрабатываются векторными инструкциями OpenCV по четыре за раз.
+ */
+class ColorLut
+{
+public:
+    /*!
+     * \brief ColorLut создает таблицу
+     * \param size число узлов сетки по каждой оси (не меньше 2)
+     * \param values size^3 троек R, G, B в диапазоне 0..1; быстрее всего меняется индекс красного, медленнее всего - синего
+     */
+    ColorLut(int size, std::vector<float> values);
+
+    /*!
+     * \brief fromColorSpaces таблица преобразования из цветового пространства source в target
+     * \param size число узлов сетки по каждой оси
+     */
+    static std::shared_ptr<const ColorLut> fromColorSpaces(const QColorSpace &source, const QColorSpace &target, int size);
+
+    int size() const { return gridSize; }
+    /*!
+     * \brief supports true, если apply умеет обрабатывать формат на месте
+     * (8 и 16 бит на канал без премультипликации альфы; альфа не меняется)
+     */
+    static bool supports(QImage::Format format);
+    /*!
+     * \brief apply преобразует цвета строк [begin, end) изображения на месте
+     * \return false, если формат не поддерживается (см. supports)
+     */
+    bool apply(QImage &image, int begin, int end) const;
+    bool apply(QImage &image) const { return apply(image, 0, image.height()); }
+
+private:
+    int gridSize;
+    std::vector<float> table;
+};
+
+/*!
+ * \brief The ColorManager class преобразования цвета для показа документа на экране.
+ *
+ * Документ хранится в своем исходном цветовом пространстве: пиксели не конвертируются ни при загрузке,
+ * ни при отмене и повторе, и цвета широкого охвата не обрезаются до sRGB. В пространство экрана переводится
+ * только то, что рисуется в области просмотра. Таблица (ColorLut) для пары (пространство документа,
+ * пространство экрана) строится один раз и хранится в кэше. Методы потокобезопасны.
+ */
+class ColorManager
+{
+public:
+    /*!
+     * \brief GridSize число узлов сетки таблиц преобразования для показа
+     */
+    static const int GridSize = 33;
+
+    /*!
+     * \brief instance общий экземпляр приложения
+     */
+    static ColorManager &instance();
+
+    /*!
+     * \brief displayColorSpace цветовое пространство экрана (по умолчанию sRGB)
+     */
+    QColorSpace displayColorSpace() const;
+    void setDisplayColorSpace(const QColorSpace &space);
+    /*!
+     * \brief displayTransform таблица перевода из source в пространство экрана
+     * \return nullptr, если преобразование не нужно (пространства совпадают или source не задано)
+     */
+    std::shared_ptr<const ColorLut> displayTransform(const QColorSpace &source);
+    /*!
+     * \brief transform таблица перевода из source в target из кэша (строится при первом запросе)
+     * \return nullptr, если преобразование не нужно
+     */
+    std::shared_ptr<const ColorLut> transform(const QColorSpace &source, const QColorSpace &target);
+
+    ColorManager() = default;
+
+private:
+    Q_DISABLE_COPY(ColorManager)
+
+    struct Entry
+    {
+        QColorSpace source;
+        QColorSpace target;
+        std::shared_ptr<const ColorLut> lut;
+    };
+    /*!
+     * \brief MaxEntries число хранимых таблиц; недавно использованные стоят в начале списка
+     */
+    static const int MaxEntries = 8;
+
+    mutable QMutex mutex;
+    QColorSpace display = QColorSpace(QColorSpace::SRgb);
+    QVector<Entry> cache;
+};
+
+#endif // COLORMANAGER_H
@@ -1,23 +1,115 @@
 #include "commands.h"
 
-AddCommand::AddCommand(QImage &image, QImage &imageBefore, ImageViewer *mainWindow, QUndoCommand *parent)
-    : QUndoCommand(parent), imageViewer(mainWindow)
+CropCommand::CropCommand(const QRect &crop, ImageViewer *mainWindow, QUndoCommand *parent)
+    : QUndoCommand(parent), imageViewer(mainWindow), cropBefore(mainWindow->currentCrop()), cropAfter(crop)
 {
+}
 
-    this->image = image;
-    this->imageBefore = imageBefore;
-    imageViewer->setImage(image);
+void CropCommand::undo()
+{
+    imageViewer->setCrop(cropBefore);
 }
 
-void AddCommand::undo()
+void CropCommand::redo()
 {
-    imageViewer->setImage(imageBefore);
+    imageViewer->setCrop(cropAfter);
+}
 
+AdjustmentCommand::AdjustmentCommand(const QVector<Adjustment> &adjustments, ImageViewer *mainWindow, QUndoCommand *parent)
+    : QUndoCommand(parent), imageViewer(mainWindow), before(mainWindow->currentAdjustments()), after(adjustments)
+{
 }
-void AddCommand::redo()
+
+void AdjustmentCommand::undo()
 {
-    imageViewer->setImage(image);
+    imageViewer->setAdjustments(before);
 }
 
+void AdjustmentCommand::redo()
+{
+    imageViewer->setAdjustments(after);
+}
 
+LayerCommand::LayerCommand(const QVector<Layer> &before, const QVector<Layer> &after, ImageViewer *mainWindow,
+                           int mergeKey, QUndoCommand *parent)
+    : QUndoCommand(parent), imageViewer(mainWindow), before(before), after(after), mergeKey(mergeKey)
+{
+    const int count = qMax(before.size(), after.size());
+    layerSize = count == 0 ? QSize() : (before.isEmpty() ? after : before).first().image.size();
+    const TiledImage empty = Layer::create(QString(), layerSize).image;
+    for (int i = 0; i < count; ++i) {
+        // Тайлы, общие для обоих состояний (свойства слоя, другие слои), не сравниваются
+        deltas.append(QSharedPointer<ImageDelta>::create(i < before.size() ? before.at(i).image : empty,
+                                                         i < after.size() ? after.at(i).image : empty));
+    }
+    for (Layer &layer : this->before)
+        layer.image = TiledImage();
+    for (Layer &layer : this->after)
+        layer.image = TiledImage();
+    imageViewer->setLayers(after);
+}
+
+void LayerCommand::undo()
+{
+    if (applied)
+        toggle();
+}
+
+void LayerCommand::redo()
+{
+    if (!applied)
+        toggle();
+}
 
+void LayerCommand::toggle()
+{
+    const QVector<Layer> &current = imageViewer->currentLayers();
+    QVector<Layer> list = applied ? before : after;
+    const TiledImage empty = Layer::create(QString(), layerSize).image;
+    for (int i = 0; i < deltas.size(); ++i) {
+        TiledImage image = i < current.size() ? current.at(i).image : empty;
+        deltas.at(i)->apply(image);
+        if (i < list.size())
+            list[i].image = image;
+    }
+    imageViewer->setLayers(list);
+    applied = !applied;
+}
+
+bool LayerCommand::changesPixels() const
+{
+    for (const QSharedPointer<ImageDelta> &delta : deltas) {
+        if (!delta->region().isEmpty())
+            return true;
+    }
+    return false;
+}
+
+bool LayerCommand::mergeWith(const QUndoCommand *other)
+{
+    const LayerCommand *command = static_cast<const LayerCommand *>(other);
+    // Разницы пикселей не складываются, поэтому сливаются только изменения свойств одних и тех же слоев
+    if (command->mergeKey != mergeKey || command->before.size() != after.size()
+            || command->after.size() != after.size() || changesPixels() || command->changesPixels())
+        return false;
+    after = command->after;
+    return true;
+}
+
+qint64 LayerCommand::residentBytes() const
+{
+    qint64 bytes = 0;
+    for (const QSharedPointer<ImageDelta> &delta : deltas)
+        bytes += delta->residentBytes();
+    return bytes;
+}
+
+bool LayerCommand::spill()
+{
+    bool spilled = false;
+    for (const QSharedPointer<ImageDelta> &delta : deltas) {
+        if (delta->residentBytes() > 0)
+            spilled = delta->spill() || spilled;
+    }
+    return spilled;
+}
@@ -1,41 +1,116 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <QSharedPointer>
 #include <QUndoCommand>
 #include <imageviewer.h>
+#include "imagedelta.h"
 /*!
- * \brief The AddCommand class наследуется от QUndoCommand.
- * Дает возможность записывать пользовательские действия в стэк.
+ * \brief The CropCommand class обрезка документа. Пиксели не копируются и не сравниваются:
+ * команда хранит только видимые области до и после обрезки (см. ImageViewer::setCrop).
  */
-class AddCommand : public QUndoCommand
+class CropCommand : public QUndoCommand
 {
 public:
     /*!
-     * \brief устанавливает поля image (изображение после совершения какого-либо действия) и
-     *  imageBefore (изображение до совершения какого-либо действия).
-     *  Устанавливает изображение после совершения действия в главную форму.
-     * \param image изображение после действия
-     * \param imageBefore изображение до совершения действия
+     * \param crop новая видимая область в координатах документа
      * \param mainWindow указатель на главную форму
      * \param parent экзэмпляр родительского класса
      */
-    AddCommand(QImage &image, QImage &imageBefore, ImageViewer *mainWindow,
-               QUndoCommand *parent = nullptr);
+    CropCommand(const QRect &crop, ImageViewer *mainWindow, QUndoCommand *parent = nullptr);
+    void undo() override;
+    void redo() override;
+
+private:
+    ImageViewer *imageViewer = nullptr;
+    QRect cropBefore;
+    QRect cropAfter;
+};
+
+/*!
+ * \brief The AdjustmentCommand class заменяет список операций неразрушающего редактирования.
+ * Хранит только списки операций со значениями слайдеров, а не пиксели: результат
+ * пересчитывается из документа при отмене и повторе (см. AdjustmentStack).
+ */
+class AdjustmentCommand : public QUndoCommand
+{
+public:
     /*!
-     * \brief undo Отменяет выполненное действие.
-     * Устанавливает в главное окно ImageViewer изображение imageBefore
+     * \param adjustments список операций после действия
+     * \param mainWindow указатель на главную форму
+     * \param parent экзэмпляр родительского класса
      */
+    AdjustmentCommand(const QVector<Adjustment> &adjustments, ImageViewer *mainWindow, QUndoCommand *parent = nullptr);
     void undo() override;
+    void redo() override;
+
+private:
+    ImageViewer *imageViewer = nullptr;
+    QVector<Adjustment> before;
+    QVector<Adjustment> after;
+};
+
+/*!
+ * \brief The LayerCommand class заменяет слои аннотаций (мазок, текст, свойства и порядок слоев).
+ * Команда хранит свойства слоев до и после действия, а пиксели - только как сжатую разницу
+ * изображений каждого слоя (см. ImageDelta): применение разницы к текущим слоям дает другое состояние.
+ * Слою, которого нет в одном из состояний, соответствует пустой прозрачный слой.
+ * Разницу можно выгрузить во временный файл (см. ImageViewer::enforceUndoBudget).
+ * Конструктор сам устанавливает слои после действия.
+ */
+class LayerCommand : public QUndoCommand
+{
+public:
     /*!
-     * \brief redo Возвращает выполенное действие после его отмены.
-     * Устанавливает в главное окно ImageViewer изображение image.
+     * \param before слои до действия
+     * \param after слои после действия
+     * \param mainWindow указатель на главную форму
+     * \param mergeKey номер слоя: подряд идущие команды с одинаковым mergeKey сливаются в одну
+     * (перетаскивание слайдера непрозрачности); -1 - команда не сливается
+     * \param parent экзэмпляр родительского класса
      */
+    LayerCommand(const QVector<Layer> &before, const QVector<Layer> &after, ImageViewer *mainWindow,
+                 int mergeKey = -1, QUndoCommand *parent = nullptr);
+    void undo() override;
     void redo() override;
+    int id() const override { return mergeKey < 0 ? -1 : 1; }
+    /*!
+     * \brief mergeWith сливает команды, не менявшие пиксели (свойства слоя)
+     */
+    bool mergeWith(const QUndoCommand *other) override;
+    /*!
+     * \brief residentBytes объем оперативной памяти, занятый командой
+     */
+    qint64 residentBytes() const;
+    /*!
+     * \brief spill выгружает разницу слоев во временный файл
+     * \return true, если данные выгружены
+     */
+    bool spill();
 
 private:
-    QImage image;
-    QImage imageBefore;
+    /*!
+     * \brief toggle переключает слои главного окна между состояниями до и после действия
+     */
+    void toggle();
+    bool changesPixels() const;
+
     ImageViewer *imageViewer = nullptr;
+    /*!
+     * \brief before, after свойства слоев до и после действия (изображения не хранятся)
+     */
+    QVector<Layer> before;
+    QVector<Layer> after;
+    /*!
+     * \brief deltas разница изображений слоя i для i < max(before.size(), after.size())
+     */
+    QVector<QSharedPointer<ImageDelta>> deltas;
+    QSize layerSize;
+    int mergeKey = -1;
+    /*!
+     * \brief applied true, если слои главного окна сейчас находятся в состоянии после действия
+     */
+    bool applied = true;
 };
 
 #endif
@@ -1,109 +1,286 @@
 #include "convert.h"
 
-cv::Mat Convert::QImageToCvMat(const QImage &inImage)
+namespace {
+
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 1 || (CV_VERSION_MINOR == 1 && CV_VERSION_REVISION >= 2)))
+typedef cv::AccessFlag AccessFlags;
+#else
+typedef int AccessFlags;
+#endif
+
+/*
+ * Аллокатор для матриц, построенных над буфером QImage: при освобождении
+ * последней ссылки на матрицу удаляет удерживаемую копию QImage.
+ * Новые буферы (если такую матрицу пересоздают через create) выделяет стандартный аллокатор.
+ */
+class QImageHolderAllocator : public cv::MatAllocator
 {
-    switch ( inImage.format() )
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           AccessFlags flags, cv::UMatUsageFlags usageFlags) const override
     {
-       case QImage::Format_ARGB32:
-       case QImage::Format_ARGB32_Premultiplied:
-       {
-          cv::Mat  mat( inImage.height(), inImage.width(),
-                        CV_8UC4,
-                        const_cast<uchar*>(inImage.bits()),
-                        static_cast<size_t>(inImage.bytesPerLine())
-                        );
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
 
-          return mat;
-       }
+    bool allocate(cv::UMatData *data, AccessFlags accessFlags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData *u) const override
+    {
+        if (!u)
+            return;
+        delete static_cast<QImage *>(u->userdata);
+        delete u;
+    }
+};
+
+const QImageHolderAllocator *holderAllocator()
+{
+    static QImageHolderAllocator allocator;
+    return &allocator;
+}
+
+void releaseMat(void *info)
+{
+    delete static_cast<cv::Mat *>(info);
+}
 
+void setReport(Convert::Report *report, bool copied, bool swizzled, const char *route)
+{
+    if (!report)
+        return;
+    report->copied = copied;
+    report->swizzled = swizzled;
+    report->route = route;
+}
+
+bool hasIdentityGrayPalette(const QImage &image)
+{
+    const QVector<QRgb> table = image.colorTable();
+    if (table.size() != 256)
+        return false;
+    for (int i = 0; i < 256; ++i) {
+        if (table[i] != qRgb(i, i, i))
+            return false;
+    }
+    return true;
+}
+
+}
+
+cv::Mat Convert::wrapQImage(const QImage &inImage, int type)
+{
+    QImage *holder = new QImage(inImage);
+    cv::Mat mat( holder->height(), holder->width(), type,
+                 const_cast<uchar*>(holder->constBits()),
+                 static_cast<size_t>(holder->bytesPerLine()) );
+
+    cv::UMatData *u = new cv::UMatData(holderAllocator());
+    u->data = u->origdata = mat.data;
+    u->size = mat.step[0] * static_cast<size_t>(mat.rows);
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+    u->userdata = holder;
+    u->refcount = 1;
+    mat.u = u;
+    return mat;
+}
+
+QImage Convert::wrapCvMat(const cv::Mat &inMat, QImage::Format format)
+{
+    cv::Mat *holder = new cv::Mat(inMat);
+    return QImage( holder->data,
+                   holder->cols, holder->rows,
+                   static_cast<int>(holder->step),
+                   format, releaseMat, holder );
+}
+
+int Convert::rawMatType(QImage::Format format)
+{
+    switch ( format )
+    {
        case QImage::Format_RGB32:
-       {
+       case QImage::Format_ARGB32:
+       case QImage::Format_ARGB32_Premultiplied:
+       case QImage::Format_RGBA8888:
+       case QImage::Format_RGBA8888_Premultiplied:
+       case QImage::Format_RGBX8888:
+          return CV_8UC4;
+       case QImage::Format_RGB888:
+       case QImage::Format_BGR888:
+          return CV_8UC3;
+       case QImage::Format_Grayscale8:
+          return CV_8UC1;
+       case QImage::Format_Grayscale16:
+          return CV_16UC1;
+       case QImage::Format_RGBA64:
+       case QImage::Format_RGBA64_Premultiplied:
+       case QImage::Format_RGBX64:
+          return CV_16UC4;
+       default:
+          return -1;
+    }
+}
 
-          cv::Mat  mat( inImage.height(), inImage.width(),
-                        CV_8UC4,
-                        const_cast<uchar*>(inImage.bits()),
-                        static_cast<size_t>(inImage.bytesPerLine())
-                        );
+cv::Mat Convert::rawMat(QImage &image)
+{
+    const int type = rawMatType(image.format());
+    if (type < 0 || image.isNull())
+       return cv::Mat();
+    uchar *bits = image.bits();
+    return cv::Mat( image.height(), image.width(), type, bits, static_cast<size_t>(image.bytesPerLine()) );
+}
 
-          cv::Mat  matNoAlpha;
+cv::Mat Convert::QImageToCvMat(const QImage &inImage, Report *report)
+{
+    switch ( inImage.format() )
+    {
+       case QImage::Format_Invalid:
+          setReport(report, false, false, "Invalid -> empty");
+          return cv::Mat();
 
-          cv::cvtColor( mat, matNoAlpha, cv::COLOR_BGRA2BGR );   // drop the all-white alpha channel
+       case QImage::Format_ARGB32:
+       case QImage::Format_ARGB32_Premultiplied:
+       case QImage::Format_RGB32:
+          // в памяти B,G,R,A (little-endian): раскладка совпадает с CV_8UC4
+          setReport(report, false, false, "ARGB32 -> CV_8UC4 (view)");
+          return wrapQImage(inImage, CV_8UC4);
 
-          return matNoAlpha;
+       case QImage::Format_RGBA8888:
+       case QImage::Format_RGBA8888_Premultiplied:
+       case QImage::Format_RGBX8888:
+       {
+          cv::Mat mat;
+          cv::cvtColor( wrapQImage(inImage, CV_8UC4), mat, cv::COLOR_RGBA2BGRA );
+          setReport(report, true, true, "RGBA8888 -> CV_8UC4 (swizzle)");
+          return mat;
        }
 
        case QImage::Format_RGB888:
        {
+          cv::Mat mat;
+          cv::cvtColor( wrapQImage(inImage, CV_8UC3), mat, cv::COLOR_RGB2BGR );
+          setReport(report, true, true, "RGB888 -> CV_8UC3 (swizzle)");
+          return mat;
+       }
 
+       case QImage::Format_BGR888:
+          setReport(report, false, false, "BGR888 -> CV_8UC3 (view)");
+          return wrapQImage(inImage, CV_8UC3);
 
-          QImage   swapped = inImage.rgbSwapped();
-
-          return cv::Mat( swapped.height(), swapped.width(),
-                          CV_8UC3,
-                          const_cast<uchar*>(swapped.bits()),
-                          static_cast<size_t>(swapped.bytesPerLine())
-                          ).clone();
-       }
+       case QImage::Format_Grayscale8:
+       case QImage::Format_Alpha8:
+          setReport(report, false, false, "Grayscale8 -> CV_8UC1 (view)");
+          return wrapQImage(inImage, CV_8UC1);
 
        case QImage::Format_Indexed8:
-       {
-          cv::Mat  mat( inImage.height(), inImage.width(),
-                        CV_8UC1,
-                        const_cast<uchar*>(inImage.bits()),
-                        static_cast<size_t>(inImage.bytesPerLine())
-                        );
+          if (hasIdentityGrayPalette(inImage)) {
+             setReport(report, false, false, "Indexed8 (gray) -> CV_8UC1 (view)");
+             return wrapQImage(inImage, CV_8UC1);
+          }
+          break;
+
+       case QImage::Format_Grayscale16:
+          setReport(report, false, false, "Grayscale16 -> CV_16UC1 (view)");
+          return wrapQImage(inImage, CV_16UC1);
 
+       case QImage::Format_RGBA64:
+       case QImage::Format_RGBA64_Premultiplied:
+       case QImage::Format_RGBX64:
+       {
+          cv::Mat mat;
+          cv::cvtColor( wrapQImage(inImage, CV_16UC4), mat, cv::COLOR_RGBA2BGRA );
+          setReport(report, true, true, "RGBA64 -> CV_16UC4 (swizzle)");
           return mat;
        }
 
        default:
-          qWarning() << "ASM::QImageToCvMat() - QImage format not handled in switch:" << inImage.format();
           break;
     }
 
-    return cv::Mat();
+    // Остальные форматы (палитровые, 16-битные RGB, 10-битные и т.д.) приводятся
+    // к 32-битному формату одним проходом Qt, результат используется без повторного копирования.
+    const QImage converted = inImage.convertToFormat( inImage.hasAlphaChannel()
+                                                      ? QImage::Format_ARGB32
+                                                      : QImage::Format_RGB32 );
+    if (converted.isNull()) {
+       qWarning() << "Convert::QImageToCvMat() - QImage format not handled:" << inImage.format();
+       setReport(report, false, false, "unsupported -> empty");
+       return cv::Mat();
+    }
+    setReport(report, true, false, "other -> ARGB32 -> CV_8UC4 (convert)");
+    return wrapQImage(converted, CV_8UC4);
 }
 
 
-QImage Convert::cvMatToQImage(const cv::Mat &inMat)
+cv::Mat Convert::QImageToFloatMat(const QImage &inImage)
+{
+    const cv::Mat mat = QImageToCvMat(inImage);
+    if (mat.empty())
+       return mat;
+    cv::Mat result;
+    mat.convertTo(result, CV_32F, mat.depth() == CV_16U ? 1.0 / 65535 : 1.0 / 255);
+    return result;
+}
+
+QImage Convert::cvMatToQImage(const cv::Mat &inMat, Report *report)
 {
+    if (inMat.empty() || inMat.dims != 2) {
+       setReport(report, false, false, "empty -> null");
+       return QImage();
+    }
+
+    if (inMat.depth() == CV_32F) {
+       // Хранение документа 16-битное: число с плавающей точкой квантуется один раз, здесь
+       cv::Mat quantized;
+       inMat.convertTo(quantized, CV_16U, 65535.0);
+       Report inner;
+       const QImage image = cvMatToQImage(quantized, &inner);
+       // Квантование уже скопировало пиксели, даже если 16-битный путь лишь обернул буфер
+       setReport(report, true, inner.swizzled, "CV_32F -> 16U (quantize)");
+       return image;
+    }
+
     switch ( inMat.type() )
     {
        case CV_8UC4:
-       {
-          QImage image( inMat.data,
-                        inMat.cols, inMat.rows,
-                        static_cast<int>(inMat.step),
-                        QImage::Format_ARGB32 );
-
-          return image;
-       }
+          setReport(report, false, false, "CV_8UC4 -> ARGB32 (view)");
+          return wrapCvMat(inMat, QImage::Format_ARGB32);
 
        case CV_8UC3:
-       {
-          QImage image( inMat.data,
-                        inMat.cols, inMat.rows,
-                        static_cast<int>(inMat.step),
-                        QImage::Format_RGB888 );
+          setReport(report, false, false, "CV_8UC3 -> BGR888 (view)");
+          return wrapCvMat(inMat, QImage::Format_BGR888);
 
-          return image.rgbSwapped();
-       }
        case CV_8UC1:
-       {
+          setReport(report, false, false, "CV_8UC1 -> Grayscale8 (view)");
+          return wrapCvMat(inMat, QImage::Format_Grayscale8);
 
-          QImage image( inMat.data,
-                        inMat.cols, inMat.rows,
-                        static_cast<int>(inMat.step),
-                        QImage::Format_Grayscale8 );
+       case CV_16UC1:
+          setReport(report, false, false, "CV_16UC1 -> Grayscale16 (view)");
+          return wrapCvMat(inMat, QImage::Format_Grayscale16);
 
+       case CV_16UC3:
+       {
+          cv::Mat rgba;
+          cv::cvtColor( inMat, rgba, cv::COLOR_BGR2RGBA );
+          setReport(report, true, true, "CV_16UC3 -> RGBX64 (swizzle)");
+          return wrapCvMat(rgba, QImage::Format_RGBX64);
+       }
 
-          return image;
+       case CV_16UC4:
+       {
+          cv::Mat rgba;
+          cv::cvtColor( inMat, rgba, cv::COLOR_BGRA2RGBA );
+          setReport(report, true, true, "CV_16UC4 -> RGBA64 (swizzle)");
+          return wrapCvMat(rgba, QImage::Format_RGBA64);
        }
 
        default:
-          qWarning() << "ASM::cvMatToQImage() - cv::Mat image type not handled in switch:" << inMat.type();
+          qWarning() << "Convert::cvMatToQImage() - cv::Mat image type not handled in switch:" << inMat.type();
           break;
     }
 
+    setReport(report, false, false, "unsupported -> null");
     return QImage();
 }
@@ -13,27 +13,81 @@
  * \brief The Convert class собирает в себе статические методы
  * для конвертации изображений в различные форматы, используемые
  * в проекте.
+ *
+ * Если раскладка пикселей QImage и cv::Mat совпадает, конвертация не копирует
+ * данные: возвращается представление над тем же буфером, которое совместно
+ * владеет им (буфер живет, пока жив хотя бы один из объектов).
+ * Если раскладка не совпадает, выполняется ровно один проход с перестановкой каналов.
+ * Представления следует считать доступными только для чтения.
  */
 
 class Convert
 {
 public:
+    /*!
+     * \brief The Report struct описывает, как была выполнена конкретная конвертация.
+     */
+    struct Report
+    {
+        /*!
+         * \brief copied true, если пиксели были скопированы в новый буфер
+         */
+        bool copied = false;
+        /*!
+         * \brief swizzled true, если при копировании переставлялись каналы
+         */
+        bool swizzled = false;
+        /*!
+         * \brief route краткое описание пути конвертации, например "ARGB32 -> CV_8UC4 (view)"
+         */
+        const char *route = "";
+    };
+
     Convert() = default;
     /*!
-     * \brief cvMatToQImage Конвертирует cv::Mat в QImage
+     * \brief cvMatToQImage Конвертирует cv::Mat в QImage.
+     * Матрицы глубины CV_32F (значения 0..1) квантуются в 16-битные форматы QImage.
      * \param inMat входное изображение в формате cv::Mat
-     * \return Возвращает QImage
+     * \param report если не nullptr, сюда записывается отчет о копировании
+     * \return Возвращает QImage, совместно с inMat владеющий буфером, если копирование не понадобилось
      */
-    static QImage  cvMatToQImage( const cv::Mat &inMat );
+    static QImage  cvMatToQImage( const cv::Mat &inMat, Report *report = nullptr );
     /*!
-     * \brief QImageToCvMat Конвертирует QImage в cv::Mat
+     * \brief QImageToCvMat Конвертирует QImage в cv::Mat с порядком каналов BGR(A)
      * \param inImage входное изображение в формате QImage
-     * \return Возвращает cv::Mat
+     * \param report если не nullptr, сюда записывается отчет о копировании
+     * \return Возвращает cv::Mat, совместно с inImage владеющий буфером, если копирование не понадобилось
      */
-    static cv::Mat QImageToCvMat( const QImage &inImage);
-
-
+    static cv::Mat QImageToCvMat( const QImage &inImage, Report *report = nullptr );
+    /*!
+     * \brief QImageToFloatMat Конвертирует QImage в cv::Mat глубины CV_32F с порядком каналов BGR(A)
+     * и значениями 0..1 независимо от разрядности исходного формата (рабочие данные фильтров,
+     * которым не хватает точности 8 или 16 бит)
+     */
+    static cv::Mat QImageToFloatMat( const QImage &inImage );
+    /*!
+     * \brief rawMatType Возвращает тип cv::Mat с той же раскладкой байт пикселя, что и у формата QImage.
+     * Порядок каналов не учитывается (для ARGB32 это B,G,R,A, для RGBA8888 - R,G,B,A).
+     * \return -1, если формат не является одним из форматов документа (см. TiledImage::fromImage)
+     */
+    static int rawMatType( QImage::Format format );
+    /*!
+     * \brief rawMat Создает cv::Mat над буфером image без копирования и без перестановки каналов.
+     * Матрица не владеет буфером: image должен жить дольше нее. Запись в матрицу меняет image на месте
+     * (для разделяемого QImage буфер предварительно отделяется).
+     * \return пустую матрицу, если для формата нет rawMatType
+     */
+    static cv::Mat rawMat( QImage &image );
 
+private:
+    /*!
+     * \brief wrapQImage создает cv::Mat над буфером QImage, удерживающий копию QImage до освобождения матрицы
+     */
+    static cv::Mat wrapQImage( const QImage &inImage, int type );
+    /*!
+     * \brief wrapCvMat создает QImage над буфером cv::Mat, удерживающий матрицу до освобождения изображения
+     */
+    static QImage wrapCvMat( const cv::Mat &inMat, QImage::Format format );
 };
 
 #endif // CONVERT_H
@@ -0,0 +1,28 @@
+#include "effectcache.h"
+
+EffectCache::EffectCache(qint64 budgetBytes)
+    : cache(static_cast<int>(qMax<qint64>(budgetBytes / 1024, 1)))
+{
+}
+
+bool EffectCache::find(const Key &key, TiledImage *result)
+{
+    TiledImage *cached = cache.object(key);
+    if (!cached)
+        return false;
+    *result = *cached;
+    return true;
+}
+
+void EffectCache::insert(const Key &key, const TiledImage &result)
+{
+    if (result.isNull())
+        return;
+    const int cost = static_cast<int>(qMax<qint64>(result.residentBytes() / 1024, 1));
+    cache.insert(key, new TiledImage(result), cost);
+}
+
+void EffectCache::clear()
+{
+    cache.clear();
+}
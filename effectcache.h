@@ -0,0 +1,67 @@
+#ifndef EFFECTCACHE_H
+#define EFFECTCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "tiledimage.h"
+
+/*!
+ * \brief The EffectCache class хранит недавние результаты эффектов, чтобы возврат слайдера
+ * к уже просмотренному значению показывал результат сразу, без повторного вычисления.
+ *
+ * Ключ включает ревизию документа, поэтому после любого изменения документа старые результаты
+ * перестают находиться и вытесняются по мере заполнения. Объем кэша ограничен в байтах.
+ */
+class EffectCache
+{
+public:
+    /*!
+     * \brief The Key struct однозначно описывает результат эффекта
+     */
+    struct Key
+    {
+        quint64 revision = 0; //!< ревизия документа, к которому применялся эффект
+        QString effect;       //!< имя эффекта
+        QVector<int> values;  //!< значения слайдеров
+        int scale = 1;        //!< во сколько раз уменьшен документ (1 - полное разрешение)
+
+        bool operator==(const Key &other) const
+        {
+            return revision == other.revision && effect == other.effect
+                    && values == other.values && scale == other.scale;
+        }
+    };
+
+    /*!
+     * \brief EffectCache создает кэш
+     * \param budgetBytes максимальный суммарный объем тайлов результатов
+     */
+    explicit EffectCache(qint64 budgetBytes = qint64(256) * 1024 * 1024);
+    /*!
+     * \brief find ищет результат
+     * \param key ключ результата
+     * \param result сюда записывается найденный результат
+     * \return true, если результат найден
+     */
+    bool find(const Key &key, TiledImage *result);
+    /*!
+     * \brief insert запоминает результат (тайлы разделяются, пиксели не копируются)
+     */
+    void insert(const Key &key, const TiledImage &result);
+    /*!
+     * \brief clear удаляет все результаты
+     */
+    void clear();
+
+private:
+    QCache<Key, TiledImage> cache; // стоимость - в килобайтах
+};
+
+inline uint qHash(const EffectCache::Key &key, uint seed = 0)
+{
+    return qHash(key.revision, seed) ^ qHash(key.effect, seed) ^ qHash(key.values, seed) ^ qHash(key.scale, seed);
+}
+
+#endif // EFFECTCACHE_H
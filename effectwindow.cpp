@@ -1,5 +1,7 @@
 #include "effectwindow.h"
 #include "ui_effectwindow.h"
+#include "imagecanvas.h"
+#include "profiler.h"
 #include <QSlider>
 #include <QLabel>
 #include <QScreen>
@@ -10,7 +12,13 @@ effectwindow::effectwindow(QImage &beforeImage, QImage &afterImage, QWidget *par
     ui(new Ui::effectwindow)
 {
     init(afterImage, beforeImage);
+    sliderLabel = new QLabel;
+    sliderLabel->setVisible(false);
+    ui->verticalLayout->addWidget(sliderLabel);
     ui->verticalLayout->addWidget(slider);
+    parametersLayout = new QFormLayout;
+    ui->verticalLayout->addLayout(parametersLayout);
+    QObject::connect(slider, SIGNAL(valueChanged(int)), this, SIGNAL(valuesChanged()));
     afterScrollArea->setWidgetResizable(true);
     ui->verticalLayout->addWidget(beforeScrollArea);
     ui->verticalLayout->addWidget(afterScrollArea);
@@ -42,9 +50,103 @@ effectwindow::~effectwindow()
     delete ui;
 }
 
+void effectwindow::setImages(const QImage &before, const QImage &after)
+{
+    imageBefore = before;
+    imageAfter = after;
+    repaintEffectWindow();
+}
+
+void effectwindow::setColorTransform(const std::shared_ptr<const ColorLut> &transform)
+{
+    if (transform == colorTransform)
+        return;
+    colorTransform = transform;
+    repaintEffectWindow();
+}
+
+void effectwindow::setDeferredAccept(bool deferred)
+{
+    deferredAccept = deferred;
+}
+
+QSize effectwindow::previewSize() const
+{
+    // изображения "до" и "после" расположены друг под другом
+    return QSize(width(), height() / 2);
+}
+
+void effectwindow::setParameters(const QVector<FilterParameter> &parameters)
+{
+    for (QSlider *extra : extraSliders) {
+        QWidget *label = parametersLayout->labelForField(extra);
+        delete label;
+        delete extra;
+    }
+    extraSliders.clear();
+
+    const QSignalBlocker blocker(slider);
+    if (parameters.isEmpty()) {
+        sliderLabel->setVisible(false);
+        slider->setRange(0, 99);
+        slider->setValue(0);
+        return;
+    }
+    sliderLabel->setText(parameters.first().name);
+    sliderLabel->setVisible(true);
+    slider->setRange(parameters.first().minimum, parameters.first().maximum);
+    slider->setValue(parameters.first().defaultValue);
+    for (int i = 1; i < parameters.size(); ++i) {
+        QSlider *extra = new QSlider(Qt::Horizontal);
+        extra->setRange(parameters.at(i).minimum, parameters.at(i).maximum);
+        extra->setValue(parameters.at(i).defaultValue);
+        QObject::connect(extra, SIGNAL(valueChanged(int)), this, SIGNAL(valuesChanged()));
+        parametersLayout->addRow(parameters.at(i).name, extra);
+        extraSliders.append(extra);
+    }
+}
+
+QVector<int> effectwindow::values() const
+{
+    QVector<int> result;
+    result.append(slider->value());
+    for (const QSlider *extra : extraSliders)
+        result.append(extra->value());
+    return result;
+}
+
+void effectwindow::setValues(const QVector<int> &values)
+{
+    const QSignalBlocker blocker(this);
+    if (!values.isEmpty())
+        slider->setValue(values.first());
+    for (int i = 0; i < extraSliders.size() && i + 1 < values.size(); ++i)
+        extraSliders.at(i)->setValue(values.at(i + 1));
+}
+
+void effectwindow::acceptClicked()
+{
+    if (deferredAccept)
+        emit acceptRequested();
+    else
+        accept();
+}
+
+void effectwindow::setProgress(int percent)
+{
+    progressBar->setValue(percent);
+}
+
+void effectwindow::setBusy(bool busy)
+{
+    progressBar->setVisible(busy);
+    ui->acceptButton->setEnabled(!busy);
+}
+
 void effectwindow::repaintEffectWindow(){
-    beforeImageLabel->setPixmap(QPixmap::fromImage(imageBefore));
-    afterImageLabel->setPixmap(QPixmap::fromImage(imageAfter));
+    TRACE_SCOPE("repaintEffectWindow");
+    beforeImageLabel->setPixmap(QPixmap::fromImage(ImageCanvas::displayImage(imageBefore, colorTransform.get())));
+    afterImageLabel->setPixmap(QPixmap::fromImage(ImageCanvas::displayImage(imageAfter, colorTransform.get())));
     beforeScrollArea->setWidget(beforeImageLabel);
     afterScrollArea->setWidget(afterImageLabel);
 }
@@ -56,10 +158,14 @@ void effectwindow::init(QImage &afterImage, QImage &beforeImage)
     afterImageLabel = new QLabel;
     beforeScrollArea = new QScrollArea;
     afterScrollArea = new QScrollArea;
+    progressBar = new QProgressBar;
+    progressBar->setRange(0, 100);
+    progressBar->setVisible(false);
+    ui->verticalLayout->addWidget(progressBar);
     beforeScrollArea->setBackgroundRole(QPalette::Dark);
     afterScrollArea->setBackgroundRole(QPalette::Dark);
     setWindowTitle(tr("Effect Preview"));
-    QObject::connect(ui->acceptButton, SIGNAL(clicked()), this, SLOT(accept()));
+    QObject::connect(ui->acceptButton, SIGNAL(clicked()), this, SLOT(acceptClicked()));
     QObject::connect(ui->cancelButton, SIGNAL(clicked()), this, SLOT(reject()));
     resize(QGuiApplication::primaryScreen()->availableSize() * 1 / 2);
     imageAfter = afterImage;
@@ -5,6 +5,11 @@
 #include <QScrollArea>
 #include <QLabel>
 #include <QSlider>
+#include <QProgressBar>
+#include <QFormLayout>
+#include <memory>
+#include "colormanager.h"
+#include "filterplugin.h"
 namespace Ui {
 class effectwindow;
 }
@@ -42,11 +47,72 @@ public:
      * \brief imageAfter изображение после эффекта
      */
     QImage imageAfter;
+    /*!
+     * \brief setImages заменяет изображения "до" и "после" и перерисовывает окно.
+     * Передача пустых изображений освобождает память, занятую предпросмотром.
+     * \param before Изображение до эффекта.
+     * \param after Изображение после эффекта.
+     */
+    void setImages(const QImage &before, const QImage &after);
+    /*!
+     * \brief setColorTransform задает перевод изображений в пространство экрана, как у холста
+     * (см. ImageCanvas::displayImage); nullptr - изображения показываются без преобразования
+     */
+    void setColorTransform(const std::shared_ptr<const ColorLut> &transform);
+    /*!
+     * \brief setDeferredAccept если включено, кнопка "Accept" не закрывает окно, а посылает сигнал acceptRequested,
+     * чтобы эффект можно было досчитать в полном разрешении перед закрытием.
+     * \param deferred true, чтобы откладывать закрытие окна
+     */
+    void setDeferredAccept(bool deferred);
+    /*!
+     * \brief previewSize размер области, в которой показывается изображение после эффекта.
+     * По нему выбирается разрешение уменьшенной копии для предпросмотра.
+     */
+    QSize previewSize() const;
+    /*!
+     * \brief setParameters создает слайдеры по описанию параметров фильтра: первый параметр управляет
+     * слайдером slider, для остальных добавляются подписанные слайдеры. Пустой список возвращает
+     * окно к единственному слайдеру встроенных эффектов.
+     */
+    void setParameters(const QVector<FilterParameter> &parameters);
+    /*!
+     * \brief values значения всех слайдеров, начиная со slider
+     */
+    QVector<int> values() const;
+    /*!
+     * \brief setValues устанавливает значения слайдеров (в порядке values) без сигнала valuesChanged
+     */
+    void setValues(const QVector<int> &values);
+signals:
+    /*!
+     * \brief acceptRequested Сигнал о нажатии кнопки "Accept" в режиме отложенного закрытия
+     */
+    void acceptRequested();
+    /*!
+     * \brief valuesChanged Сигнал об изменении значения любого из слайдеров
+     */
+    void valuesChanged();
+public slots:
+    /*!
+     * \brief setProgress показывает прогресс вычисления эффекта
+     * \param percent процент выполнения
+     */
+    void setProgress(int percent);
+    /*!
+     * \brief setBusy показывает индикатор прогресса и блокирует кнопку "Accept", пока эффект вычисляется
+     * \param busy true, если эффект вычисляется
+     */
+    void setBusy(bool busy);
 private slots:
     /*!
      * \brief repaintEffectWindow Данный слот изменяет изображения в окне эффектов.
      */
     void repaintEffectWindow();
+    /*!
+     * \brief acceptClicked закрывает окно или, в режиме отложенного закрытия, посылает acceptRequested
+     */
+    void acceptClicked();
 private:
     /*!
      * \brief init Функция, в которую вынесены действия для инициализации форм с двумя изображениями.
@@ -56,11 +122,17 @@ private:
     void init(QImage &afterImage, QImage &beforeImage);
     Ui::effectwindow *ui = nullptr;
     QImage imageBefore;
+    std::shared_ptr<const ColorLut> colorTransform;
 
     QLabel *beforeImageLabel = nullptr;
     QLabel *afterImageLabel = nullptr;
     QScrollArea *beforeScrollArea = nullptr;
     QScrollArea *afterScrollArea = nullptr;
+    QProgressBar *progressBar = nullptr;
+    bool deferredAccept = false;
+    QLabel *sliderLabel = nullptr;
+    QFormLayout *parametersLayout = nullptr;
+    QVector<QSlider *> extraSliders;
 
     QLabel *beforeHistogramLabel = nullptr;
     QLabel *afterHistogramLabel = nullptr;
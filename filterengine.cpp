@@ -0,0 +1,73 @@
+#include "filterengine.h"
+
+#include <QMetaObject>
+
+bool FilterJob::reportProgress(int done, int total)
+{
+    if (total > 0 && engine) {
+        const int value = done * 100 / total;
+        if (percent.exchange(value) != value) {
+            FilterEngine *target = engine;
+            const FilterJob *job = this;
+            QMetaObject::invokeMethod(target, [target, job, value]() {
+                if (target->current.get() == job)
+                    emit target->progress(value);
+            }, Qt::QueuedConnection);
+        }
+    }
+    return !isCancelled();
+}
+
+std::function<bool(int, int)> FilterJob::progress()
+{
+    return [this](int done, int total) { return reportProgress(done, total); };
+}
+
+FilterEngine::FilterEngine(QObject *parent)
+    : QObject(parent)
+{
+    // Вытесненная задача может доработать текущий тайл, пока новая уже начата
+    pool.setMaxThreadCount(2);
+}
+
+FilterEngine::~FilterEngine()
+{
+    if (current)
+        current->cancel();
+    pool.waitForDone();
+}
+
+void FilterEngine::run(const Operation &operation, const Callback &callback)
+{
+    cancel();
+    std::shared_ptr<FilterJob> job = std::make_shared<FilterJob>();
+    job->engine = this;
+    current = job;
+    emit busyChanged(true);
+    emit progress(0);
+
+    pool.start([this, job, operation, callback]() {
+        if (job->isCancelled())
+            return;
+        const TiledImage result = operation(*job);
+        if (job->isCancelled())
+            return;
+        QMetaObject::invokeMethod(this, [this, job, result, callback]() {
+            if (current != job || job->isCancelled())
+                return;
+            current.reset();
+            emit progress(100);
+            emit busyChanged(false);
+            callback(result);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void FilterEngine::cancel()
+{
+    if (!current)
+        return;
+    current->cancel();
+    current.reset();
+    emit busyChanged(false);
+}
@@ -0,0 +1,99 @@
+#ifndef FILTERENGINE_H
+#define FILTERENGINE_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "tiledimage.h"
+
+class FilterEngine;
+
+/*!
+ * \brief The FilterJob class описывает одну задачу FilterEngine: флаг отмены и прогресс.
+ * Методы потокобезопасны и вызываются из рабочих потоков.
+ */
+class FilterJob
+{
+public:
+    /*!
+     * \brief isCancelled true, если задача отменена или вытеснена более новой
+     */
+    bool isCancelled() const { return cancelled.load(); }
+    /*!
+     * \brief cancel отменяет задачу
+     */
+    void cancel() { cancelled = true; }
+    /*!
+     * \brief reportProgress сообщает о прогрессе задачи в окно эффектов
+     * \param done количество выполненных частей
+     * \param total общее количество частей
+     * \return false, если задача отменена и работу нужно прекратить
+     */
+    bool reportProgress(int done, int total);
+    /*!
+     * \brief progress возвращает обратный вызов прогресса для методов Filters
+     */
+    std::function<bool(int, int)> progress();
+
+private:
+    friend class FilterEngine;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> percent{-1};
+    FilterEngine *engine = nullptr;
+};
+
+/*!
+ * \brief The FilterEngine class выполняет фильтры в рабочих потоках.
+ * Одновременно актуальна только одна задача: запуск новой отменяет предыдущую,
+ * а результат доставляется в поток интерфейса только для самой новой задачи.
+ */
+class FilterEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<TiledImage(FilterJob &job)> Operation;
+    typedef std::function<void(const TiledImage &result)> Callback;
+
+    explicit FilterEngine(QObject *parent = nullptr);
+    /*!
+     * \brief ~FilterEngine отменяет текущую задачу и дожидается завершения рабочих потоков
+     */
+    ~FilterEngine();
+    /*!
+     * \brief run запускает operation в рабочем потоке, отменяя предыдущую задачу.
+     * \param operation операция над документом
+     * \param callback вызывается в потоке интерфейса с результатом, если задача не была отменена
+     */
+    void run(const Operation &operation, const Callback &callback);
+    /*!
+     * \brief isBusy true, если есть незавершенная актуальная задача
+     */
+    bool isBusy() const { return current != nullptr; }
+
+public slots:
+    /*!
+     * \brief cancel отменяет текущую задачу; ее результат не будет доставлен
+     */
+    void cancel();
+
+signals:
+    /*!
+     * \brief progress прогресс текущей задачи в процентах
+     */
+    void progress(int percent);
+    /*!
+     * \brief busyChanged сообщает о начале и завершении (или отмене) текущей задачи
+     */
+    void busyChanged(bool busy);
+
+private:
+    friend class FilterJob;
+
+    QThreadPool pool;
+    std::shared_ptr<FilterJob> current;
+};
+
+#endif // FILTERENGINE_H
@@ -0,0 +1,94 @@
+#ifndef FILTERPLUGIN_H
+#define FILTERPLUGIN_H
+
+#include <QImage>
+#include <QString>
+#include <QVector>
+#include <QtPlugin>
+
+/*!
+ * \brief The FilterParameter struct параметр фильтра; в окне эффектов для него создается слайдер
+ */
+struct FilterParameter
+{
+    QString name;
+    int minimum = 0;
+    int maximum = 100;
+    int defaultValue = 0;
+    /*!
+     * \brief spatial значение измеряется в пикселях (радиус, длина ядра): при предпросмотре на уменьшенной
+     * копии документа редактор делит его на коэффициент уменьшения
+     */
+    bool spatial = false;
+};
+
+/*!
+ * \brief The FilterBuffer struct вид на пиксели, которые передаются фильтру без копирования.
+ * Строки идут сверху вниз через bytesPerLine байт, раскладка пикселя - как у QImage формата format.
+ */
+struct FilterBuffer
+{
+    uchar *bits = nullptr;
+    int width = 0;
+    int height = 0;
+    int bytesPerLine = 0;
+    QImage::Format format = QImage::Format_Invalid;
+};
+
+/*!
+ * \brief The FilterPlugin class интерфейс фильтра, загружаемого из разделяемой библиотеки при запуске редактора.
+ *
+ * Библиотека объявляет класс, наследующий QObject и FilterPlugin, с макросами
+ * Q_PLUGIN_METADATA(IID FilterPlugin_iid) и Q_INTERFACES(FilterPlugin), и кладется в каталог plugins/filters
+ * рядом с исполняемым файлом (или в каталог из переменной окружения IMAGEEDITOR_FILTER_PATH).
+ * Пункт меню и слайдеры окна эффектов редактор создает по описанию фильтра.
+ *
+ * Редактор вызывает process из нескольких потоков одновременно (для разных тайлов), поэтому метод
+ * должен быть реентерабельным. Тайловый фильтр не знает положения тайла в изображении: если результат
+ * зависит от координат пикселя, фильтр должен вернуть false из isTileable.
+ */
+class FilterPlugin
+{
+public:
+    virtual ~FilterPlugin() {}
+
+    /*!
+     * \brief id постоянный идентификатор фильтра (используется в ключах кэша результатов)
+     */
+    virtual QString id() const = 0;
+    /*!
+     * \brief title название пункта меню
+     */
+    virtual QString title() const = 0;
+    /*!
+     * \brief category подменю фильтра в меню "Filter"; пустая строка - само меню
+     */
+    virtual QString category() const { return QString(); }
+    virtual QVector<FilterParameter> parameters() const { return QVector<FilterParameter>(); }
+    /*!
+     * \brief formats форматы пикселей, которые фильтр умеет обрабатывать. Документ другого формата
+     * приводится к первому из них перед вызовом process.
+     */
+    virtual QVector<QImage::Format> formats() const = 0;
+    /*!
+     * \brief isTileable true, если фильтр можно применять к тайлам документа независимо
+     */
+    virtual bool isTileable() const { return true; }
+    /*!
+     * \brief halo сколько пикселей соседей с каждой стороны нужно для одного выходного пикселя.
+     * Если 0, редактор передает в process один и тот же буфер как source и target (обработка на месте).
+     * \param values значения параметров (пространственные уже пересчитаны под масштаб)
+     */
+    virtual int halo(const QVector<int> &values) const { Q_UNUSED(values) return 0; }
+    /*!
+     * \brief process обрабатывает source в target. Размеры и форматы буферов совпадают.
+     * \param values значения параметров в порядке parameters()
+     * \return false при ошибке; применение фильтра тогда прерывается
+     */
+    virtual bool process(const FilterBuffer &source, const FilterBuffer &target, const QVector<int> &values) = 0;
+};
+
+#define FilterPlugin_iid "ImageEditor.FilterPlugin/1.0"
+Q_DECLARE_INTERFACE(FilterPlugin, FilterPlugin_iid)
+
+#endif // FILTERPLUGIN_H
@@ -0,0 +1,139 @@
+#include "filterregistry.h"
+#include "imagepool.h"
+#include "profiler.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QLibrary>
+#include <QPluginLoader>
+#include <atomic>
+
+namespace {
+
+FilterBuffer bufferOf(QImage &image)
+{
+    FilterBuffer buffer;
+    buffer.bits = image.bits();
+    buffer.width = image.width();
+    buffer.height = image.height();
+    buffer.bytesPerLine = image.bytesPerLine();
+    buffer.format = image.format();
+    return buffer;
+}
+
+// Вид на чужой буфер только для чтения: bits() отделил бы разделяемое изображение копированием
+FilterBuffer constBufferOf(const QImage &image)
+{
+    FilterBuffer buffer;
+    buffer.bits = const_cast<uchar *>(image.constBits());
+    buffer.width = image.width();
+    buffer.height = image.height();
+    buffer.bytesPerLine = image.bytesPerLine();
+    buffer.format = image.format();
+    return buffer;
+}
+
+}
+
+QStringList FilterRegistry::load()
+{
+    QStringList directories;
+    directories.append(QDir(QCoreApplication::applicationDirPath()).filePath(QStringLiteral("plugins/filters")));
+    const QString extra = qEnvironmentVariable("IMAGEEDITOR_FILTER_PATH");
+    directories.append(extra.split(QDir::listSeparator(), Qt::SkipEmptyParts));
+
+    QStringList errors;
+    for (const QString &directory : directories)
+        errors.append(loadDirectory(directory));
+    return errors;
+}
+
+QStringList FilterRegistry::loadDirectory(const QString &directory)
+{
+    QStringList errors;
+    const QDir dir(directory);
+    for (const QString &name : dir.entryList(QDir::Files, QDir::Name)) {
+        const QString fileName = dir.absoluteFilePath(name);
+        if (!QLibrary::isLibrary(fileName))
+            continue;
+        QPluginLoader loader(fileName);
+        QObject *instance = loader.instance();
+        FilterPlugin *plugin = qobject_cast<FilterPlugin *>(instance);
+        if (!plugin) {
+            errors.append(QStringLiteral("%1: %2").arg(QDir::toNativeSeparators(fileName),
+                    instance ? QStringLiteral("not a filter plugin") : loader.errorString()));
+            if (instance)
+                loader.unload();
+            continue;
+        }
+        if (loadedIds.contains(plugin->id())) {
+            errors.append(QStringLiteral("%1: duplicate filter id \"%2\"").arg(QDir::toNativeSeparators(fileName), plugin->id()));
+            continue;
+        }
+        loadedIds.append(plugin->id());
+        loaded.append(plugin);
+    }
+    return errors;
+}
+
+QVector<int> FilterRegistry::scaledValues(const FilterPlugin *plugin, const QVector<int> &values, int scale)
+{
+    const QVector<FilterParameter> parameters = plugin->parameters();
+    QVector<int> result = values;
+    for (int i = 0; i < result.size() && i < parameters.size(); ++i) {
+        if (parameters.at(i).spatial && scale > 1)
+            result[i] = qMax(parameters.at(i).minimum, result.at(i) / scale);
+    }
+    return result;
+}
+
+TiledImage FilterRegistry::apply(FilterPlugin *plugin, const TiledImage &source, const QVector<int> &values,
+                                 const Progress &progress)
+{
+    TRACE_SCOPE("FilterRegistry::apply");
+    if (source.isNull())
+        return TiledImage();
+    const QVector<QImage::Format> formats = plugin->formats();
+    if (formats.isEmpty())
+        return TiledImage();
+    TiledImage input = source;
+    if (!formats.contains(source.format())) {
+        const QImage::Format format = formats.first();
+        input = source.map(0, [format](const QImage &tile) { return tile.convertToFormat(format); });
+    }
+
+    if (!plugin->isTileable()) {
+        QImage image = input.toImage();
+        QImage output = ImagePool::instance().acquire(image.size(), image.format());
+        if (progress && !progress(0, 1))
+            return TiledImage();
+        if (!plugin->process(constBufferOf(image), bufferOf(output), values))
+            return TiledImage();
+        if (progress)
+            progress(1, 1);
+        return TiledImage::fromImage(output);
+    }
+
+    // Ошибка фильтра в одном тайле прерывает обработку остальных через обратный вызов прогресса
+    std::atomic<bool> failed(false);
+    const Progress guarded = [&failed, &progress](int done, int total) {
+        return !failed && (!progress || progress(done, total));
+    };
+    const int halo = plugin->halo(values);
+    TiledImage result;
+    if (halo == 0) {
+        result = input.transform([plugin, &values, &failed](QImage &tile) {
+            const FilterBuffer buffer = bufferOf(tile);
+            if (!plugin->process(buffer, buffer, values))
+                failed = true;
+        }, guarded);
+    } else {
+        result = input.map(halo, [plugin, &values, &failed](const QImage &region) {
+            QImage output = ImagePool::instance().acquire(region.size(), region.format());
+            if (!plugin->process(constBufferOf(region), bufferOf(output), values))
+                failed = true;
+            return output;
+        }, guarded);
+    }
+    return failed ? TiledImage() : result;
+}
@@ -0,0 +1,55 @@
+#ifndef FILTERREGISTRY_H
+#define FILTERREGISTRY_H
+
+#include <QStringList>
+#include <QVector>
+#include <functional>
+#include "filterplugin.h"
+#include "tiledimage.h"
+
+/*!
+ * \brief The FilterRegistry class загружает фильтры-плагины и применяет их к документу.
+ *
+ * Плагины загружаются один раз и не выгружаются до завершения программы.
+ * Применение фильтра выбирается по его описанию: точечный фильтр (halo 0) обрабатывает тайлы на месте,
+ * фильтр с окрестностью получает тайл, расширенный на halo пикселей, а нетайловый - весь документ одним буфером.
+ */
+class FilterRegistry
+{
+public:
+    typedef std::function<bool(int, int)> Progress;
+
+    FilterRegistry() = default;
+    /*!
+     * \brief load загружает плагины из plugins/filters рядом с исполняемым файлом
+     * и из каталогов переменной окружения IMAGEEDITOR_FILTER_PATH
+     * \return описания ошибок загрузки (пустой список, если ошибок не было)
+     */
+    QStringList load();
+    /*!
+     * \brief loadDirectory загружает все плагины фильтров из каталога
+     */
+    QStringList loadDirectory(const QString &directory);
+    const QVector<FilterPlugin *> &plugins() const { return loaded; }
+
+    /*!
+     * \brief scaledValues пересчитывает пространственные параметры для документа, уменьшенного в scale раз
+     */
+    static QVector<int> scaledValues(const FilterPlugin *plugin, const QVector<int> &values, int scale);
+    /*!
+     * \brief apply применяет фильтр к документу
+     * \param plugin фильтр
+     * \param source исходный документ
+     * \param values значения параметров (уже пересчитанные под масштаб)
+     * \param progress см. TiledImage::map
+     * \return результат или пустой документ, если обработка прервана или фильтр вернул ошибку
+     */
+    static TiledImage apply(FilterPlugin *plugin, const TiledImage &source, const QVector<int> &values,
+                            const Progress &progress = Progress());
+
+private:
+    QVector<FilterPlugin *> loaded;
+    QStringList loadedIds;
+};
+
+#endif // FILTERREGISTRY_H
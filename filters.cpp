@@ -0,0 +1,374 @@
+#include "filters.h"
+#include "colormanager.h"
+#include "profiler.h"
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Коэффициенты сепии для порядка каналов B, G, R (строки - выходные каналы, последний столбец - сдвиг)
+const float SepiaMatrix[12] = { 0.131f, 0.534f, 0.272f, 0,
+                                0.168f, 0.686f, 0.349f, 0,
+                                0.189f, 0.769f, 0.393f, 0 };
+
+// Непремультиплицированный формат с той же раскладкой каналов (или сам format)
+QImage::Format straightFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+        return QImage::Format_ARGB32;
+    case QImage::Format_RGBA8888_Premultiplied:
+        return QImage::Format_RGBA8888;
+    case QImage::Format_RGBA64_Premultiplied:
+        return QImage::Format_RGBA64;
+    default:
+        return format;
+    }
+}
+
+// Применяет к тайлу поканальную операцию над цветом. Премультиплицированный тайл на это время
+// переводится в непремультиплицированный формат, иначе цвет может стать больше альфы.
+void applyStraight(QImage &tile, const std::function<void(QImage &)> &function)
+{
+    const QImage::Format format = tile.format();
+    const QImage::Format straight = straightFormat(format);
+    if (straight == format) {
+        function(tile);
+        return;
+    }
+    QImage converted = tile.convertToFormat(straight);
+    function(converted);
+    tile = converted.convertToFormat(format);
+}
+
+// Таблица out = alpha * in + beta для 8-битных каналов. Для четырехканальных изображений
+// последний байт пикселя (альфа-канал или X) отображается сам в себя.
+cv::Mat brightnessLut8(double alpha, double beta, int channels)
+{
+    cv::Mat lut(1, 256, CV_8UC(channels));
+    uchar *entry = lut.ptr<uchar>();
+    for (int i = 0; i < 256; ++i) {
+        const uchar value = cv::saturate_cast<uchar>(alpha * i + beta);
+        for (int c = 0; c < channels; ++c)
+            *entry++ = channels == 4 && c == 3 ? static_cast<uchar>(i) : value;
+    }
+    return lut;
+}
+
+// То же для 16-битных каналов; beta задан в шкале 0..255
+std::vector<ushort> brightnessLut16(double alpha, double beta)
+{
+    std::vector<ushort> lut(65536);
+    for (int i = 0; i < 65536; ++i)
+        lut[i] = cv::saturate_cast<ushort>(alpha * i + beta * 257);
+    return lut;
+}
+
+// Точная медиана одного 16-битного канала (cv::medianBlur умеет 16 бит только с ядрами 3 и 5).
+// Окно сдвигается вдоль строки; его значения хранятся в двухуровневой гистограмме
+// (старший байт, затем младший), поэтому поиск медианы стоит не больше 512 шагов.
+cv::Mat medianBlur16(const cv::Mat &source, int size)
+{
+    const int radius = size / 2;
+    cv::Mat padded;
+    cv::copyMakeBorder(source, padded, radius, radius, radius, radius, cv::BORDER_REPLICATE);
+    cv::Mat result(source.size(), CV_16UC1);
+    std::vector<int> coarse(256, 0);
+    std::vector<int> fine(65536, 0);
+    const int median = size * size / 2;
+    for (int y = 0; y < source.rows; ++y) {
+        for (int row = y; row < y + size; ++row) {
+            const ushort *line = padded.ptr<ushort>(row);
+            for (int column = 0; column < size; ++column) {
+                ++coarse[line[column] >> 8];
+                ++fine[line[column]];
+            }
+        }
+        ushort *output = result.ptr<ushort>(y);
+        for (int x = 0; x < source.cols; ++x) {
+            int rank = median;
+            int high = 0;
+            while (rank >= coarse[high])
+                rank -= coarse[high++];
+            const int *bins = fine.data() + (high << 8);
+            int low = 0;
+            while (rank >= bins[low])
+                rank -= bins[low++];
+            output[x] = static_cast<ushort>((high << 8) | low);
+            // Левый столбец окна уходит, справа приходит новый; после последнего пикселя окно очищается
+            const int next = x + 1 < source.cols ? x + size : -1;
+            for (int row = y; row < y + size; ++row) {
+                const ushort *line = padded.ptr<ushort>(row);
+                --coarse[line[x] >> 8];
+                --fine[line[x]];
+                if (next >= 0) {
+                    ++coarse[line[next] >> 8];
+                    ++fine[line[next]];
+                }
+            }
+        }
+        for (int row = y; row < y + size; ++row) {
+            const ushort *line = padded.ptr<ushort>(row);
+            for (int column = source.cols; column < source.cols + size - 1; ++column) {
+                --coarse[line[column] >> 8];
+                --fine[line[column]];
+            }
+        }
+    }
+    return result;
+}
+
+// Эквализация 16-битной яркости: гистограмма на 65536 уровней, отображение в CV_32F (без промежуточных 8 бит)
+void equalizeHist16(cv::Mat &luma)
+{
+    cv::Mat levels;
+    luma.convertTo(levels, CV_16U, 65535.0);
+    std::vector<quint64> histogram(65536, 0);
+    for (int y = 0; y < levels.rows; ++y) {
+        const ushort *line = levels.ptr<ushort>(y);
+        for (int x = 0; x < levels.cols; ++x)
+            ++histogram[line[x]];
+    }
+    const quint64 total = quint64(levels.rows) * levels.cols;
+    int first = 0;
+    while (first < 65535 && histogram[first] == 0)
+        ++first;
+    if (histogram[first] == total)
+        return;
+    // Та же формула, что у cv::equalizeHist: первый непустой уровень переходит в 0, последний - в 1
+    std::vector<float> lut(65536, 0.0f);
+    const double scale = 1.0 / double(total - histogram[first]);
+    quint64 sum = 0;
+    for (int i = first + 1; i < 65536; ++i) {
+        sum += histogram[i];
+        lut[i] = float(sum * scale);
+    }
+    for (int y = 0; y < levels.rows; ++y) {
+        const ushort *line = levels.ptr<ushort>(y);
+        float *output = luma.ptr<float>(y);
+        for (int x = 0; x < levels.cols; ++x)
+            output[x] = lut[line[x]];
+    }
+}
+
+}
+
+TiledImage Filters::brightness(const TiledImage &source, double alpha, double beta, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::brightness");
+    const int type = Convert::rawMatType(source.format());
+    const int channels = CV_MAT_CN(type);
+    if (CV_MAT_DEPTH(type) == CV_8U) {
+        const cv::Mat lut = brightnessLut8(alpha, beta, channels);
+        return source.transform([lut](QImage &tile) {
+            applyStraight(tile, [&lut](QImage &straight) {
+                cv::Mat pixels = Convert::rawMat(straight);
+                cv::LUT(pixels, lut, pixels);
+            });
+        }, progress);
+    }
+
+    const std::shared_ptr<const std::vector<ushort>> lut =
+            std::make_shared<const std::vector<ushort>>(brightnessLut16(alpha, beta));
+    return source.transform([lut, channels](QImage &tile) {
+        applyStraight(tile, [&lut, channels](QImage &straight) {
+            const ushort *table = lut->data();
+            const int colorChannels = channels == 4 ? 3 : channels; // альфа-канал не трогаем
+            for (int y = 0; y < straight.height(); ++y) {
+                ushort *pixel = reinterpret_cast<ushort *>(straight.scanLine(y));
+                for (int x = 0; x < straight.width(); ++x, pixel += channels) {
+                    for (int c = 0; c < colorChannels; ++c)
+                        pixel[c] = table[pixel[c]];
+                }
+            }
+        });
+    }, progress);
+}
+
+PixelPipeline Filters::brightnessPipeline(double alpha, double beta)
+{
+    const cv::Mat lut = brightnessLut8(alpha, beta, 1);
+    PixelPipeline pipeline;
+    pipeline.addLut(lut.ptr<uchar>());
+    return pipeline;
+}
+
+PixelPipeline Filters::sepiaPipeline()
+{
+    PixelPipeline pipeline;
+    pipeline.addMatrix(SepiaMatrix);
+    return pipeline;
+}
+
+TiledImage Filters::sepia(const TiledImage &source, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::sepia");
+    if (PixelPipeline::supports(source.format()))
+        return sepiaPipeline().apply(source, progress);
+
+    // Серые и 16-битные документы: сепия через cv::transform с сохранением глубины
+    return source.map(0, [](const QImage &region) -> QImage {
+        cv::Mat src = Convert::QImageToCvMat(region);
+        if (src.channels() == 1)
+            cv::cvtColor(src, src, cv::COLOR_GRAY2BGR);
+        cv::Mat dst ;
+        cv::Mat kern = cv::Mat::eye(4, 4, CV_32F);
+        cv::Mat(3, 4, CV_32F, const_cast<float *>(SepiaMatrix)).colRange(0, 3).copyTo(kern(cv::Rect(0, 0, 3, 3)));
+        cv::transform(src, dst, kern(cv::Rect(0, 0, src.channels(), src.channels())));
+        return Convert::cvMatToQImage(dst);
+    }, progress);
+}
+
+TiledImage Filters::colorLut(const TiledImage &source, const ColorLut &lut, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::colorLut");
+    TiledImage input = source;
+    if (source.format() == QImage::Format_Grayscale8 || source.format() == QImage::Format_Grayscale16) {
+        const QImage::Format format = source.format() == QImage::Format_Grayscale8 ? QImage::Format_RGB32
+                                                                                   : QImage::Format_RGBX64;
+        input = source.map(0, [format](const QImage &tile) { return tile.convertToFormat(format); });
+    }
+    return input.transform([&lut](QImage &tile) {
+        applyStraight(tile, [&lut](QImage &straight) { lut.apply(straight); });
+    }, progress);
+}
+
+int Filters::kernelSize(int maxKernelLength)
+{
+    // Последнее (и единственное значимое) ядро прежнего цикла for (i = 1; i < max; i += 2)
+    const int size = maxKernelLength % 2 == 0 ? maxKernelLength - 1 : maxKernelLength - 2;
+    return size < 1 ? 1 : size;
+}
+
+TiledImage Filters::homogeneous(const TiledImage &source, int maxKernelLength, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::homogeneous");
+    const int size = kernelSize(maxKernelLength);
+    return source.map(size / 2, [size](const QImage &region) -> QImage {
+        cv::Mat dst;
+        cv::Mat src = Convert::QImageToCvMat(region);
+        blur( src, dst, cv::Size( size, size ), cv::Point(-1,-1) );
+        return Convert::cvMatToQImage(dst);
+    }, progress);
+}
+
+TiledImage Filters::gaussian(const TiledImage &source, int maxKernelLength, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::gaussian");
+    const int size = kernelSize(maxKernelLength);
+    return source.map(size / 2, [size](const QImage &region) -> QImage {
+        cv::Mat dst;
+        cv::Mat src = Convert::QImageToCvMat(region);
+        GaussianBlur( src, dst, cv::Size( size, size ), 0, 0 );
+        return Convert::cvMatToQImage(dst);
+    }, progress);
+}
+
+TiledImage Filters::median(const TiledImage &source, int maxKernelLength, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::median");
+    const int size = kernelSize(maxKernelLength);
+    return source.map(size / 2, [size](const QImage &region) -> QImage {
+        cv::Mat dst;
+        cv::Mat src = Convert::QImageToCvMat(region);
+        if (src.depth() == CV_16U && size > 5) {
+            std::vector<cv::Mat> channels;
+            cv::split(src, channels);
+            for (cv::Mat &channel : channels)
+                channel = medianBlur16(channel, size);
+            cv::merge(channels, dst);
+        } else {
+            medianBlur ( src, dst, size );
+        }
+        return Convert::cvMatToQImage(dst);
+    }, progress);
+}
+
+TiledImage Filters::bilateral(const TiledImage &source, int maxKernelLength, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::bilateral");
+    const int size = kernelSize(maxKernelLength);
+    return source.map(size / 2, [size](const QImage &region) -> QImage {
+        cv::Mat dst;
+        cv::Mat src = Convert::QImageToCvMat(region);
+        // bilateralFilter работает только с одно- и трехканальными изображениями
+        if (src.channels() == 4)
+            cv::cvtColor(src, src, cv::COLOR_BGRA2BGR);
+        // и только с глубиной 8U или 32F: 16-битные каналы обрабатываются в CV_32F в шкале 0..255,
+        // чтобы параметр sigmaColor значил то же, что и для 8-битных
+        const int depth = src.depth();
+        if (depth != CV_8U)
+            src.convertTo(src, CV_32F, 255.0 / 65535);
+        bilateralFilter ( src, dst, size, size*2, size/2 );
+        if (depth != CV_8U)
+            dst.convertTo(dst, depth, 65535 / 255.0);
+        return Convert::cvMatToQImage(dst);
+    }, progress);
+}
+
+TiledImage Filters::histogramEqualization(const TiledImage &source, const Progress &progress)
+{
+    TRACE_SCOPE("Filters::histogramEqualization");
+    const QImage image = source.toImage();
+    const int type = Convert::rawMatType(image.format());
+    if (type >= 0 && CV_MAT_DEPTH(type) == CV_16U)
+        return histogramEqualization16(image, progress);
+    cv::Mat src = Convert::QImageToCvMat(image);
+    if (src.channels() == 1)
+        cv::cvtColor(src, src, cv::COLOR_GRAY2BGR);
+    if (progress && !progress(1, 4))
+        return TiledImage();
+
+    cv::Mat ycrcb;
+    cv::cvtColor(src,ycrcb, CV_BGR2YCrCb);
+
+    std::vector<cv::Mat> channels;
+    cv::split(ycrcb,channels);
+    if (progress && !progress(2, 4))
+        return TiledImage();
+
+    cv::equalizeHist(channels[0], channels[0]);
+
+    cv::Mat dst;
+    cv::merge(channels,ycrcb);
+    if (progress && !progress(3, 4))
+        return TiledImage();
+
+    cv::cvtColor(ycrcb,dst,CV_YCrCb2BGR);
+    const TiledImage result = TiledImage::fromImage(Convert::cvMatToQImage(dst));
+    if (progress)
+        progress(4, 4);
+    return result;
+}
+
+TiledImage Filters::histogramEqualization16(const QImage &image, const Progress &progress)
+{
+    // Рабочие данные в CV_32F: преобразования цвета не округляются до 16 бит между шагами
+    cv::Mat src = Convert::QImageToFloatMat(image);
+    if (src.channels() == 1)
+        cv::cvtColor(src, src, cv::COLOR_GRAY2BGR);
+    else if (src.channels() == 4)
+        cv::cvtColor(src, src, cv::COLOR_BGRA2BGR);
+    if (progress && !progress(1, 4))
+        return TiledImage();
+
+    cv::Mat ycrcb;
+    cv::cvtColor(src, ycrcb, cv::COLOR_BGR2YCrCb);
+    std::vector<cv::Mat> channels;
+    cv::split(ycrcb, channels);
+    if (progress && !progress(2, 4))
+        return TiledImage();
+
+    equalizeHist16(channels[0]);
+    cv::merge(channels, ycrcb);
+    if (progress && !progress(3, 4))
+        return TiledImage();
+
+    cv::Mat dst;
+    cv::cvtColor(ycrcb, dst, cv::COLOR_YCrCb2BGR);
+    const TiledImage result = TiledImage::fromImage(Convert::cvMatToQImage(dst));
+    if (progress)
+        progress(4, 4);
+    return result;
+}
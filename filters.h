@@ -0,0 +1,95 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <QImage>
+#include <functional>
+#include "convert.h"
+#include "pixelpipeline.h"
+#include "tiledimage.h"
+
+class ColorLut;
+
+/*!
+ * \brief The Filters class собирает в себе статические методы, реализующие эффекты редактора.
+ * Методы не зависят от интерфейса и могут выполняться в рабочих потоках.
+ * Тайловые фильтры принимают необязательный обратный вызов progress (см. TiledImage::map):
+ * если он возвращает false, фильтр прерывается и возвращает пустой документ.
+ */
+class Filters
+{
+public:
+    typedef std::function<bool(int, int)> Progress;
+
+    Filters() = default;
+    /*!
+     * \brief brightness Изменяет яркость и контраст: out = alpha * in + beta.
+     * Значения для всех 256 (для 16-битных форматов - 65536) уровней канала вычисляются один раз
+     * в таблицу, которая затем применяется к тайлам на месте в их собственном формате,
+     * без конвертации в cv::Mat с перестановкой каналов. Альфа-канал не меняется.
+     * \param source исходный документ
+     * \param alpha коэффициент контраста
+     * \param beta сдвиг яркости в шкале 0..255
+     * \param progress обратный вызов прогресса
+     */
+    static TiledImage brightness(const TiledImage &source, double alpha, double beta, const Progress &progress = Progress());
+    /*!
+     * \brief brightnessPipeline Изменение яркости и контраста как стадия PixelPipeline (для 8-битных каналов)
+     */
+    static PixelPipeline brightnessPipeline(double alpha, double beta);
+    /*!
+     * \brief sepiaPipeline Сепия как стадия PixelPipeline
+     */
+    static PixelPipeline sepiaPipeline();
+    /*!
+     * \brief sepia Применяет эффект сепии. Для 8-битных цветных форматов - одним проходом на месте
+     * через PixelPipeline, иначе через cv::transform.
+     */
+    static TiledImage sepia(const TiledImage &source, const Progress &progress = Progress());
+    /*!
+     * \brief colorLut Применяет трехмерную таблицу цветокоррекции (см. LutFile) с тетраэдрической интерполяцией.
+     * Тайлы (блоки по 256 строк) обрабатываются параллельно и на месте, в своем формате и разрядности.
+     * Премультиплицированные тайлы на время применения переводятся в непремультиплицированный формат,
+     * серые документы - в цветной формат той же разрядности.
+     */
+    static TiledImage colorLut(const TiledImage &source, const ColorLut &lut, const Progress &progress = Progress());
+    /*!
+     * \brief kernelSize Размер ядра размытия для значения слайдера: наибольшее нечетное число,
+     * меньшее maxKernelLength (но не меньше 1). Размытия выполняются одним проходом с этим ядром.
+     */
+    static int kernelSize(int maxKernelLength);
+    /*!
+     * \brief homogeneous Применяет гомогенное размытие
+     * \param maxKernelLength интенсивность размытия (значение слайдера)
+     */
+    static TiledImage homogeneous(const TiledImage &source, int maxKernelLength, const Progress &progress = Progress());
+    /*!
+     * \brief gaussian Применяет гауссово размытие
+     * \param maxKernelLength интенсивность размытия (значение слайдера)
+     */
+    static TiledImage gaussian(const TiledImage &source, int maxKernelLength, const Progress &progress = Progress());
+    /*!
+     * \brief median Применяет медианное размытие. Для 16-битных каналов с ядром больше 5
+     * медиана считается собственной реализацией без перевода в 8 бит.
+     * \param maxKernelLength интенсивность размытия (значение слайдера)
+     */
+    static TiledImage median(const TiledImage &source, int maxKernelLength, const Progress &progress = Progress());
+    /*!
+     * \brief bilateral Применяет двустороннее размытие (16-битные каналы - через CV_32F)
+     * \param maxKernelLength интенсивность размытия (значение слайдера)
+     */
+    static TiledImage bilateral(const TiledImage &source, int maxKernelLength, const Progress &progress = Progress());
+    /*!
+     * \brief histogramEqualization Эквализирует гистограмму яркости (канал Y в YCrCb).
+     * Эквализация использует гистограмму всего изображения, поэтому работает с непрерывной копией.
+     * 16-битные документы эквализируются по 65536 уровням (см. histogramEqualization16).
+     */
+    static TiledImage histogramEqualization(const TiledImage &source, const Progress &progress = Progress());
+
+private:
+    /*!
+     * \brief histogramEqualization16 эквализация 16-битного изображения с рабочими данными в CV_32F
+     */
+    static TiledImage histogramEqualization16(const QImage &image, const Progress &progress);
+};
+
+#endif // FILTERS_H
@@ -0,0 +1,160 @@
+#include "histogramservice.h"
+
+#include <opencv2/core.hpp>
+
+namespace {
+
+// Смещения байт B, G, R в пикселе 8-битных форматов; false для остальных форматов
+bool byteOffsets(QImage::Format format, int *bytesPerPixel, int *blue, int *green, int *red)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        *bytesPerPixel = 4; *blue = 0; *green = 1; *red = 2;
+        return true;
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+    case QImage::Format_RGBX8888:
+        *bytesPerPixel = 4; *blue = 2; *green = 1; *red = 0;
+        return true;
+    case QImage::Format_RGB888:
+        *bytesPerPixel = 3; *blue = 2; *green = 1; *red = 0;
+        return true;
+    case QImage::Format_BGR888:
+        *bytesPerPixel = 3; *blue = 0; *green = 1; *red = 2;
+        return true;
+    case QImage::Format_Grayscale8:
+        *bytesPerPixel = 1; *blue = 0; *green = 0; *red = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Считает пиксели прямоугольника rect изображения image
+void countImage(const QImage &image, const QRect &rect, Histogram *histogram)
+{
+    int bytesPerPixel = 0, blue = 0, green = 0, red = 0;
+    QImage converted;
+    const QImage *source = &image;
+    if (!byteOffsets(image.format(), &bytesPerPixel, &blue, &green, &red)) {
+        converted = image.convertToFormat(QImage::Format_RGB32);
+        source = &converted;
+        byteOffsets(converted.format(), &bytesPerPixel, &blue, &green, &red);
+    }
+    quint64 (*bins)[256] = histogram->bins;
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar *pixel = source->constScanLine(y) + rect.left() * bytesPerPixel;
+        for (int x = rect.left(); x <= rect.right(); ++x, pixel += bytesPerPixel) {
+            const int b = pixel[blue];
+            const int g = pixel[green];
+            const int r = pixel[red];
+            ++bins[Histogram::Blue][b];
+            ++bins[Histogram::Green][g];
+            ++bins[Histogram::Red][r];
+            ++bins[Histogram::Luma][HistogramService::luma(b, g, r)];
+        }
+    }
+    histogram->pixels += quint64(rect.width()) * rect.height();
+}
+
+}
+
+void Histogram::add(const Histogram &other, int sign)
+{
+    for (int c = 0; c < ChannelCount; ++c) {
+        for (int i = 0; i < 256; ++i) {
+            if (sign > 0)
+                bins[c][i] += other.bins[c][i];
+            else
+                bins[c][i] -= other.bins[c][i];
+        }
+    }
+    if (sign > 0)
+        pixels += other.pixels;
+    else
+        pixels -= other.pixels;
+}
+
+void HistogramService::countTile(const TiledImage &document, int column, int row, const QRect &area,
+                                  Histogram *histogram)
+{
+    *histogram = Histogram();
+    const QRect bounds = document.tileRect(column, row) & area;
+    if (bounds.isEmpty())
+        return;
+    if (document.isTileAllocated(column, row)) {
+        countImage(document.tile(column, row), bounds.translated(-document.tileRect(column, row).topLeft()), histogram);
+        return;
+    }
+    // Невыделенный тайл целиком залит фоном: считаем один пиксель и умножаем
+    QImage pixel(1, 1, document.format());
+    pixel.fill(QColor::fromRgba(document.background()));
+    Histogram single;
+    countImage(pixel, pixel.rect(), &single);
+    const quint64 area = quint64(bounds.width()) * bounds.height();
+    for (int c = 0; c < Histogram::ChannelCount; ++c) {
+        for (int i = 0; i < 256; ++i)
+            histogram->bins[c][i] = single.bins[c][i] * area;
+    }
+    histogram->pixels = area;
+}
+
+void HistogramService::update(const TiledImage &document, const QRect &dirty, const QRect &area)
+{
+    const QRect region = area.isEmpty() ? document.rect() : area & document.rect();
+    if (document.size() != size || document.format() != format || document.background() != background
+            || region != counted) {
+        size = document.size();
+        counted = region;
+        format = document.format();
+        background = document.background();
+        entries = QVector<TileEntry>(document.tileColumns() * document.tileRows());
+        total = Histogram();
+    }
+
+    const int columns = document.tileColumns();
+    const QRect dirtyTiles = document.tilesIn(dirty);
+    const QRect countedTiles = document.tilesIn(counted);
+    QVector<int> stale;
+    for (int i = 0; i < entries.size(); ++i) {
+        const int column = i % columns;
+        const int row = i / columns;
+        // Тайлы вне области не считаются: их гистограмма остается пустой
+        if (!countedTiles.contains(column, row))
+            continue;
+        const TileEntry &entry = entries.at(i);
+        const qint64 key = document.isTileAllocated(column, row) ? document.tile(column, row).cacheKey() : 0;
+        if (!entry.valid || entry.cacheKey != key || dirtyTiles.contains(column, row))
+            stale.append(i);
+    }
+    if (stale.isEmpty())
+        return;
+
+    QVector<Histogram> fresh(stale.size());
+    Histogram *target = fresh.data();
+    cv::parallel_for_(cv::Range(0, stale.size()), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k)
+            countTile(document, stale.at(k) % columns, stale.at(k) / columns, counted, &target[k]);
+    });
+
+    for (int k = 0; k < stale.size(); ++k) {
+        const int i = stale.at(k);
+        TileEntry &entry = entries[i];
+        if (entry.valid)
+            total.add(entry.histogram, -1);
+        entry.histogram = fresh.at(k);
+        entry.cacheKey = document.isTileAllocated(i % columns, i / columns)
+                ? document.tile(i % columns, i / columns).cacheKey() : 0;
+        entry.valid = true;
+        total.add(entry.histogram);
+    }
+}
+
+Histogram HistogramService::compute(const TiledImage &document)
+{
+    HistogramService service;
+    service.update(document);
+    return service.histogram();
+}
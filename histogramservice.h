@@ -0,0 +1,80 @@
+#ifndef HISTOGRAMSERVICE_H
+#define HISTOGRAMSERVICE_H
+
+#include <QRect>
+#include <QVector>
+#include "tiledimage.h"
+
+/*!
+ * \brief The Histogram struct гистограммы каналов B, G, R и яркости (по 256 уровней)
+ */
+struct Histogram
+{
+    enum Channel { Blue, Green, Red, Luma, ChannelCount };
+
+    quint64 bins[ChannelCount][256] = {};
+    quint64 pixels = 0;
+
+    /*!
+     * \brief add прибавляет (sign > 0) или вычитает (sign < 0) другую гистограмму
+     */
+    void add(const Histogram &other, int sign = 1);
+};
+
+/*!
+ * \brief The HistogramService class поддерживает гистограмму документа в актуальном состоянии.
+ *
+ * Гистограмма хранится отдельно для каждого тайла, а общая гистограмма - их сумма.
+ * При обновлении пересчитываются только тайлы, попавшие в прямоугольник изменений, и тайлы,
+ * чей буфер сменился (копия при записи меняет QImage::cacheKey), поэтому мазок кисти стоит
+ * пересчета нескольких тайлов, а отмена, эффект или обрезка - только реально измененных.
+ * Все каналы тайла считаются за один проход, тайлы - параллельно.
+ */
+class HistogramService
+{
+public:
+    HistogramService() = default;
+    /*!
+     * \brief update приводит гистограмму в соответствие с document
+     * \param document текущий документ
+     * \param dirty прямоугольник, пиксели в котором могли измениться без смены буфера тайла
+     * (рисование в уже отделенный тайл); пустой, если такого нет
+     * \param area часть документа, по которой считается гистограмма (видимая область после обрезки);
+     * пустой прямоугольник - весь документ
+     */
+    void update(const TiledImage &document, const QRect &dirty = QRect(), const QRect &area = QRect());
+    /*!
+     * \brief histogram текущая гистограмма документа
+     */
+    const Histogram &histogram() const { return total; }
+    /*!
+     * \brief compute считает гистограмму документа целиком без кэширования
+     */
+    static Histogram compute(const TiledImage &document);
+    /*!
+     * \brief luma яркость пикселя (Rec. 601) в целочисленной форме, как ее считает сервис
+     */
+    static int luma(int blue, int green, int red) { return (29 * blue + 150 * green + 77 * red + 128) >> 8; }
+
+private:
+    /*!
+     * \brief The TileEntry struct гистограмма одного тайла и ключ буфера, по которому она посчитана
+     */
+    struct TileEntry
+    {
+        qint64 cacheKey = 0;
+        bool valid = false;
+        Histogram histogram;
+    };
+
+    static void countTile(const TiledImage &document, int column, int row, const QRect &area, Histogram *histogram);
+
+    QSize size;
+    QRect counted;
+    QImage::Format format = QImage::Format_Invalid;
+    QRgb background = 0;
+    QVector<TileEntry> entries;
+    Histogram total;
+};
+
+#endif // HISTOGRAMSERVICE_H
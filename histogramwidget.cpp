@@ -0,0 +1,101 @@
+#include "histogramwidget.h"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+
+namespace {
+
+const QColor channelColors[Histogram::ChannelCount] = {
+    QColor(0, 0, 255, 160),
+    QColor(0, 200, 0, 160),
+    QColor(255, 0, 0, 160),
+    QColor(80, 80, 80, 200),
+};
+
+QString clippingText(const Histogram &histogram, int channel)
+{
+    if (histogram.pixels == 0)
+        return QString();
+    const double black = 100.0 * histogram.bins[channel][0] / histogram.pixels;
+    const double white = 100.0 * histogram.bins[channel][255] / histogram.pixels;
+    return QStringLiteral("%1% / %2%").arg(black, 0, 'f', 1).arg(white, 0, 'f', 1);
+}
+
+}
+
+HistogramWidget::HistogramWidget(QWidget *parent)
+    : QWidget(parent)
+{
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
+}
+
+void HistogramWidget::setHistogram(const Histogram &histogram)
+{
+    current = histogram;
+    update();
+}
+
+QImage HistogramWidget::render(const Histogram &histogram, const QSize &size)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    draw(painter, histogram, image.rect(), Qt::black);
+    return image;
+}
+
+void HistogramWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+    draw(painter, current, rect(), palette().color(QPalette::Text));
+}
+
+void HistogramWidget::draw(QPainter &painter, const Histogram &histogram, const QRect &area, const QColor &textColor)
+{
+    const int textHeight = painter.fontMetrics().height();
+    const QRect plot = area.adjusted(2, 2, -2, -2 - textHeight);
+    if (plot.height() <= 0 || histogram.pixels == 0)
+        return;
+
+    // Масштаб по максимуму без крайних уровней, чтобы обрезанные пиксели не сплющивали остальной график
+    quint64 peak = 1;
+    for (int c = 0; c < Histogram::ChannelCount; ++c)
+        peak = std::max(peak, *std::max_element(histogram.bins[c] + 1, histogram.bins[c] + 255));
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (int c = 0; c < Histogram::ChannelCount; ++c) {
+        QPainterPath path(QPointF(plot.left(), plot.bottom()));
+        for (int i = 0; i < 256; ++i) {
+            const double x = plot.left() + plot.width() * (i + 0.5) / 256.0;
+            const double value = std::min<double>(histogram.bins[c][i], peak);
+            path.lineTo(x, plot.bottom() - plot.height() * value / peak);
+        }
+        path.lineTo(plot.right(), plot.bottom());
+        if (c == Histogram::Luma) {
+            painter.setPen(channelColors[c]);
+            painter.setBrush(Qt::NoBrush);
+        } else {
+            painter.setPen(Qt::NoPen);
+            QColor fill = channelColors[c];
+            fill.setAlpha(70);
+            painter.setBrush(fill);
+        }
+        painter.drawPath(path);
+    }
+
+    // Каналы, в которых есть обрезанные пиксели, отмечаются полосой у соответствующего края
+    for (int c = 0; c < Histogram::ChannelCount; ++c) {
+        const int y = plot.top() + c * 4;
+        if (histogram.bins[c][0] > 0)
+            painter.fillRect(QRect(plot.left(), y, 4, 3), channelColors[c]);
+        if (histogram.bins[c][255] > 0)
+            painter.fillRect(QRect(plot.right() - 3, y, 4, 3), channelColors[c]);
+    }
+
+    painter.setPen(textColor);
+    painter.drawText(QRect(area.left() + 2, plot.bottom() + 1, area.width() - 4, textHeight),
+                     Qt::AlignLeft | Qt::AlignVCenter,
+                     QStringLiteral("Clipped (black / white): %1").arg(clippingText(histogram, Histogram::Luma)));
+}
@@ -0,0 +1,39 @@
+#ifndef HISTOGRAMWIDGET_H
+#define HISTOGRAMWIDGET_H
+
+#include <QWidget>
+#include "histogramservice.h"
+
+/*!
+ * \brief The HistogramWidget class рисует гистограммы каналов R, G, B и яркости
+ * и долю пикселей, обрезанных в черное (0) и белое (255) по каждому каналу.
+ */
+class HistogramWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit HistogramWidget(QWidget *parent = nullptr);
+    /*!
+     * \brief setHistogram задает отображаемую гистограмму и перерисовывает виджет
+     */
+    void setHistogram(const Histogram &histogram);
+    /*!
+     * \brief render рисует гистограмму в изображение заданного размера
+     * (используется и виджетом, и окном эквализации гистограммы)
+     */
+    static QImage render(const Histogram &histogram, const QSize &size);
+
+    QSize sizeHint() const override { return QSize(256, 180); }
+    QSize minimumSizeHint() const override { return QSize(128, 100); }
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    static void draw(QPainter &painter, const Histogram &histogram, const QRect &area, const QColor &textColor);
+
+    Histogram current;
+};
+
+#endif // HISTOGRAMWIDGET_H
@@ -0,0 +1,404 @@
+#include "imagecanvas.h"
+#include "profiler.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QScrollBar>
+#include <QtMath>
+
+constexpr qreal ImageCanvas::MinZoom;
+constexpr qreal ImageCanvas::MaxZoom;
+
+ImageCanvas::ImageCanvas(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    setBackgroundRole(QPalette::Dark);
+    viewport()->setBackgroundRole(QPalette::Dark);
+    // Фон и изображение рисует paintEvent, очищать область просмотра заранее не нужно
+    viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
+    // 64 МБ 8-битных тайлов - примерно четыре экрана 4K
+    displayTiles.setMaxCost(64 * 1024);
+    horizontalScrollBar()->setSingleStep(20);
+    verticalScrollBar()->setSingleStep(20);
+    pyramid = new ImagePyramid(this);
+    QObject::connect(pyramid, SIGNAL(levelsUpdated()), viewport(), SLOT(update()));
+}
+
+void ImageCanvas::setDocument(const TiledImage *document, const QRect &view)
+{
+    this->document = document;
+    pyramid->setSource(document);
+    setView(view);
+}
+
+void ImageCanvas::setView(const QRect &view)
+{
+    this->view = !document ? QRect() : view.isEmpty() ? document->rect() : view & document->rect();
+    if (fitToWindow)
+        zoomFactor = fitZoom();
+    updateScrollBars();
+    setOffset(offset);
+    viewport()->update();
+    emit viewChanged();
+}
+
+void ImageCanvas::updateImageRect(const QRect &imageRect)
+{
+    if (!document || document->isNull())
+        return;
+    pyramid->invalidate(imageRect.translated(view.topLeft()));
+    viewport()->update(mapFromImage(QRectF(imageRect)).toAlignedRect().adjusted(-1, -1, 1, 1));
+}
+
+void ImageCanvas::setPreview(const QImage &image)
+{
+    previewSource = image;
+    preview = displayImage(image, colorTransform.get());
+    viewport()->update();
+}
+
+void ImageCanvas::setColorTransform(const std::shared_ptr<const ColorLut> &transform)
+{
+    if (transform == colorTransform)
+        return;
+    colorTransform = transform;
+    displayTiles.clear();
+    preview = displayImage(previewSource, colorTransform.get());
+    viewport()->update();
+}
+
+void ImageCanvas::setZoom(qreal zoom)
+{
+    zoomBy(zoom / zoomFactor, QRectF(viewport()->rect()).center());
+}
+
+void ImageCanvas::zoomBy(qreal factor, const QPointF &anchor)
+{
+    const qreal zoom = qBound(MinZoom, zoomFactor * factor, MaxZoom);
+    if (qFuzzyCompare(zoom, zoomFactor))
+        return;
+    const QPointF fixed = mapToImage(anchor);
+    zoomFactor = zoom;
+    updateScrollBars();
+    setOffset(fixed * zoomFactor - anchor);
+    viewport()->update();
+    emit zoomChanged(zoomFactor);
+    emit viewChanged();
+}
+
+void ImageCanvas::setFitToWindow(bool fit)
+{
+    fitToWindow = fit;
+    if (!fit)
+        return;
+    zoomFactor = fitZoom();
+    updateScrollBars();
+    setOffset(QPointF());
+    viewport()->update();
+    emit zoomChanged(zoomFactor);
+    emit viewChanged();
+}
+
+qreal ImageCanvas::fitZoom() const
+{
+    if (!document || document->isNull())
+        return 1;
+    const QSize area = viewport()->size();
+    const qreal zoom = qMin(qreal(area.width()) / view.width(), qreal(area.height()) / view.height());
+    return qBound(MinZoom, zoom, MaxZoom);
+}
+
+QRect ImageCanvas::visibleImageRect() const
+{
+    if (!document || document->isNull())
+        return QRect();
+    const QPointF topLeft = mapToImage(QPointF(0, 0));
+    const QPointF bottomRight = mapToImage(QPointF(viewport()->width(), viewport()->height()));
+    return QRectF(topLeft, bottomRight).toAlignedRect() & QRect(QPoint(0, 0), view.size());
+}
+
+QPointF ImageCanvas::origin() const
+{
+    if (!document || document->isNull())
+        return QPointF();
+    const qreal contentWidth = view.width() * zoomFactor;
+    const qreal contentHeight = view.height() * zoomFactor;
+    const qreal x = contentWidth < viewport()->width() ? (viewport()->width() - contentWidth) / 2 : -offset.x();
+    const qreal y = contentHeight < viewport()->height() ? (viewport()->height() - contentHeight) / 2 : -offset.y();
+    return QPointF(x, y);
+}
+
+QPointF ImageCanvas::mapToImage(const QPointF &point) const
+{
+    return (point - origin()) / zoomFactor;
+}
+
+QRectF ImageCanvas::mapFromImage(const QRectF &rect) const
+{
+    return QRectF(rect.topLeft() * zoomFactor + origin(), rect.size() * zoomFactor);
+}
+
+QRectF ImageCanvas::mapFromDocument(const QRectF &rect) const
+{
+    return mapFromImage(rect.translated(-view.topLeft()));
+}
+
+QPoint ImageCanvas::imagePoint(const QPointF &point) const
+{
+    const QPointF mapped = mapToImage(point);
+    return QPoint(qFloor(mapped.x()), qFloor(mapped.y()));
+}
+
+void ImageCanvas::updateScrollBars()
+{
+    const QSize area = viewport()->size();
+    QSize content;
+    if (document && !document->isNull() && !fitToWindow)
+        content = QSize(qCeil(view.width() * zoomFactor), qCeil(view.height() * zoomFactor));
+    QScrollBar *horizontal = horizontalScrollBar();
+    QScrollBar *vertical = verticalScrollBar();
+    const QSignalBlocker blockHorizontal(horizontal);
+    const QSignalBlocker blockVertical(vertical);
+    horizontal->setRange(0, qMax(0, content.width() - area.width()));
+    horizontal->setPageStep(area.width());
+    vertical->setRange(0, qMax(0, content.height() - area.height()));
+    vertical->setPageStep(area.height());
+}
+
+void ImageCanvas::setOffset(const QPointF &value)
+{
+    QScrollBar *horizontal = horizontalScrollBar();
+    QScrollBar *vertical = verticalScrollBar();
+    offset = QPointF(qBound<qreal>(0, value.x(), horizontal->maximum()),
+                     qBound<qreal>(0, value.y(), vertical->maximum()));
+    const QSignalBlocker blockHorizontal(horizontal);
+    const QSignalBlocker blockVertical(vertical);
+    horizontal->setValue(qRound(offset.x()));
+    vertical->setValue(qRound(offset.y()));
+}
+
+void ImageCanvas::scrollContentsBy(int dx, int dy)
+{
+    const bool aligned = offset == offset.toPoint();
+    offset = QPointF(horizontalScrollBar()->value(), verticalScrollBar()->value());
+    // Если область просмотра стояла на целых пикселях, уже нарисованное сдвигается, перерисовывается только полоса
+    if (aligned)
+        viewport()->scroll(dx, dy);
+    else
+        viewport()->update();
+    emit viewChanged();
+}
+
+void ImageCanvas::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    if (fitToWindow) {
+        const qreal zoom = fitZoom();
+        if (!qFuzzyCompare(zoom, zoomFactor)) {
+            zoomFactor = zoom;
+            emit zoomChanged(zoomFactor);
+        }
+    }
+    updateScrollBars();
+    setOffset(offset);
+    emit viewChanged();
+}
+
+void ImageCanvas::paintEvent(QPaintEvent *event)
+{
+    TRACE_SCOPE("paint");
+    QPainter painter(viewport());
+    const QRect dirty = event->rect();
+    if (!document || document->isNull()) {
+        painter.fillRect(dirty, palette().dark());
+        return;
+    }
+    const QRectF imageArea = mapFromImage(QRectF(QPointF(0, 0), QSizeF(view.size())));
+    painter.setClipRegion(QRegion(dirty).subtracted(QRegion(imageArea.toRect())));
+    painter.fillRect(dirty, palette().dark());
+    painter.setClipRect(dirty & imageArea.toAlignedRect());
+    // Уменьшенное изображение сглаживается; при увеличении пиксели остаются четкими
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, zoomFactor < 1);
+
+    const QRectF visible = QRectF(mapToImage(dirty.topLeft()), mapToImage(dirty.bottomRight() + QPoint(1, 1)));
+    // Пока файл загружается, невыделенные тайлы рисуются из предпросмотра, поэтому пирамида не используется
+    const int level = preview.isNull() ? qMin(ImagePyramid::levelFor(zoomFactor), pyramid->levelCount()) : 0;
+    pyramid->request(level);
+    drawLevel(painter, level, visible.toAlignedRect().translated(view.topLeft()) & view);
+}
+
+void ImageCanvas::drawLevel(QPainter &painter, int level, const QRect &imageRect)
+{
+    if (level > 0) {
+        const TiledImage &source = pyramid->level(level);
+        const int factor = 1 << level;
+        const QRect levelArea(QPoint(imageRect.left() / factor, imageRect.top() / factor),
+                              QPoint(imageRect.right() / factor, imageRect.bottom() / factor));
+        const QRect range = source.tilesIn(levelArea);
+        for (int row = range.top(); row <= range.bottom(); ++row) {
+            for (int column = range.left(); column <= range.right(); ++column) {
+                const QRect bounds = source.tileRect(column, row);
+                const QRect covered(bounds.x() * factor, bounds.y() * factor, bounds.width() * factor, bounds.height() * factor);
+                if (pyramid->isTileReady(level, column, row))
+                    painter.drawImage(mapFromDocument(QRectF(covered)), displayTile(source.tile(column, row)));
+                else
+                    drawLevel(painter, level - 1, covered & imageRect);
+            }
+        }
+        return;
+    }
+
+    const QRect range = document->tilesIn(imageRect);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const QRect bounds = document->tileRect(column, row);
+            const QRectF target = mapFromDocument(QRectF(bounds));
+            if (document->isTileAllocated(column, row)) {
+                painter.drawImage(target, displayTile(document->tile(column, row)));
+            } else if (!preview.isNull()) {
+                const qreal px = qreal(preview.width()) / document->width();
+                const qreal py = qreal(preview.height()) / document->height();
+                painter.drawImage(target, preview,
+                                  QRectF(bounds.x() * px, bounds.y() * py, bounds.width() * px, bounds.height() * py));
+            } else {
+                painter.fillRect(target, QColor::fromRgba(document->background()));
+            }
+        }
+    }
+}
+
+QImage ImageCanvas::displayTile(const QImage &tile)
+{
+    if (!colorTransform) {
+        switch (tile.format()) {
+        case QImage::Format_RGBA64:
+        case QImage::Format_RGBA64_Premultiplied:
+        case QImage::Format_RGBX64:
+        case QImage::Format_Grayscale16:
+            break;
+        default:
+            return tile;
+        }
+    }
+    if (const QImage *cached = displayTiles.object(tile.cacheKey()))
+        return *cached;
+    QImage *converted = new QImage(displayImage(tile, colorTransform.get()));
+    const QImage result = *converted;
+    displayTiles.insert(tile.cacheKey(), converted, qMax(1, int(converted->sizeInBytes() / 1024)));
+    return result;
+}
+
+QImage ImageCanvas::displayImage(const QImage &image, const ColorLut *transform)
+{
+    if (image.isNull())
+        return image;
+    const bool alpha = image.hasAlphaChannel();
+    if (!transform) {
+        if (image.depth() <= 32 && image.format() != QImage::Format_Grayscale16)
+            return image;
+        return image.convertToFormat(alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    }
+    // Таблица применяется к 16-битным цветам без премультипликации альфы, и только результат квантуется
+    // до 8 бит: иначе ошибки округления входа и выхода складываются в заметные полосы на плавных переходах
+    QImage converted = image.convertToFormat(alpha ? QImage::Format_RGBA64 : QImage::Format_RGBX64);
+    transform->apply(converted);
+    return converted.convertToFormat(alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+}
+
+void ImageCanvas::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::MiddleButton || (event->button() == Qt::LeftButton && state == -1)) {
+        panning = true;
+        panStart = event->localPos();
+        viewport()->setCursor(Qt::ClosedHandCursor);
+        return;
+    }
+    switch (state) {
+    case 0: {
+        begin = imagePoint(event->localPos());
+        if (!rubberBand) rubberBand = new QRubberBand(QRubberBand::Rectangle, viewport());
+        rubberBand->setGeometry(QRect(event->pos(), QSize()));
+        rubberBand->show();
+        break;
+    }
+    case 1: {
+        begin = imagePoint(event->localPos());
+        end = begin;
+        emit drawing(0);
+        break;
+    }
+    case 2: {
+        begin = imagePoint(event->localPos());
+        bool ok;
+        QString text = QInputDialog::getText(this, tr("Text Shape"),
+                                             tr("Enter text:"),
+                                             QLineEdit::Normal, tr("Some Text"),&ok,Qt::MSWindowsFixedSizeDialogHint);
+        emit generateText(text);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void ImageCanvas::mouseMoveEvent(QMouseEvent *event)
+{
+    if (panning) {
+        const QPointF delta = event->localPos() - panStart;
+        panStart = event->localPos();
+        setOffset(offset - delta);
+        viewport()->update();
+        emit viewChanged();
+        return;
+    }
+    switch (state) {
+        case 0:
+            if (rubberBand) {
+                const QRectF selection(mapFromImage(QRectF(begin, QSizeF(0, 0))).topLeft(), event->localPos());
+                rubberBand->setGeometry(selection.normalized().toRect());
+            }
+            break;
+        case 1:
+            begin = end;
+            end = imagePoint(event->localPos());
+            emit drawing(1);
+            break;
+        default:
+            break;
+    }
+
+}
+
+void ImageCanvas::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (panning) {
+        panning = false;
+        viewport()->unsetCursor();
+        return;
+    }
+    switch (state) {
+        case 0:
+            end = imagePoint(event->localPos());
+            if (rubberBand) rubberBand->hide();
+            emit areaSelected();
+            break;
+        case 1:
+            begin = end;
+            end = imagePoint(event->localPos());
+            emit drawing(2);
+            break;
+        default:
+            break;
+    }
+
+}
+
+void ImageCanvas::wheelEvent(QWheelEvent *event)
+{
+    if (!(event->modifiers() & Qt::ControlModifier) || fitToWindow) {
+        QAbstractScrollArea::wheelEvent(event);
+        return;
+    }
+    // Один шаг колеса (120 единиц) - четверть удвоения масштаба
+    zoomBy(qPow(2.0, event->angleDelta().y() / 480.0), event->position());
+    event->accept();
+}
@@ -0,0 +1,247 @@
+#ifndef IMAGECANVAS_H
+#define IMAGECANVAS_H
+#include <QAbstractScrollArea>
+#include <QRubberBand>
+#include <QPoint>
+#include <QPointF>
+#include <QMouseEvent>
+#include <QInputDialog>
+#include <QCache>
+#include <memory>
+#include "tiledimage.h"
+#include "imagepyramid.h"
+#include "colormanager.h"
+
+
+/*!
+ * \brief The ImageCanvas class центральная область редактора: рисует видимую часть документа
+ * в текущем масштабе и обрабатывает нажатия мыши в режимах обрезки, рисования и наложения текста.
+ *
+ * Виджет не растягивает изображение целиком: при каждой перерисовке из документа берутся только тайлы,
+ * попадающие в перерисовываемую часть области просмотра. Положение области просмотра хранится с дробной
+ * точностью, поэтому масштабирование относительно курсора и перетаскивание не накапливают ошибку округления.
+ * Все координаты, которые виджет сообщает наружу (begin, end), - координаты изображения.
+ * Изображение - это видимая область документа (view): после обрезки документ не копируется, а виджет
+ * показывает только его часть, и точка (0, 0) изображения соответствует view.topLeft() документа.
+ * При масштабе меньше 1/2 тайлы берутся из ImagePyramid - ближайшего уровня, который не меньше экрана.
+ * 16-битные тайлы переводятся в 8 бит только для показа (displayTile); документ остается 16-битным.
+ * Там же видимые тайлы переводятся из цветового пространства документа в пространство экрана (setColorTransform).
+ */
+class ImageCanvas : public QAbstractScrollArea
+{
+   Q_OBJECT
+public:
+    /*!
+     * \brief MinZoom минимальный масштаб
+     */
+    static constexpr qreal MinZoom = 1.0 / 64;
+    /*!
+     * \brief MaxZoom максимальный масштаб
+     */
+    static constexpr qreal MaxZoom = 64;
+
+    explicit ImageCanvas(QWidget *parent = nullptr);
+    /*!
+     * \brief begin Координаты начала обрезки/рисования/текста
+     */
+    QPoint begin;
+    /*!
+     * \brief end Координаты конца обрезки/последующей точки при рисовании
+     */
+    QPoint end;
+    /*!
+     * \brief state Состояние редактора
+     * -1, если ни один из режимов не включен.
+     * 0, если режим обрезки
+     * 1, если режим рисования
+     * 2, если режим наложения текста
+     */
+    int state = -1;
+    /*!
+     * \brief setDocument устанавливает документ, тайлы которого рисуются в виджете.
+     * Виджет не владеет документом; после смены размера документа или видимой области метод нужно вызвать снова.
+     * \param document указатель на документ или nullptr
+     * \param view видимая область документа (обрезка); пустой прямоугольник - весь документ
+     */
+    void setDocument(const TiledImage *document, const QRect &view = QRect());
+    /*!
+     * \brief setView меняет видимую область того же документа. Уровни пирамиды при этом не перестраиваются,
+     * поэтому обрезка и ее отмена не требуют ни копирования, ни пересчета пикселей.
+     */
+    void setView(const QRect &view);
+    /*!
+     * \brief imageSize размер изображения (видимой области документа)
+     */
+    QSize imageSize() const { return view.size(); }
+    /*!
+     * \brief updateImageRect перерисовывает часть области просмотра, соответствующую прямоугольнику изображения
+     * \param imageRect прямоугольник в координатах изображения
+     */
+    void updateImageRect(const QRect &imageRect);
+    /*!
+     * \brief setPreview задает уменьшенную копию изображения, которая рисуется на месте
+     * еще не выделенных тайлов документа (пока файл загружается). Пустое изображение отключает предпросмотр.
+     */
+    void setPreview(const QImage &preview);
+    /*!
+     * \brief setColorTransform задает перевод цветов документа в пространство экрана
+     * (см. ColorManager::displayTransform); nullptr - документ показывается без преобразования
+     */
+    void setColorTransform(const std::shared_ptr<const ColorLut> &transform);
+    /*!
+     * \brief displayImage переводит изображение в 8 бит и в пространство экрана transform (без кэша);
+     * используется и окнами предпросмотра эффектов
+     * \param transform перевод в пространство экрана; nullptr - без преобразования
+     */
+    static QImage displayImage(const QImage &image, const ColorLut *transform);
+
+    qreal zoom() const { return zoomFactor; }
+    /*!
+     * \brief setZoom устанавливает масштаб, сохраняя на месте точку изображения под центром области просмотра
+     */
+    void setZoom(qreal zoom);
+    /*!
+     * \brief zoomBy умножает масштаб на factor, сохраняя на месте точку изображения под anchor
+     * \param anchor точка в координатах области просмотра
+     */
+    void zoomBy(qreal factor, const QPointF &anchor);
+    /*!
+     * \brief setFitToWindow в этом режиме масштаб подбирается так, чтобы изображение целиком помещалось в окно
+     */
+    void setFitToWindow(bool fit);
+    bool isFitToWindow() const { return fitToWindow; }
+    /*!
+     * \brief visibleImageRect видимая часть изображения в координатах изображения
+     */
+    QRect visibleImageRect() const;
+    /*!
+     * \brief mapToImage переводит точку области просмотра в координаты изображения
+     */
+    QPointF mapToImage(const QPointF &point) const;
+    /*!
+     * \brief mapFromImage переводит прямоугольник изображения в координаты области просмотра
+     */
+    QRectF mapFromImage(const QRectF &rect) const;
+signals:
+    /*!
+     * \brief areaSelected Сигнал о завершении выделения
+     */
+    void areaSelected();
+    /*!
+     * \brief drawing Сигнал об обновлении полей begin и end.
+     * Если передает 0 в параметре, значит линия начата.
+     * Если передает 1 в параметре, значит линия рисуется.
+     * Если передает 2 в параметре, значит линия нарисована.
+     */
+    void drawing(int);
+    /*!
+     * \brief generateText Сигнал о получении текста из диалогового окна
+     * и установки координаты размещения этого текста.
+     */
+    void generateText(QString);
+    /*!
+     * \brief viewChanged Сигнал об изменении видимой части изображения (прокрутка, масштаб, размер окна)
+     */
+    void viewChanged();
+    /*!
+     * \brief zoomChanged Сигнал об изменении масштаба
+     */
+    void zoomChanged(qreal zoom);
+protected:
+   /*!
+    * \brief paintEvent рисует только тайлы документа, попадающие в перерисовываемую часть области просмотра
+    * \param event событие перерисовки
+    */
+   void paintEvent(QPaintEvent *event) override;
+   /*!
+    * \brief mousePressEvent
+    * Обработчик события нажатия, который:
+    * 1) Устанавливает параметры для обрезки изображения
+    * 2) Устанавливает параметры для рисования
+    * 3) Устанавливает координаты наложенного текста и вызывает текстовое окно
+    * Средняя кнопка (и левая, если ни один режим не включен) начинает перетаскивание изображения.
+    * \param event событие мыши
+   */
+   void mousePressEvent(QMouseEvent *event) override;
+   /*!
+    * \brief mouseMoveEvent
+    * 1) устанавливает выделенную область при движении в режиме обрезки
+    * 2) устанавливает координаты новой точки в режиме рисования
+    * 3) сдвигает изображение при перетаскивании
+    * \param event событие мыши
+    */
+   void mouseMoveEvent(QMouseEvent *event) override;
+   /*!
+    * \brief mouseReleaseEvent
+    * 1) Отправляет выделенную область в режиме обрезки
+    * 2) Устанавливает финальную точку в режиме рисования, сообщает о завершении
+    * \param event событие мыши
+    */
+   void mouseReleaseEvent(QMouseEvent *event) override;
+   /*!
+    * \brief wheelEvent с зажатым Ctrl масштабирует изображение относительно курсора, иначе прокручивает
+    */
+   void wheelEvent(QWheelEvent *event) override;
+   void resizeEvent(QResizeEvent *event) override;
+   /*!
+    * \brief scrollContentsBy синхронизирует положение области просмотра с полосами прокрутки
+    */
+   void scrollContentsBy(int dx, int dy) override;
+private:
+   /*!
+    * \brief origin положение точки (0, 0) изображения в координатах области просмотра.
+    * Если изображение меньше области просмотра, оно центрируется.
+    */
+   QPointF origin() const;
+   /*!
+    * \brief mapFromDocument переводит прямоугольник документа в координаты области просмотра
+    */
+   QRectF mapFromDocument(const QRectF &rect) const;
+   QPoint imagePoint(const QPointF &point) const;
+   /*!
+    * \brief setOffset сдвигает область просмотра (в пикселях масштабированного изображения)
+    * и обновляет полосы прокрутки, не вызывая scrollContentsBy
+    */
+   void setOffset(const QPointF &offset);
+   void updateScrollBars();
+   qreal fitZoom() const;
+   /*!
+    * \brief drawLevel рисует часть изображения imageRect из уровня пирамиды level.
+    * Тайлы, которые на этом уровне еще не готовы, рисуются из более детального уровня.
+    */
+   void drawLevel(QPainter &painter, int level, const QRect &imageRect);
+   /*!
+    * \brief displayTile тайл в 8-битном формате пространства экрана для рисования. Тайлы форматов
+    * больше 8 бит на канал и все тайлы при заданном colorTransform переводятся один раз на каждую
+    * версию тайла (ключ - QImage::cacheKey), иначе перевод повторялся бы при каждой перерисовке.
+    */
+   QImage displayTile(const QImage &tile);
+
+   QRubberBand* rubberBand = nullptr;
+   QImage previewSource;
+   /*!
+    * \brief preview previewSource в пространстве экрана
+    */
+   QImage preview;
+   std::shared_ptr<const ColorLut> colorTransform;
+   const TiledImage *document = nullptr;
+   /*!
+    * \brief view видимая область документа
+    */
+   QRect view;
+   ImagePyramid *pyramid = nullptr;
+   qreal zoomFactor = 1;
+   bool fitToWindow = false;
+   /*!
+    * \brief offset левый верхний угол области просмотра в пикселях масштабированного изображения
+    */
+   QPointF offset;
+   bool panning = false;
+   QPointF panStart;
+   /*!
+    * \brief displayTiles тайлы, подготовленные displayTile; стоимость - в килобайтах
+    */
+   QCache<qint64, QImage> displayTiles;
+};
+
+#endif // IMAGECANVAS_H
@@ -0,0 +1,254 @@
+#include "imagedelta.h"
+#include "imagepool.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <opencv2/core.hpp>
+#include <cstring>
+
+namespace {
+
+// Быстрое сжатие: разница после XOR почти целиком состоит из нулей.
+const int CompressionLevel = 1;
+
+QImage materialize(const TiledImage &image, int column, int row)
+{
+    if (image.isTileAllocated(column, row))
+        return image.tile(column, row);
+    QImage tile = ImagePool::instance().acquire(image.tileRect(column, row).size(), image.format());
+    tile.fill(QColor::fromRgba(image.background()));
+    return tile;
+}
+
+// Прямоугольник пикселей, в которых a и b различаются; пустой, если тайлы совпадают.
+QRect differingRect(const QImage &a, const QImage &b)
+{
+    const int bytesPerPixel = a.depth() / 8;
+    const int rowBytes = a.width() * bytesPerPixel;
+    int top = -1;
+    int bottom = -1;
+    int left = a.width();
+    int right = -1;
+    for (int y = 0; y < a.height(); ++y) {
+        const uchar *pa = a.constScanLine(y);
+        const uchar *pb = b.constScanLine(y);
+        if (std::memcmp(pa, pb, static_cast<size_t>(rowBytes)) == 0)
+            continue;
+        if (top < 0)
+            top = y;
+        bottom = y;
+        int first = 0;
+        while (pa[first] == pb[first])
+            ++first;
+        int last = rowBytes - 1;
+        while (pa[last] == pb[last])
+            --last;
+        left = qMin(left, first / bytesPerPixel);
+        right = qMax(right, last / bytesPerPixel);
+    }
+    if (top < 0)
+        return QRect();
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+QByteArray packRect(const QImage &a, const QImage *b, const QRect &rect)
+{
+    const int bytesPerPixel = a.depth() / 8;
+    const int rowBytes = rect.width() * bytesPerPixel;
+    QByteArray raw(rowBytes * rect.height(), Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar *>(raw.data());
+    for (int y = 0; y < rect.height(); ++y) {
+        const uchar *pa = a.constScanLine(rect.y() + y) + rect.x() * bytesPerPixel;
+        if (b) {
+            const uchar *pb = b->constScanLine(rect.y() + y) + rect.x() * bytesPerPixel;
+            for (int i = 0; i < rowBytes; ++i)
+                out[i] = pa[i] ^ pb[i];
+        } else {
+            std::memcpy(out, pa, static_cast<size_t>(rowBytes));
+        }
+        out += rowBytes;
+    }
+    return qCompress(raw, CompressionLevel);
+}
+
+}
+
+ImageDelta::ImageDelta(const TiledImage &before, const TiledImage &after)
+{
+    if (before.size() != after.size() || before.format() != after.format()) {
+        snapshot = true;
+        changedRegion = before.rect() | after.rect();
+        encodeSnapshot(before);
+        return;
+    }
+
+    const int columns = before.tileColumns();
+    const int count = columns * before.tileRows();
+    QVector<Entry> results(count);
+    Entry *target = results.data();
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const int column = i % columns;
+            const int row = i / columns;
+            const bool allocatedBefore = before.isTileAllocated(column, row);
+            const bool allocatedAfter = after.isTileAllocated(column, row);
+            if (!allocatedBefore && !allocatedAfter)
+                continue;
+            if (allocatedBefore && allocatedAfter
+                    && before.tile(column, row).cacheKey() == after.tile(column, row).cacheKey())
+                continue;
+            const QImage a = materialize(before, column, row);
+            const QImage b = materialize(after, column, row);
+            const QRect rect = differingRect(a, b);
+            if (rect.isEmpty())
+                continue;
+            target[i].column = column;
+            target[i].row = row;
+            target[i].rect = rect;
+            target[i].data = packRect(a, &b, rect);
+        }
+    });
+
+    for (const Entry &entry : results) {
+        if (entry.data.isEmpty())
+            continue;
+        entries.append(entry);
+        changedRegion |= entry.rect.translated(before.tileRect(entry.column, entry.row).topLeft());
+    }
+}
+
+void ImageDelta::apply(TiledImage &document)
+{
+    const bool wasSpilled = spilled;
+    if (spilled && !restore()) {
+        qWarning() << "ImageDelta::apply() - cannot read spilled undo data";
+        return;
+    }
+
+    if (snapshot) {
+        const TiledImage stored = decodeSnapshot();
+        encodeSnapshot(document);
+        document = stored;
+    } else {
+        QVector<QImage *> tiles(entries.size());
+        for (int i = 0; i < entries.size(); ++i)
+            tiles[i] = &document.tileForWrite(entries[i].column, entries[i].row);
+        cv::parallel_for_(cv::Range(0, entries.size()), [&](const cv::Range &range) {
+            for (int i = range.start; i < range.end; ++i) {
+                const Entry &entry = entries.at(i);
+                QImage &tile = *tiles.at(i);
+                const QByteArray raw = qUncompress(entry.data);
+                const int bytesPerPixel = tile.depth() / 8;
+                const int rowBytes = entry.rect.width() * bytesPerPixel;
+                const uchar *in = reinterpret_cast<const uchar *>(raw.constData());
+                for (int y = 0; y < entry.rect.height(); ++y) {
+                    uchar *out = tile.scanLine(entry.rect.y() + y) + entry.rect.x() * bytesPerPixel;
+                    for (int x = 0; x < rowBytes; ++x)
+                        out[x] ^= in[x];
+                    in += rowBytes;
+                }
+            }
+        });
+    }
+
+    if (wasSpilled)
+        spill();
+}
+
+qint64 ImageDelta::residentBytes() const
+{
+    qint64 bytes = 0;
+    for (const Entry &entry : entries)
+        bytes += entry.data.size();
+    return bytes;
+}
+
+bool ImageDelta::spill()
+{
+    if (spilled)
+        return true;
+    if (!spillFile) {
+        spillFile.reset(new QTemporaryFile);
+        if (!spillFile->open()) {
+            spillFile.reset();
+            return false;
+        }
+    }
+    spillFile->resize(0);
+    spillFile->seek(0);
+    QDataStream stream(spillFile.data());
+    stream << snapshotSize << static_cast<int>(snapshotFormat) << snapshotBackground << entries.size();
+    for (const Entry &entry : entries)
+        stream << entry.column << entry.row << entry.rect << entry.data;
+    if (stream.status() != QDataStream::Ok || !spillFile->flush())
+        return false;
+    entries = QVector<Entry>();
+    spilled = true;
+    return true;
+}
+
+bool ImageDelta::restore()
+{
+    if (!spillFile || !spillFile->seek(0))
+        return false;
+    QDataStream stream(spillFile.data());
+    int format = 0;
+    int count = 0;
+    stream >> snapshotSize >> format >> snapshotBackground >> count;
+    snapshotFormat = static_cast<QImage::Format>(format);
+    QVector<Entry> restored(count);
+    for (Entry &entry : restored)
+        stream >> entry.column >> entry.row >> entry.rect >> entry.data;
+    if (stream.status() != QDataStream::Ok)
+        return false;
+    entries = restored;
+    spilled = false;
+    return true;
+}
+
+void ImageDelta::encodeSnapshot(const TiledImage &document)
+{
+    snapshotSize = document.size();
+    snapshotFormat = document.format();
+    snapshotBackground = document.background();
+
+    const int columns = document.tileColumns();
+    const int count = columns * document.tileRows();
+    QVector<Entry> results(count);
+    Entry *target = results.data();
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const int column = i % columns;
+            const int row = i / columns;
+            if (!document.isTileAllocated(column, row))
+                continue;
+            const QImage tile = document.tile(column, row);
+            target[i].column = column;
+            target[i].row = row;
+            target[i].rect = tile.rect();
+            target[i].data = packRect(tile, nullptr, tile.rect());
+        }
+    });
+
+    entries.clear();
+    for (const Entry &entry : results) {
+        if (!entry.data.isEmpty())
+            entries.append(entry);
+    }
+}
+
+TiledImage ImageDelta::decodeSnapshot() const
+{
+    TiledImage result(snapshotSize, snapshotFormat, snapshotBackground);
+    for (const Entry &entry : entries) {
+        const QByteArray raw = qUncompress(entry.data);
+        QImage &tile = result.tileForWrite(entry.column, entry.row);
+        const int rowBytes = entry.rect.width() * (tile.depth() / 8);
+        const uchar *in = reinterpret_cast<const uchar *>(raw.constData());
+        for (int y = 0; y < entry.rect.height(); ++y) {
+            std::memcpy(tile.scanLine(y), in, static_cast<size_t>(rowBytes));
+            in += rowBytes;
+        }
+    }
+    return result;
+}
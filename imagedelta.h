@@ -0,0 +1,82 @@
+#ifndef IMAGEDELTA_H
+#define IMAGEDELTA_H
+
+#include <QByteArray>
+#include <QRect>
+#include <QScopedPointer>
+#include <QTemporaryFile>
+#include <QVector>
+#include "tiledimage.h"
+
+/*!
+ * \brief The ImageDelta class хранит разницу между двумя состояниями документа.
+ *
+ * Если размер и формат документа не изменились, для каждого измененного тайла хранится
+ * только прямоугольник изменившихся пикселей: XOR старых и новых байт, сжатый zlib.
+ * Применение такой разницы к любому из двух состояний дает другое, поэтому одна и та же
+ * разница служит и для отмены, и для повтора. Тайлы, разделяемые обоими состояниями, не сравниваются.
+ *
+ * Если размер или формат изменились (обрезка, смена формата фильтром), хранится сжатый
+ * снимок того состояния, которое сейчас не показано; при применении снимок и документ меняются местами.
+ *
+ * Содержимое можно выгрузить во временный файл (spill), чтобы освободить оперативную память.
+ */
+class ImageDelta
+{
+public:
+    /*!
+     * \brief ImageDelta вычисляет разницу между before и after
+     * \param before документ до действия
+     * \param after документ после действия
+     */
+    ImageDelta(const TiledImage &before, const TiledImage &after);
+    /*!
+     * \brief apply превращает одно состояние документа в другое (after в before и наоборот)
+     * \param document текущий документ, изменяется на месте
+     */
+    void apply(TiledImage &document);
+    /*!
+     * \brief region прямоугольник изменившихся пикселей в координатах изображения
+     */
+    QRect region() const { return changedRegion; }
+    /*!
+     * \brief residentBytes объем оперативной памяти, занятый разницей
+     */
+    qint64 residentBytes() const;
+    /*!
+     * \brief isSpilled true, если содержимое выгружено во временный файл
+     */
+    bool isSpilled() const { return spilled; }
+    /*!
+     * \brief spill выгружает содержимое во временный файл и освобождает память
+     * \return false, если файл создать или записать не удалось (содержимое остается в памяти)
+     */
+    bool spill();
+
+private:
+    /*!
+     * \brief The Entry struct сжатые байты одного тайла
+     */
+    struct Entry
+    {
+        int column = 0;
+        int row = 0;
+        QRect rect;
+        QByteArray data;
+    };
+
+    void encodeSnapshot(const TiledImage &document);
+    TiledImage decodeSnapshot() const;
+    bool restore();
+
+    bool snapshot = false;
+    bool spilled = false;
+    QRect changedRegion;
+    QSize snapshotSize;
+    QImage::Format snapshotFormat = QImage::Format_Invalid;
+    QRgb snapshotBackground = 0;
+    QVector<Entry> entries;
+    QScopedPointer<QTemporaryFile> spillFile;
+};
+
+#endif // IMAGEDELTA_H
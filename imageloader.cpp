@@ -0,0 +1,177 @@
+#include "imageloader.h"
+#include "profiler.h"
+
+#include <QImageReader>
+#include <QMetaObject>
+
+namespace {
+
+bool swapsAxes(QImageIOHandler::Transformations transformation)
+{
+    return transformation & QImageIOHandler::TransformationRotate90;
+}
+
+// Формат 8-битного документа для 16-битного файла, если 16 бит хранить не нужно
+QImage::Format lowBitDepthFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        return QImage::Format_ARGB32;
+    case QImage::Format_RGBX64:
+        return QImage::Format_RGB32;
+    case QImage::Format_Grayscale16:
+        return QImage::Format_Grayscale8;
+    default:
+        return format;
+    }
+}
+
+}
+
+ImageLoader::ImageLoader(QObject *parent)
+    : QObject(parent)
+{
+    // Полное декодирование и одна область одновременно
+    pool.setMaxThreadCount(2);
+}
+
+ImageLoader::~ImageLoader()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+bool ImageLoader::open(const QString &name, const QSize &previewBound, QImage *preview, QSize *fullSize, QString *error)
+{
+    cancel();
+
+    QImageReader reader(name);
+    reader.setAutoTransform(true);
+    QSize size = reader.size();
+    if (!size.isValid()) {
+        // Размер не известен без полного чтения: читаем сразу все
+        const QImage image = reader.read();
+        if (image.isNull()) {
+            *error = reader.errorString();
+            return false;
+        }
+        size = image.size();
+        *preview = image;
+    } else {
+        if (swapsAxes(reader.transformation()))
+            size.transpose();
+        QSize bound = previewBound;
+        if (swapsAxes(reader.transformation()))
+            bound.transpose();
+        const QSize stored = reader.size();
+        const bool large = stored.width() > bound.width() || stored.height() > bound.height();
+        if (large && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+            reader.setScaledSize(stored.scaled(bound, Qt::KeepAspectRatio));
+            *preview = reader.read();
+            if (preview->isNull()) {
+                *error = reader.errorString();
+                return false;
+            }
+        } else if (!large) {
+            // Маленькое изображение дешевле прочитать целиком сразу
+            *preview = reader.read();
+            if (preview->isNull()) {
+                *error = reader.errorString();
+                return false;
+            }
+        } else {
+            *preview = QImage();
+        }
+    }
+    *fullSize = size;
+
+    fileName = name;
+    loading = true;
+    regionBusy = false;
+    pendingRegion = QRect();
+    regionsSupported = reader.supportsOption(QImageIOHandler::ClipRect)
+            && reader.transformation() == QImageIOHandler::TransformationNone;
+    cancelled = std::make_shared<std::atomic<bool>>(false);
+
+    // Если предпросмотр уже в полном разрешении, второй раз файл не читается
+    const QImage decoded = preview->size() == size ? *preview : QImage();
+    const std::shared_ptr<std::atomic<bool>> token = cancelled;
+    const bool keepHighBitDepth = highBitDepth;
+    pool.start([this, name, decoded, token, keepHighBitDepth]() {
+        TRACE_SCOPE("ImageLoader::decode");
+        QImage image = decoded;
+        QString message;
+        int depth = image.depth();
+        if (image.isNull()) {
+            QImageReader fullReader(name);
+            fullReader.setAutoTransform(true);
+            image = fullReader.read();
+            message = fullReader.errorString();
+            depth = image.depth();
+        }
+        if (*token)
+            return;
+        if (!keepHighBitDepth && lowBitDepthFormat(image.format()) != image.format())
+            image = image.convertToFormat(lowBitDepthFormat(image.format()));
+        const QColorSpace colorSpace = image.colorSpace();
+        const TiledImage document = TiledImage::fromImage(image);
+        image = QImage();
+        if (*token)
+            return;
+        QMetaObject::invokeMethod(this, [this, name, document, depth, colorSpace, message, token]() {
+            if (*token)
+                return;
+            loading = false;
+            if (document.isNull())
+                emit failed(name, message);
+            else
+                emit loaded(name, document, depth, colorSpace);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+bool ImageLoader::requestRegion(const QRect &rect)
+{
+    if (!loading || !regionsSupported || rect.isEmpty())
+        return false;
+    if (regionBusy)
+        pendingRegion = rect;
+    else
+        startRegion(rect);
+    return true;
+}
+
+void ImageLoader::startRegion(const QRect &rect)
+{
+    regionBusy = true;
+    pendingRegion = QRect();
+    const QString name = fileName;
+    const std::shared_ptr<std::atomic<bool>> token = cancelled;
+    pool.start([this, name, rect, token]() {
+        if (*token)
+            return;
+        QImageReader reader(name);
+        reader.setClipRect(rect);
+        const QImage image = reader.read();
+        QMetaObject::invokeMethod(this, [this, rect, image, token]() {
+            if (*token)
+                return;
+            regionBusy = false;
+            if (!image.isNull())
+                emit regionLoaded(rect, image);
+            if (!pendingRegion.isEmpty() && loading)
+                startRegion(pendingRegion);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ImageLoader::cancel()
+{
+    if (cancelled)
+        *cancelled = true;
+    loading = false;
+    regionBusy = false;
+    pendingRegion = QRect();
+}
@@ -0,0 +1,97 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <QColorSpace>
+#include <QImage>
+#include <QObject>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+#include "tiledimage.h"
+
+/*!
+ * \brief The ImageLoader class открывает файлы изображений в два этапа.
+ *
+ * Сначала синхронно читается заголовок и уменьшенная до размера экрана копия: если формат поддерживает
+ * декодирование с уменьшением (JPEG уменьшает еще в DCT-области), это намного быстрее полного чтения.
+ * Затем полное изображение декодируется и разбивается на тайлы в рабочем потоке. Пиксели остаются
+ * в исходном цветовом пространстве файла: в пространство экрана переводится только показываемое (ColorManager).
+ * Пока оно не готово, отдельные области можно запросить в полном разрешении (requestRegion),
+ * если формат умеет декодировать только часть изображения.
+ */
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImageLoader(QObject *parent = nullptr);
+    /*!
+     * \brief ~ImageLoader отменяет загрузку и дожидается завершения рабочих потоков
+     */
+    ~ImageLoader();
+
+    /*!
+     * \brief open начинает загрузку файла, отменяя предыдущую
+     * \param fileName путь к файлу
+     * \param previewBound размер, в который должна уместиться копия для предпросмотра
+     * \param preview сюда записывается копия для предпросмотра (или пустое изображение, если формат не умеет
+     * быстро декодировать с уменьшением)
+     * \param fullSize сюда записывается размер полного изображения
+     * \param error сюда записывается описание ошибки
+     * \return false, если файл не удалось прочитать
+     */
+    bool open(const QString &fileName, const QSize &previewBound, QImage *preview, QSize *fullSize, QString *error);
+    /*!
+     * \brief requestRegion запрашивает область текущего файла в полном разрешении (результат - сигнал regionLoaded).
+     * Одновременно декодируется одна область; если за это время запрошено несколько, декодируется последняя.
+     * \return false, если формат не умеет декодировать часть изображения или загрузка уже завершена
+     */
+    bool requestRegion(const QRect &rect);
+    /*!
+     * \brief cancel отменяет текущую загрузку; ее результаты не будут доставлены
+     */
+    void cancel();
+    /*!
+     * \brief isLoading true, пока полное изображение не загружено
+     */
+    bool isLoading() const { return loading; }
+public slots:
+    /*!
+     * \brief setHighBitDepth сохранять ли 16 бит на канал у 16-битных файлов (по умолчанию да).
+     * Если нет, такие файлы переводятся в 8 бит при загрузке: документ занимает вдвое меньше памяти,
+     * но фильтры теряют точность. Действует на файлы, открытые после вызова.
+     */
+    void setHighBitDepth(bool keep) { highBitDepth = keep; }
+
+signals:
+    /*!
+     * \brief loaded полное изображение загружено
+     * \param fileName путь к файлу
+     * \param document изображение в виде тайлов
+     * \param depth глубина цвета исходного файла
+     * \param colorSpace цветовое пространство пикселей документа (недействительное, если файл его не задает)
+     */
+    void loaded(const QString &fileName, const TiledImage &document, int depth, const QColorSpace &colorSpace);
+    /*!
+     * \brief failed полное изображение прочитать не удалось
+     */
+    void failed(const QString &fileName, const QString &error);
+    /*!
+     * \brief regionLoaded область, запрошенная requestRegion, декодирована в полном разрешении
+     */
+    void regionLoaded(const QRect &rect, const QImage &image);
+
+private:
+    void startRegion(const QRect &rect);
+
+    QThreadPool pool;
+    QString fileName;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+    bool loading = false;
+    bool regionsSupported = false;
+    bool highBitDepth = true;
+    bool regionBusy = false;
+    QRect pendingRegion;
+};
+
+#endif // IMAGELOADER_H
@@ -0,0 +1,174 @@
+#include "imagepool.h"
+
+#include <QGlobalStatic>
+#include <cstdlib>
+#include <cstring>
+
+Q_GLOBAL_STATIC(ImagePool, globalPool)
+
+namespace {
+
+// Заголовок перед пикселями: размер класса. 64 байта сохраняют выравнивание данных.
+const size_t HeaderSize = 64;
+
+size_t sizeClass(size_t bytes)
+{
+    size_t power = 64;
+    while (power < bytes)
+        power *= 2;
+    const size_t eighth = power / 8; // классы: 5/8, 6/8, 7/8 и 8/8 от power
+    for (size_t step = 5; step < 8; ++step) {
+        if (eighth * step >= bytes)
+            return eighth * step;
+    }
+    return power;
+}
+
+size_t blockClass(void *block)
+{
+    return *static_cast<size_t *>(block);
+}
+
+uchar *blockData(void *block)
+{
+    return static_cast<uchar *>(block) + HeaderSize;
+}
+
+}
+
+ImagePool &ImagePool::instance()
+{
+    return *globalPool();
+}
+
+ImagePool::~ImagePool()
+{
+    trim();
+}
+
+QImage ImagePool::acquire(const QSize &size, QImage::Format format)
+{
+    if (size.isEmpty() || format == QImage::Format_Invalid)
+        return QImage();
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    if (depth < 8)
+        return QImage(size, format);
+    // Строки выравниваются по 4 байта, как у QImage
+    const int bytesPerLine = ((size.width() * depth + 31) >> 5) << 2;
+    const size_t bytes = size_t(bytesPerLine) * size.height();
+    const size_t cls = sizeClass(bytes);
+
+    void *block = nullptr;
+    {
+        QMutexLocker locker(&mutex);
+        auto it = idle.find(cls);
+        if (it != idle.end() && !it->isEmpty()) {
+            block = it->takeLast();
+            idleTotal -= qint64(cls);
+            ++reused;
+        } else {
+            ++allocated;
+        }
+    }
+    if (!block) {
+        block = std::malloc(HeaderSize + cls);
+        if (!block)
+            return QImage();
+        *static_cast<size_t *>(block) = cls;
+    }
+    return QImage(blockData(block), size.width(), size.height(), bytesPerLine, format, release, block);
+}
+
+QImage ImagePool::copy(const QImage &source, const QRect &rect)
+{
+    const QRect area = rect & source.rect();
+    if (area.isEmpty() || source.depth() < 8)
+        return source.copy(rect);
+    QImage result = acquire(area.size(), source.format());
+    if (result.isNull())
+        return source.copy(rect);
+    const int bytesPerPixel = source.depth() / 8;
+    const size_t rowBytes = size_t(area.width()) * bytesPerPixel;
+    for (int y = 0; y < area.height(); ++y) {
+        std::memcpy(result.scanLine(y), source.constScanLine(area.y() + y) + area.x() * bytesPerPixel, rowBytes);
+    }
+    result.setColorTable(source.colorTable());
+    result.setColorSpace(source.colorSpace());
+    result.setDevicePixelRatio(source.devicePixelRatio());
+    result.setDotsPerMeterX(source.dotsPerMeterX());
+    result.setDotsPerMeterY(source.dotsPerMeterY());
+    return result;
+}
+
+void ImagePool::release(void *block)
+{
+    if (globalPool.isDestroyed()) {
+        std::free(block);
+        return;
+    }
+    globalPool()->recycle(block);
+}
+
+void ImagePool::recycle(void *block)
+{
+    QMutexLocker locker(&mutex);
+    const size_t cls = blockClass(block);
+    if (idleTotal + qint64(cls) > limit) {
+        locker.unlock();
+        std::free(block);
+        return;
+    }
+    idle[cls].append(block);
+    idleTotal += qint64(cls);
+}
+
+void ImagePool::setCapacity(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    limit = bytes;
+    evict();
+}
+
+qint64 ImagePool::capacity() const
+{
+    QMutexLocker locker(&mutex);
+    return limit;
+}
+
+qint64 ImagePool::idleBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return idleTotal;
+}
+
+quint64 ImagePool::reuseCount() const
+{
+    QMutexLocker locker(&mutex);
+    return reused;
+}
+
+quint64 ImagePool::allocationCount() const
+{
+    QMutexLocker locker(&mutex);
+    return allocated;
+}
+
+void ImagePool::trim()
+{
+    QMutexLocker locker(&mutex);
+    const qint64 saved = limit;
+    limit = 0;
+    evict();
+    limit = saved;
+}
+
+void ImagePool::evict()
+{
+    for (auto it = idle.begin(); it != idle.end() && idleTotal > limit; ++it) {
+        while (!it->isEmpty() && idleTotal > limit) {
+            void *block = it->takeLast();
+            idleTotal -= qint64(blockClass(block));
+            std::free(block);
+        }
+    }
+}
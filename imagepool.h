@@ -0,0 +1,85 @@
+#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QVector>
+
+/*!
+ * \brief The ImagePool class переиспользует буферы пикселей изображений.
+ *
+ * Изображение, полученное через acquire, при освобождении последней ссылки на него возвращает
+ * свой буфер в пул, и следующий запрос того же класса размеров получает его без обращения к аллокатору.
+ * Тайлы документа, результаты фильтров и кадры предпросмотра имеют немного повторяющихся размеров,
+ * поэтому в установившемся режиме (рисование, отмена и повтор, предпросмотр эффектов) новые буферы не выделяются.
+ *
+ * Размеры округляются вверх до класса (четыре класса на каждую степень двойки), так что потери
+ * не превышают четверти буфера. Объем простаивающих буферов ограничен capacity.
+ * Форматы с глубиной меньше 8 бит на пиксель выделяются обычным образом.
+ * Методы потокобезопасны.
+ */
+class ImagePool
+{
+public:
+    /*!
+     * \brief instance общий пул приложения
+     */
+    static ImagePool &instance();
+
+    /*!
+     * \brief acquire возвращает изображение с неинициализированными пикселями из пула
+     * \param size размер изображения
+     * \param format формат пикселей
+     */
+    QImage acquire(const QSize &size, QImage::Format format);
+    /*!
+     * \brief copy копирует область source в изображение из пула (аналог QImage::copy)
+     */
+    QImage copy(const QImage &source, const QRect &rect);
+    /*!
+     * \brief copy копирует source в изображение из пула целиком
+     */
+    QImage copy(const QImage &source) { return copy(source, source.rect()); }
+
+    /*!
+     * \brief setCapacity максимальный объем простаивающих буферов в байтах; лишние освобождаются
+     */
+    void setCapacity(qint64 bytes);
+    qint64 capacity() const;
+    /*!
+     * \brief idleBytes объем буферов, ожидающих повторного использования
+     */
+    qint64 idleBytes() const;
+    /*!
+     * \brief reuseCount число запросов, обслуженных без выделения памяти
+     */
+    quint64 reuseCount() const;
+    /*!
+     * \brief allocationCount число запросов, для которых пришлось выделить новый буфер
+     */
+    quint64 allocationCount() const;
+    /*!
+     * \brief trim освобождает все простаивающие буферы
+     */
+    void trim();
+
+    ImagePool() = default;
+    ~ImagePool();
+
+private:
+    Q_DISABLE_COPY(ImagePool)
+
+    static void release(void *block);
+    void recycle(void *block);
+    void evict();
+
+    mutable QMutex mutex;
+    QHash<size_t, QVector<void *>> idle;
+    qint64 idleTotal = 0;
+    qint64 limit = qint64(256) * 1024 * 1024;
+    quint64 reused = 0;
+    quint64 allocated = 0;
+};
+
+#endif // IMAGEPOOL_H
@@ -0,0 +1,177 @@
+#include "imagepyramid.h"
+#include "convert.h"
+#include "imagepool.h"
+
+#include <QMetaObject>
+#include <QtMath>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+
+ImagePyramid::ImagePyramid(QObject *parent)
+    : QObject(parent)
+{
+    // Уровни строятся одним заданием за раз; внутри задания тайлы обрабатываются параллельно
+    pool.setMaxThreadCount(1);
+    // Во время мазка кисти пересборка откладывается, чтобы не отделять тайлы документа на каждое движение мыши
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    timer->setInterval(100);
+    QObject::connect(timer, SIGNAL(timeout()), this, SLOT(start()));
+}
+
+ImagePyramid::~ImagePyramid()
+{
+    pool.waitForDone();
+}
+
+void ImagePyramid::setSource(const TiledImage *source)
+{
+    document = source;
+    ++generation;
+    requestedLevel = 0;
+    levels.clear();
+    stale.clear();
+    if (!document || document->isNull() || Convert::rawMatType(document->format()) < 0)
+        return;
+    levels.append(TiledImage());
+    stale.append(QVector<bool>());
+    QSize size = document->size();
+    for (int level = 1; level <= MaxLevels && qMax(size.width(), size.height()) > 1; ++level) {
+        size = QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+        const TiledImage built(size, document->format(), document->background());
+        levels.append(built);
+        stale.append(QVector<bool>(built.tileColumns() * built.tileRows(), true));
+    }
+}
+
+QRect ImagePyramid::levelRect(const QRect &imageRect, int level) const
+{
+    const int factor = 1 << level;
+    const int left = imageRect.left() / factor;
+    const int top = imageRect.top() / factor;
+    const int right = imageRect.right() / factor;
+    const int bottom = imageRect.bottom() / factor;
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+void ImagePyramid::invalidate(const QRect &imageRect)
+{
+    if (levels.size() < 2 || imageRect.isEmpty())
+        return;
+    // Фильтр мог сменить формат пикселей без смены размера - тогда строить уровни нужно заново
+    if (document->format() != levels.at(1).format() || document->background() != levels.at(1).background()) {
+        const int level = requestedLevel;
+        setSource(document);
+        request(level);
+        return;
+    }
+    const QRect clipped = imageRect & document->rect();
+    for (int level = 1; level < levels.size(); ++level) {
+        const TiledImage &target = levels.at(level);
+        const QRect range = target.tilesIn(levelRect(clipped, level));
+        for (int row = range.top(); row <= range.bottom(); ++row) {
+            for (int column = range.left(); column <= range.right(); ++column)
+                stale[level][row * target.tileColumns() + column] = true;
+        }
+    }
+    if (requestedLevel > 0)
+        timer->start();
+}
+
+void ImagePyramid::request(int level)
+{
+    // Уровень задается тем, что нужно текущей отрисовке: после возврата к крупному масштабу
+    // грубые уровни больше не пересобираются при каждом изменении документа
+    level = qBound(0, level, levelCount());
+    if (level == requestedLevel)
+        return;
+    const bool grows = level > requestedLevel;
+    requestedLevel = level;
+    if (grows && !timer->isActive())
+        QMetaObject::invokeMethod(this, "start", Qt::QueuedConnection);
+}
+
+bool ImagePyramid::isTileReady(int level, int column, int row) const
+{
+    if (level <= 0 || level >= levels.size())
+        return false;
+    return !stale.at(level).at(row * levels.at(level).tileColumns() + column);
+}
+
+int ImagePyramid::levelFor(qreal zoom)
+{
+    if (zoom >= 0.5)
+        return 0;
+    return qMin(MaxLevels, qFloor(std::log2(1 / zoom)));
+}
+
+bool ImagePyramid::hasStaleTiles(int upToLevel) const
+{
+    for (int level = 1; level <= upToLevel && level < stale.size(); ++level) {
+        if (stale.at(level).contains(true))
+            return true;
+    }
+    return false;
+}
+
+QImage ImagePyramid::buildTile(const TiledImage &source, const TiledImage &target, int column, int row)
+{
+    const QRect bounds = target.tileRect(column, row);
+    const QRect area = QRect(bounds.x() * 2, bounds.y() * 2, bounds.width() * 2, bounds.height() * 2) & source.rect();
+    QImage input = source.copy(area);
+    QImage output = ImagePool::instance().acquire(bounds.size(), target.format());
+    const cv::Mat src = Convert::rawMat(input);
+    cv::Mat dst = Convert::rawMat(output);
+    cv::resize(src, dst, dst.size(), 0, 0, cv::INTER_AREA);
+    return output;
+}
+
+void ImagePyramid::start()
+{
+    if (running || requestedLevel == 0 || !hasStaleTiles(requestedLevel))
+        return;
+    running = true;
+    const int top = requestedLevel;
+    const int startedGeneration = generation;
+    const TiledImage source = *document;
+    QVector<TiledImage> snapshot = levels.mid(0, top + 1);
+    QVector<QVector<bool>> work = stale.mid(0, top + 1);
+    for (int level = 1; level <= top; ++level)
+        stale[level].fill(false);
+
+    pool.start([this, source, snapshot, work, top, startedGeneration]() mutable {
+        for (int level = 1; level <= top; ++level) {
+            const TiledImage &previous = level == 1 ? source : snapshot.at(level - 1);
+            TiledImage &target = snapshot[level];
+            QVector<int> indices;
+            for (int i = 0; i < work.at(level).size(); ++i) {
+                if (work.at(level).at(i))
+                    indices.append(i);
+            }
+            QVector<QImage> results(indices.size());
+            QImage *output = results.data();
+            const int columns = target.tileColumns();
+            cv::parallel_for_(cv::Range(0, indices.size()), [&](const cv::Range &range) {
+                for (int i = range.start; i < range.end; ++i)
+                    output[i] = buildTile(previous, target, indices.at(i) % columns, indices.at(i) / columns);
+            });
+            for (int i = 0; i < indices.size(); ++i)
+                target.setTile(indices.at(i) % columns, indices.at(i) / columns, results.at(i));
+        }
+        QMetaObject::invokeMethod(this, [this, snapshot, top, startedGeneration]() {
+            running = false;
+            if (startedGeneration != generation) {
+                // Документ сменился целиком, пока строились уровни: начинаем заново, если уровни все еще нужны
+                start();
+                return;
+            }
+            // Тайлы, устаревшие за время построения, остаются помеченными и будут пересобраны следующим заданием
+            for (int level = 1; level <= top; ++level)
+                levels[level] = snapshot.at(level);
+            emit levelsUpdated();
+            if (hasStaleTiles(requestedLevel) && !timer->isActive())
+                start();
+        }, Qt::QueuedConnection);
+    });
+}
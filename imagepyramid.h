@@ -0,0 +1,98 @@
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <QObject>
+#include <QRect>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+#include "tiledimage.h"
+
+/*!
+ * \brief The ImagePyramid class уменьшенные копии документа (1/2, 1/4, 1/8 ...) для отображения в мелком масштабе.
+ *
+ * Уровень k - TiledImage размером в 2^k раз меньше документа; каждый его тайл усредняется по площади
+ * из четырех тайлов уровня k-1. Уровни строятся лениво: только когда область просмотра запросила уровень,
+ * и в рабочем потоке (тайлы уровня - параллельно). После изменения документа помечаются устаревшими
+ * только тайлы, покрывающие измененный прямоугольник, на всех уровнях, и пересобираются только они.
+ * Пока тайл устарел или еще не построен, isTileReady возвращает false и рисовать нужно из более детального уровня.
+ */
+class ImagePyramid : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * \brief MaxLevels число уровней над документом (до 1/64)
+     */
+    static const int MaxLevels = 6;
+
+    explicit ImagePyramid(QObject *parent = nullptr);
+    /*!
+     * \brief ~ImagePyramid дожидается завершения построения
+     */
+    ~ImagePyramid();
+
+    /*!
+     * \brief setSource задает документ и сбрасывает все уровни (новый размер, формат или содержимое целиком).
+     * Пирамида не владеет документом и читает его только при запуске построения.
+     */
+    void setSource(const TiledImage *document);
+    /*!
+     * \brief invalidate помечает устаревшими тайлы всех уровней, покрывающие прямоугольник документа
+     */
+    void invalidate(const QRect &imageRect);
+    /*!
+     * \brief request просит построить уровни до level включительно и поддерживать их в актуальном состоянии;
+     * более грубые уровни перестают пересобираться (0 - уровни не нужны)
+     */
+    void request(int level);
+
+    /*!
+     * \brief levelCount число уровней, доступных для текущего документа (0, если формат не поддерживается)
+     */
+    int levelCount() const { return levels.size() - 1; }
+    /*!
+     * \brief level уровень пирамиды; пользоваться можно только тайлами, для которых isTileReady
+     */
+    const TiledImage &level(int index) const { return levels.at(index); }
+    bool isTileReady(int level, int column, int row) const;
+    /*!
+     * \brief levelFor самый грубый уровень, который при масштабе zoom еще не меньше экрана
+     */
+    static int levelFor(qreal zoom);
+
+signals:
+    /*!
+     * \brief levelsUpdated построены новые тайлы
+     */
+    void levelsUpdated();
+
+private slots:
+    void start();
+
+private:
+    QRect levelRect(const QRect &imageRect, int level) const;
+    bool hasStaleTiles(int upToLevel) const;
+    /*!
+     * \brief buildTile усредняет область уровня source, соответствующую тайлу target
+     */
+    static QImage buildTile(const TiledImage &source, const TiledImage &target, int column, int row);
+
+    const TiledImage *document = nullptr;
+    /*!
+     * \brief levels levels[0] не используется (это сам документ), levels[k] - уровень k
+     */
+    QVector<TiledImage> levels;
+    /*!
+     * \brief stale для каждого уровня и тайла: true, если тайл еще не построен или устарел
+     */
+    QVector<QVector<bool>> stale;
+    int requestedLevel = 0;
+    int generation = 0;
+    bool running = false;
+    QTimer *timer = nullptr;
+    QThreadPool pool;
+};
+
+#endif // IMAGEPYRAMID_H
@@ -0,0 +1,96 @@
+#include "imagesaver.h"
+
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QMetaObject>
+#include <memory>
+
+ImageSaver::ImageSaver(QObject *parent)
+    : QObject(parent)
+{
+}
+
+ImageSaver::~ImageSaver()
+{
+    pool.waitForDone();
+}
+
+bool ImageSaver::write(const QImage &image, const Target &target, const Settings &settings, QString *error)
+{
+    QImageWriter writer(target.fileName, target.format);
+    const QByteArray format = !target.format.isEmpty()
+            ? target.format.toLower()
+            : QFileInfo(target.fileName).suffix().toLower().toLatin1();
+    if (format == "png") {
+        // Обработчик PNG в Qt берет уровень zlib из качества: compression = (100 - quality) * 9 / 91
+        const int level = qBound(0, settings.pngCompression, 9);
+        writer.setQuality(100 - (level * 91 + 8) / 9);
+        writer.setCompression(level);
+    } else {
+        writer.setQuality(qBound(0, settings.jpegQuality, 100));
+    }
+    writer.setOptimizedWrite(settings.optimize);
+    writer.setProgressiveScanWrite(settings.progressive);
+
+    QImage output = image;
+    if (target.longestSide > 0 && qMax(image.width(), image.height()) > target.longestSide)
+        output = image.scaled(target.longestSide, target.longestSide, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (!writer.write(output)) {
+        *error = writer.errorString();
+        return false;
+    }
+    return true;
+}
+
+void ImageSaver::save(const TiledImage &document, const QVector<Target> &targets, const QColorSpace &colorSpace)
+{
+    save([document]() { return document; }, targets, colorSpace);
+}
+
+void ImageSaver::save(const Render &render, const QVector<Target> &targets, const QColorSpace &colorSpace)
+{
+    if (targets.isEmpty())
+        return;
+    if (pending == 0) {
+        steps = 0;
+        stepsDone = 0;
+        allOk = true;
+    }
+    // Сборка изображения и каждая цель - отдельные шаги прогресса
+    pending += targets.size() + 1;
+    steps += targets.size() + 1;
+    emit progress(stepsDone * 100 / steps);
+
+    const Settings settings = encoderSettings;
+    pool.start([this, render, targets, settings, colorSpace]() {
+        QImage assembled = render().toImage();
+        if (colorSpace.isValid())
+            assembled.setColorSpace(colorSpace);
+        const std::shared_ptr<const QImage> image = std::make_shared<const QImage>(assembled);
+        QMetaObject::invokeMethod(this, [this]() { stepDone(); }, Qt::QueuedConnection);
+        for (const Target &target : targets) {
+            pool.start([this, image, target, settings]() {
+                QString error;
+                const bool ok = write(*image, target, settings, &error);
+                QMetaObject::invokeMethod(this, [this, target, ok, error]() {
+                    if (ok) {
+                        emit saved(target.fileName);
+                    } else {
+                        allOk = false;
+                        emit failed(target.fileName, error);
+                    }
+                    stepDone();
+                }, Qt::QueuedConnection);
+            });
+        }
+    });
+}
+
+void ImageSaver::stepDone()
+{
+    --pending;
+    ++stepsDone;
+    emit progress(stepsDone * 100 / steps);
+    if (pending == 0)
+        emit finished(allOk);
+}
@@ -0,0 +1,109 @@
+#ifndef IMAGESAVER_H
+#define IMAGESAVER_H
+
+#include <QColorSpace>
+#include <QImage>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+#include <functional>
+#include "tiledimage.h"
+
+/*!
+ * \brief The ImageSaver class сохраняет документ в файлы в рабочих потоках.
+ *
+ * Документ собирается в непрерывное изображение один раз, после чего все цели (разные форматы
+ * и размеры) кодируются параллельно. Документ передается как TiledImage, поэтому редактирование
+ * можно продолжать во время сохранения: сохраняется состояние на момент вызова save.
+ */
+class ImageSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * \brief The Settings struct параметры кодировщиков
+     */
+    struct Settings
+    {
+        int jpegQuality = 90;       //!< качество JPEG (и других форматов с потерями), 0..100
+        int pngCompression = 6;     //!< уровень сжатия zlib для PNG, 0..9
+        bool optimize = true;       //!< оптимизированная запись (оптимальные таблицы Хаффмана для JPEG)
+        bool progressive = false;   //!< прогрессивный JPEG
+    };
+
+    /*!
+     * \brief The Target struct один файл, в который сохраняется документ
+     */
+    struct Target
+    {
+        QString fileName;
+        QByteArray format;       //!< формат; пустой - по расширению файла
+        int longestSide = 0;     //!< уменьшить так, чтобы длинная сторона была не больше; 0 - исходный размер
+    };
+
+    /*!
+     * \brief Render собирает сохраняемый документ; вызывается в рабочем потоке
+     */
+    typedef std::function<TiledImage()> Render;
+
+    explicit ImageSaver(QObject *parent = nullptr);
+    /*!
+     * \brief ~ImageSaver дожидается завершения начатых сохранений
+     */
+    ~ImageSaver();
+
+    void setSettings(const Settings &settings) { encoderSettings = settings; }
+    Settings settings() const { return encoderSettings; }
+
+    /*!
+     * \brief save начинает сохранение документа во все цели
+     * \param colorSpace цветовое пространство пикселей документа; записывается в файлы как профиль ICC
+     */
+    void save(const TiledImage &document, const QVector<Target> &targets, const QColorSpace &colorSpace = QColorSpace());
+    /*!
+     * \brief save начинает сохранение документа, который собирает render в рабочем потоке
+     * (например, досчитывает операции неразрушающего редактирования над копией их списка)
+     */
+    void save(const Render &render, const QVector<Target> &targets, const QColorSpace &colorSpace = QColorSpace());
+    /*!
+     * \brief isBusy true, пока есть незавершенные сохранения
+     */
+    bool isBusy() const { return pending > 0; }
+    /*!
+     * \brief write синхронно кодирует изображение с заданными параметрами (используется и пакетным режимом)
+     * \return false при ошибке, описание - в error
+     */
+    static bool write(const QImage &image, const Target &target, const Settings &settings, QString *error);
+
+signals:
+    /*!
+     * \brief progress общий прогресс всех начатых сохранений в процентах
+     */
+    void progress(int percent);
+    /*!
+     * \brief saved файл успешно записан
+     */
+    void saved(const QString &fileName);
+    /*!
+     * \brief failed файл записать не удалось
+     */
+    void failed(const QString &fileName, const QString &error);
+    /*!
+     * \brief finished все начатые сохранения завершены
+     * \param ok true, если ни одно из них не завершилось ошибкой
+     */
+    void finished(bool ok);
+
+private:
+    void stepDone();
+
+    QThreadPool pool;
+    Settings encoderSettings;
+    int pending = 0;
+    int steps = 0;
+    int stepsDone = 0;
+    bool allOk = true;
+};
+
+#endif // IMAGESAVER_H
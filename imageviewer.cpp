@@ -2,37 +2,71 @@
 #include <QApplication>
 #include <QClipboard>
 #include <QColorSpace>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QImageReader>
 #include <QImageWriter>
 #include <QErrorMessage>
+#include <QFormLayout>
+#include <QVBoxLayout>
 #include <iostream>
+#include "colormanager.h"
 #include "commands.h"
+#include "lutfile.h"
+#include "filters.h"
+#include "savesettingsdialog.h"
+#include "profiler.h"
+#include <QtMath>
+#include <QDebug>
+#include <QMap>
 ImageViewer::ImageViewer(QWidget *parent)
-   : QMainWindow(parent), imageLabel(new ImageLabelWithRubberBand)
-   , scrollArea(new QScrollArea)
+   : QMainWindow(parent), canvas(new ImageCanvas)
 {
     setWindowIcon(QPixmap(":/icons/paint-brush.png"));
     undoStack = new QUndoStack(this);
-    imageLabel->setBackgroundRole(QPalette::Base);
-    imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    imageLabel->setScaledContents(true);
-
-    QObject::connect(imageLabel, SIGNAL(areaSelected()), this, SLOT(showSelectedArea()));
-    QObject::connect(imageLabel, SIGNAL(drawing(int)), this, SLOT(paintPoint(int)));
-    QObject::connect(imageLabel, SIGNAL(generateText(QString)), this, SLOT(paintText(QString)));
-    scrollArea->setBackgroundRole(QPalette::Dark);
-    scrollArea->setWidget(imageLabel);
-    scrollArea->setVisible(false);
-    setCentralWidget(scrollArea);
-
+    QObject::connect(undoStack, SIGNAL(indexChanged(int)), this, SLOT(enforceUndoBudget()));
+    filterEngine = new FilterEngine(this);
+    renderEngine = new FilterEngine(this);
+    imageLoader = new ImageLoader(this);
+    QObject::connect(imageLoader, SIGNAL(loaded(QString, TiledImage, int, QColorSpace)), this, SLOT(documentLoaded(QString, TiledImage, int, QColorSpace)));
+    QObject::connect(imageLoader, SIGNAL(failed(QString, QString)), this, SLOT(documentLoadFailed(QString, QString)));
+    QObject::connect(imageLoader, SIGNAL(regionLoaded(QRect, QImage)), this, SLOT(regionLoaded(QRect, QImage)));
+    imageSaver = new ImageSaver(this);
+    saveProgress = new QProgressBar;
+    saveProgress->setRange(0, 100);
+    saveProgress->setMaximumWidth(160);
+    saveProgress->setVisible(false);
+    statusBar()->addPermanentWidget(saveProgress);
+    timingOverlay = new TimingOverlay;
+    timingOverlay->setVisible(false);
+    statusBar()->addPermanentWidget(timingOverlay);
+    QObject::connect(imageSaver, SIGNAL(progress(int)), saveProgress, SLOT(setValue(int)));
+    QObject::connect(imageSaver, SIGNAL(saved(QString)), this, SLOT(fileSaved(QString)));
+    QObject::connect(imageSaver, SIGNAL(failed(QString, QString)), this, SLOT(fileSaveFailed(QString, QString)));
+    QObject::connect(imageSaver, SIGNAL(finished(bool)), this, SLOT(savingFinished(bool)));
+    regionTimer = new QTimer(this);
+    regionTimer->setSingleShot(true);
+    regionTimer->setInterval(150);
+    QObject::connect(regionTimer, SIGNAL(timeout()), this, SLOT(requestVisibleRegion()));
+    QObject::connect(canvas, SIGNAL(areaSelected()), this, SLOT(showSelectedArea()));
+    QObject::connect(canvas, SIGNAL(drawing(int)), this, SLOT(paintPoint(int)));
+    QObject::connect(canvas, SIGNAL(generateText(QString)), this, SLOT(paintText(QString)));
+    canvas->setVisible(false);
+    setCentralWidget(canvas);
+    QObject::connect(canvas, SIGNAL(viewChanged()), regionTimer, SLOT(start()));
+    QObject::connect(canvas, SIGNAL(viewChanged()), this, SLOT(evaluateVisibleAdjustments()));
+    QObject::connect(canvas, SIGNAL(zoomChanged(qreal)), this, SLOT(updateActions()));
+
+    createEffectWindow();
+    createHistogramDock();
+    createAdjustmentsDock();
+    createLayersDock();
     createActions();
 
     resize(QGuiApplication::primaryScreen()->availableSize() * 3 / 5);
     addToolBar(Qt::LeftToolBarArea, createToolBar());
-    QPixmap defaultPixmap(QGuiApplication::primaryScreen()->availableSize() * 2 / 5);
-    defaultPixmap.fill(Qt::white);
-    setImage(defaultPixmap.toImage());
+    setImage(TiledImage(QGuiApplication::primaryScreen()->availableSize() * 2 / 5, QImage::Format_RGB32));
 }
 
 QToolBar *ImageViewer::createToolBar()
@@ -55,65 +89,372 @@ QToolBar *ImageViewer::createToolBar()
 
 bool ImageViewer::loadFile(const QString &fileName)
 {
-    QImageReader reader(fileName);
-    reader.setAutoTransform(true);
-    const QImage newImage = reader.read();
-    if (newImage.isNull()) {
+    TRACE_SCOPE("loadFile");
+    QImage preview;
+    QSize fullSize;
+    QString error;
+    if (!imageLoader->open(fileName, QGuiApplication::primaryScreen()->availableSize(), &preview, &fullSize, &error)) {
         QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
                                  tr("Cannot load %1: %2")
-                                 .arg(QDir::toNativeSeparators(fileName), reader.errorString()));
+                                 .arg(QDir::toNativeSeparators(fileName), error));
         return false;
     }
-    setImage(newImage);
+    filterEngine->cancel();
+    undoStack->clear();
+    adjustments.setAdjustments(QVector<Adjustment>());
+    updateAdjustmentsList();
+    layers.setLayers(QVector<Layer>());
+    activeLayer = -1;
+    updateLayersList();
+    // Пока файл загружается, документ полного размера состоит из невыделенных тайлов,
+    // вместо которых рисуется предпросмотр; запрошенные области записываются в него по мере декодирования
+    setImage(TiledImage(fullSize, QImage::Format_RGB32));
+    setColorSpace(preview.colorSpace());
+    canvas->setPreview(preview);
     setWindowFilePath(fileName);
+    statusBar()->showMessage(tr("Loading \"%1\", %2x%3...")
+        .arg(QDir::toNativeSeparators(fileName)).arg(fullSize.width()).arg(fullSize.height()));
+    updateActions();
+    return true;
+}
+
+void ImageViewer::documentLoaded(const QString &fileName, const TiledImage &loaded, int depth, const QColorSpace &space)
+{
+    setColorSpace(space);
+    canvas->setPreview(QImage());
+    updateDocument(loaded, loaded.rect());
+    updateActions();
     const QString message = tr("Opened \"%1\", %2x%3, Depth: %4")
-        .arg(QDir::toNativeSeparators(fileName)).arg(image.width()).arg(image.height()).arg(image.depth());
+        .arg(QDir::toNativeSeparators(fileName)).arg(document.width()).arg(document.height()).arg(depth);
     statusBar()->showMessage(message);
-    return true;
+}
+
+void ImageViewer::documentLoadFailed(const QString &fileName, const QString &error)
+{
+    canvas->setPreview(QImage());
+    updateActions();
+    statusBar()->clearMessage();
+    QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                             tr("Cannot load %1: %2").arg(QDir::toNativeSeparators(fileName), error));
+}
+
+void ImageViewer::requestVisibleRegion()
+{
+    if (!imageLoader->isLoading() || document.isNull())
+        return;
+    // Область полного разрешения нужна, только если экран показывает больше пикселей, чем есть в предпросмотре
+    if (canvas->zoom() * cropRect.width() <= QGuiApplication::primaryScreen()->availableSize().width())
+        return;
+    const QRect imageRect = canvas->visibleImageRect().translated(cropRect.topLeft());
+    // Выравнивание по тайлам: записанные тайлы заполняются целиком и не закрывают предпросмотр фоном
+    const QRect tiles = document.tilesIn(imageRect);
+    if (tiles.isEmpty())
+        return;
+    bool complete = true;
+    for (int row = tiles.top(); row <= tiles.bottom() && complete; ++row) {
+        for (int column = tiles.left(); column <= tiles.right() && complete; ++column)
+            complete = document.isTileAllocated(column, row);
+    }
+    if (complete)
+        return;
+    const QRect region = document.tileRect(tiles.left(), tiles.top()) | document.tileRect(tiles.right(), tiles.bottom());
+    imageLoader->requestRegion(region);
+}
+
+void ImageViewer::regionLoaded(const QRect &rect, const QImage &image)
+{
+    if (!imageLoader->isLoading() || !document.rect().contains(rect))
+        return;
+    document.write(rect.topLeft(), image);
+    updateRendered(rect);
 }
 
 void ImageViewer::setImage(const QImage &newImage)
 {
-    image = newImage;
-    imageAfterEffect = image;
-    pixmapForPainting = new QPixmap(QPixmap::fromImage(image));
-    painter = new QPainter(pixmapForPainting);
-    w = new effectwindow(image, imageAfterEffect);
-    image = pixmapForPainting->toImage();
-    imageAfterEffect = pixmapForPainting->toImage();
-    w->setModal(true);
-    QObject::connect(w, SIGNAL(finished (int)), this, SLOT(dialogIsFinished(int)));
-    QObject::connect(this, SIGNAL(imageChanged()), w, SLOT(repaintEffectWindow()));
-    if (image.colorSpace().isValid())
-        image.convertToColorSpace(QColorSpace::SRgb);
-    imageLabel->setPixmap(QPixmap::fromImage(image));
-    scaleFactor = 1.0;
-    countOfScales = 0;
-    scrollArea->setVisible(true);
+    imageLoader->cancel();
+    canvas->setPreview(QImage());
+    // Операции, слои и их отмена относились к прежнему изображению
+    undoStack->clear();
+    adjustments.setAdjustments(QVector<Adjustment>());
+    updateAdjustmentsList();
+    layers.setLayers(QVector<Layer>());
+    activeLayer = -1;
+    updateLayersList();
+    setColorSpace(newImage.colorSpace());
+    setImage(TiledImage::fromImage(newImage));
+}
+
+void ImageViewer::setColorSpace(const QColorSpace &space)
+{
+    colorSpace = space;
+    const std::shared_ptr<const ColorLut> transform = ColorManager::instance().displayTransform(space);
+    canvas->setColorTransform(transform);
+    if (w)
+        w->setColorTransform(transform);
+}
+
+void ImageViewer::setImage(const TiledImage &newDocument, const QRect &crop)
+{
+    TRACE_SCOPE("setImage");
+    document = newDocument;
+    cropRect = crop.isEmpty() ? document.rect() : crop & document.rect();
+    ++documentRevision;
+    adjustments.reset();
+    layers.reset();
+    rendered = TiledImage();
+    showsRendered = false;
+    canvas->setDocument(&document, cropRect);
+    if (!fitToWindowAct->isChecked())
+        canvas->setZoom(1);
+    updateRendered(QRect());
+    updateHistogram();
+    canvas->setVisible(true);
     fitToWindowAct->setEnabled(true);
     cropAct->setEnabled(true);
     addTextAct->setEnabled(true);
     paintAct->setEnabled(true);
     updateActions();
-    if (!fitToWindowAct->isChecked())
-        imageLabel->adjustSize();
 }
 
-bool ImageViewer::saveFile(const QString& fileName)
+void ImageViewer::updateDocument(const TiledImage &newDocument, const QRect &changed, const QRect &crop)
 {
-  QImageWriter writer(fileName);
+    if (document.isNull() || newDocument.size() != document.size()) {
+        setImage(newDocument, crop);
+        return;
+    }
+    document = newDocument;
+    ++documentRevision;
+    const QRect view = crop.isEmpty() ? document.rect() : crop & document.rect();
+    if (view != cropRect) {
+        cropRect = view;
+        canvas->setView(cropRect);
+    }
+    updateRendered(changed);
+    updateHistogram();
+}
 
-  if (!writer.write(image)) {
-    QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
-      tr("Cannot write %1: %2")
-      .arg(QDir::toNativeSeparators(fileName)), writer.errorString());
+void ImageViewer::setCrop(const QRect &crop)
+{
+    const QRect view = crop & document.rect();
+    if (view.isEmpty() || view == cropRect)
+        return;
+    cropRect = view;
+    // Видимое содержимое сменилось: кэш эффектов и уменьшенная копия для предпросмотра устарели
+    ++documentRevision;
+    canvas->setView(cropRect);
+    updateRendered(QRect());
+    updateHistogram();
+}
+
+ImageSaver::Render ImageViewer::flattenDocument() const
+{
+    // Копии списков, а не snapshot(): журнал snapshot() один и уже занят досчетом видимых тайлов в renderEngine
+    const AdjustmentStack stack = adjustments;
+    const LayerStack overlay = layers;
+    const TiledImage source = document;
+    const QRect crop = cropRect;
+    return [stack, overlay, source, crop]() mutable {
+        const QRect recomputed = stack.evaluate(source, crop);
+        TiledImage result = stack.output(source);
+        if (overlay.isShown()) {
+            // Наложение могло быть посчитано поверх еще не досчитанных операций
+            overlay.invalidate(recomputed);
+            overlay.composite(result, crop);
+            result = overlay.output();
+        }
+        return crop == result.rect() ? result : result.copyRegion(crop);
+    };
+}
+
+void ImageViewer::setAdjustments(const QVector<Adjustment> &list)
+{
+    adjustments.setAdjustments(list);
+    // Результат операций сменился: кэш эффектов и уменьшенная копия для предпросмотра устарели
+    ++documentRevision;
+    updateAdjustmentsList();
+    // Слои накладываются на результат операций, поэтому наложение тоже пересчитывается
+    layers.invalidate(document.rect());
+    updateRendered(QRect());
+    canvas->updateImageRect(QRect(QPoint(0, 0), cropRect.size()));
+    updateHistogram();
+}
+
+void ImageViewer::setLayers(const QVector<Layer> &list)
+{
+    const QRect changed = layers.setLayers(list);
+    activeLayer = qMin(activeLayer, list.size() - 1);
+    updateLayersList();
+    updateComposite(changed);
+    updateHistogram();
+}
+
+QRect ImageViewer::evaluateRendered(const QRect &rect)
+{
+    if (!showsRendered)
+        return QRect();
+    if (adjustments.isEmpty()) {
+        rendered = document;
+    } else {
+        // Операции досчитываются в рабочем потоке; пока они не готовы, показываются уже посчитанные тайлы
+        requestAdjustments(rect);
+        rendered = adjustments.output(document);
+    }
+    QRect recomputed;
+    if (layers.isShown()) {
+        recomputed = layers.composite(rendered, rect);
+        rendered = layers.output();
+    }
+    // Холст и уровни пирамиды должны увидеть и тайлы, пересчитанные вне видимой части
+    canvas->updateImageRect(recomputed.translated(-cropRect.topLeft()));
+    return recomputed;
+}
+
+void ImageViewer::requestAdjustments(const QRect &rect)
+{
+    if (!rect.isEmpty() && !adjustments.isEvaluated(document, rect))
+        pendingAdjustmentsRect |= rect;
+    if (renderEngine->isBusy() || pendingAdjustmentsRect.isEmpty())
+        return;
+    const QRect area = pendingAdjustmentsRect;
+    pendingAdjustmentsRect = QRect();
+    const std::shared_ptr<AdjustmentStack> stack = std::make_shared<AdjustmentStack>(adjustments.snapshot());
+    const TiledImage source = document;
+    renderEngine->run([stack, source, area](FilterJob &) {
+        stack->evaluate(source, area);
+        return stack->output(source);
+    }, [this, stack, area](const TiledImage &) { adjustmentsEvaluated(*stack, area); });
+}
+
+void ImageViewer::adjustmentsEvaluated(const AdjustmentStack &evaluated, const QRect &rect)
+{
+    QRect adopted;
+    if (!adjustments.merge(evaluated, &adopted)) {
+        // Список операций сменился во время досчета: область считается заново по новому списку
+        requestAdjustments(rect);
+        return;
+    }
+    if (showsRendered) {
+        layers.invalidate(adopted);
+        canvas->updateImageRect(adopted.translated(-cropRect.topLeft()));
+        // Тайлы, устаревшие за время досчета, и накопившиеся запросы уходят в следующую задачу
+        evaluateRendered(rect);
+    }
+    requestAdjustments(QRect());
+    updateHistogram();
+}
+
+void ImageViewer::updateRendered(const QRect &changed)
+{
+    adjustments.invalidate(changed);
+    updateComposite(changed);
+}
+
+void ImageViewer::updateComposite(const QRect &changed)
+{
+    layers.invalidate(changed);
+    const bool wasRendered = showsRendered;
+    showsRendered = !adjustments.isEmpty() || layers.isShown();
+    if (!showsRendered)
+        rendered = TiledImage();
+    else
+        evaluateRendered(canvas->visibleImageRect().translated(cropRect.topLeft()));
+    if (showsRendered != wasRendered) {
+        canvas->setDocument(showsRendered ? &rendered : &document, cropRect);
+        return;
+    }
+    canvas->updateImageRect(changed.translated(-cropRect.topLeft()));
+}
+
+void ImageViewer::evaluateVisibleAdjustments()
+{
+    evaluateRendered(canvas->visibleImageRect().translated(cropRect.topLeft()));
+}
+
+bool ImageViewer::saveFile(const QString& fileName)
+{
+  if (document.isNull())
     return false;
+  const QFileInfo info(fileName);
+  const QString base = info.dir().filePath(info.completeBaseName());
+  const QString suffix = info.suffix().toLower();
+
+  QVector<ImageSaver::Target> targets;
+  ImageSaver::Target main;
+  main.fileName = fileName;
+  targets.append(main);
+  for (const QString &format : extraSaveFormats) {
+    if (format == suffix)
+      continue;
+    ImageSaver::Target target;
+    target.fileName = base + QLatin1Char('.') + format;
+    targets.append(target);
+  }
+  for (int size : extraSaveSizes) {
+    ImageSaver::Target target;
+    target.fileName = QStringLiteral("%1_%2.%3").arg(base).arg(size).arg(info.suffix());
+    target.longestSide = size;
+    targets.append(target);
   }
-  const QString message = tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(fileName));
-  statusBar()->showMessage(message);
+
+  imageSaver->save(flattenDocument(), targets, colorSpace);
+  saveProgress->setVisible(true);
+  statusBar()->showMessage(tr("Saving \"%1\"...").arg(QDir::toNativeSeparators(fileName)));
   return true;
 }
 
+void ImageViewer::fileSaved(const QString &fileName)
+{
+  statusBar()->showMessage(tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(fileName)));
+}
+
+void ImageViewer::fileSaveFailed(const QString &fileName, const QString &error)
+{
+  QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+    tr("Cannot write %1: %2").arg(QDir::toNativeSeparators(fileName), error));
+}
+
+void ImageViewer::savingFinished(bool ok)
+{
+  saveProgress->setVisible(false);
+  saveProgress->reset();
+  if (closeAfterSave && ok) {
+    close();
+    return;
+  }
+  closeAfterSave = false;
+}
+
+void ImageViewer::exportTrace()
+{
+  QFileDialog dialog(this, tr("Export Performance Trace"));
+  dialog.setAcceptMode(QFileDialog::AcceptSave);
+  dialog.setNameFilter(tr("Chrome trace (*.json)"));
+  dialog.setDefaultSuffix(QStringLiteral("json"));
+  if (dialog.exec() != QDialog::Accepted)
+    return;
+  const QString fileName = dialog.selectedFiles().constFirst();
+  QString error;
+  if (!Profiler::instance().writeChromeTrace(fileName, &error)) {
+    QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+      tr("Cannot write %1: %2").arg(QDir::toNativeSeparators(fileName), error));
+    return;
+  }
+  statusBar()->showMessage(tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(fileName)));
+}
+
+void ImageViewer::changeSaveSettings()
+{
+  SaveSettingsDialog dialog(this);
+  dialog.setSettings(imageSaver->settings());
+  dialog.setExtraFormats(extraSaveFormats);
+  dialog.setExtraSizes(extraSaveSizes);
+  if (dialog.exec() != QDialog::Accepted)
+    return;
+  imageSaver->setSettings(dialog.settings());
+  extraSaveFormats = dialog.extraFormats();
+  extraSaveSizes = dialog.extraSizes();
+}
+
 static void initializeImageFileDialog(QFileDialog& dialog, QFileDialog::AcceptMode acceptMode)
 {
   static bool firstDialog = true;
@@ -147,14 +488,14 @@ void ImageViewer::open()
 }
 
 
-void ImageViewer::saveAs()
+bool ImageViewer::saveAs()
 {
    const QStringList picturesLocations = QStandardPaths::standardLocations(QStandardPaths::PicturesLocation);
 
   QString filePath = QFileDialog::getSaveFileName(this, tr("Save File As"),
                                                   picturesLocations.isEmpty() ? QDir::currentPath() : picturesLocations.last(),
                                                   tr("Images (*.png *.xpm *.jpg)"));
-  if(!filePath.isEmpty())  saveFile(filePath);
+  return !filePath.isEmpty() && saveFile(filePath);
 }
 
 
@@ -162,7 +503,22 @@ void ImageViewer::saveAs()
 void ImageViewer::copy()
 {
 #ifndef QT_NO_CLIPBOARD
-    QGuiApplication::clipboard()->setImage(image);
+    // Получатели буфера обмена обычно считают пиксели sRGB: переводится только копия.
+    // Операции, слои и перевод считаются в рабочем потоке
+    const ImageSaver::Render flatten = flattenDocument();
+    const QColorSpace space = colorSpace;
+    statusBar()->showMessage(tr("Copying..."));
+    filterEngine->run([flatten, space](FilterJob &) {
+        QImage image = flatten().toImage();
+        if (!space.isValid() || space == QColorSpace(QColorSpace::SRgb))
+            return TiledImage::fromImage(image);
+        image.setColorSpace(space);
+        image.convertToColorSpace(QColorSpace::SRgb);
+        return TiledImage::fromImage(image);
+    }, [this](const TiledImage &result) {
+        statusBar()->clearMessage();
+        QGuiApplication::clipboard()->setImage(result.toImage());
+    });
 #endif
 }
 
@@ -199,9 +555,7 @@ void ImageViewer::paste()
 void ImageViewer::normalSize()
 
 {
-    imageLabel->adjustSize();
-    scaleFactor = 1.0;
-    countOfScales = 0;
+    canvas->setZoom(1);
     updateActions();
 }
 
@@ -209,28 +563,24 @@ void ImageViewer::fitToWindow()
 
 {
     bool fitToWindow = fitToWindowAct->isChecked();
-    scrollArea->setWidgetResizable(fitToWindow);
+    canvas->setFitToWindow(fitToWindow);
 
     if (!fitToWindow){
          normalSize();
          updateActions();
          return;
     }
-    if(dockWidget != nullptr) dockWidget->close();
-    imageLabel->state = -1;
     updateActions();
 }
 
 void ImageViewer::zoomIn()
 {
-    countOfScales++;
     scaleImage(1.25);
 
 }
 
 void ImageViewer::zoomOut()
 {
-    countOfScales--;
     scaleImage(0.8);
 
 }
@@ -240,30 +590,33 @@ void ImageViewer::zoomOut()
 void ImageViewer::crop()
 {
     if(cropAct->isChecked()){
-        imageLabel->state = 0;
+        canvas->state = 0;
     }
     else{
-        imageLabel->state = -1;
+        canvas->state = -1;
     }
     updateActions();
 }
 
 
 void ImageViewer::paintPoint(int val){
-    painter->setRenderHint(QPainter::Antialiasing);
-    painter->setPen(pen);
-    painter->drawLine(imageLabel->begin, imageLabel->end);
-
-    imageAfterEffect = pixmapForPainting->toImage();
-    if(val == 2){
-        QUndoCommand *addCommand = new AddCommand(imageAfterEffect, image, this);
-        undoStack->push(addCommand);
-    }
-    else {
-
-        imageLabel->setPixmap(QPixmap::fromImage(imageAfterEffect));
-    }
-
+    if(val == 0)
+        beginAnnotation(tr("Brush"));
+    // Координаты холста отсчитываются от левого верхнего угла видимой области документа
+    const QPoint begin = canvas->begin + cropRect.topLeft();
+    const QPoint end = canvas->end + cropRect.topLeft();
+    const int margin = pen.width() / 2 + 2;
+    const QRect dirty = QRect(begin, end).normalized().adjusted(-margin, -margin, margin, margin) & cropRect;
+    layers.paint(activeLayer, dirty, [&](QPainter &painter) {
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(pen);
+        painter.drawLine(begin, end);
+    });
+    updateComposite(dirty);
+    updateHistogram(dirty);
+
+    if(val == 2)
+        finishAnnotation();
 }
 
 void ImageViewer::paintText(QString text)
@@ -272,18 +625,22 @@ void ImageViewer::paintText(QString text)
 
 
     if(!text.isEmpty()){
+        beginAnnotation(tr("Text"));
         QFont timesFont("Times",  penWidth + 10);
-        path.addText(imageLabel->begin, timesFont, text);
-        painter->setBrush(color);
-        painter->drawPath(path);
-        imageAfterEffect = pixmapForPainting->toImage();
-        QUndoCommand *addCommand = new AddCommand(imageAfterEffect, image, this);
-        undoStack->push(addCommand);
+        path.addText(canvas->begin + cropRect.topLeft(), timesFont, text);
+        const QRect dirty = path.boundingRect().toAlignedRect().adjusted(-2, -2, 2, 2) & cropRect;
+        layers.paint(activeLayer, dirty, [&](QPainter &painter) {
+            painter.setRenderHint(QPainter::Antialiasing);
+            painter.setBrush(color);
+            painter.drawPath(path);
+        });
+        updateComposite(dirty);
+        finishAnnotation();
     }
 }
 void ImageViewer::showSelectedArea()
 {
-    QPoint a(imageLabel->begin), b(imageLabel->end);
+    QPoint a(canvas->begin), b(canvas->end);
     if (b.x() < a.x() && b.y() < a.y()){
         QPoint t = a;
         a = b;
@@ -299,22 +656,32 @@ void ImageViewer::showSelectedArea()
         a.setY(b.y());
         b.setY(t);
     }
-    if(b.x() > imageLabel->width()) b.setX(imageLabel->width() - 1);
-    if(b.y() > imageLabel->height()) b.setY(imageLabel->height() - 1);
-    if(a.x() < imageLabel->x()) a.setX(imageLabel->x());
-    if(a.y() < imageLabel->y()) a.setY((imageLabel->y()));
-    QRect r(a,b);
-    imageAfterEffect = image.copy(r);
-    w->show();
-    changeImage(imageAfterEffect);
-    w->slider->setEnabled(false);
+    // Выделение задано в координатах видимой области; обрезка только сужает ее, пиксели не копируются
+    const QRect r = (QRect(a, b) & QRect(QPoint(0, 0), cropRect.size())).translated(cropRect.topLeft());
+    if (r.isEmpty() || r == cropRect)
+        return;
+    undoStack->push(new CropCommand(r, this));
 }
 void ImageViewer::dialogIsFinished(int result){
-   if(result == QDialog::Accepted){
-
-       QUndoCommand *addCommand = new AddCommand(imageAfterEffect, image, this);
-       undoStack->push(addCommand);
-       return;
+   filterEngine->cancel();
+   QObject::disconnect(w, SIGNAL(valuesChanged()), this, SLOT(previewEffect()));
+   Adjustment adjustment = pendingAdjustment;
+   const int index = retuneIndex;
+   pendingAdjustment = Adjustment();
+   retuneIndex = -1;
+   currentEffect = Effect();
+   currentEffectName.clear();
+   effectPreviewPending = false;
+   releaseEffectImages();
+   if(result == QDialog::Accepted && adjustment.effect){
+       if (adjustment.adjustable)
+           adjustment.values = w->values();
+       QVector<Adjustment> list = currentAdjustments();
+       if (index >= 0 && index < list.size())
+           list[index].values = adjustment.values;
+       else
+           list.append(adjustment);
+       undoStack->push(new AdjustmentCommand(list, this));
    }
    w->slider->setValue(0);
    w->slider->setEnabled(true);
@@ -335,12 +702,12 @@ void ImageViewer::changePenWidth(int n)
 void ImageViewer::paint()
 {
     if(paintAct->isChecked()){
-        imageLabel->state = 1;
+        canvas->state = 1;
         if(dockWidget != nullptr) dockWidget->close();
         initColorSizeWidget("Brush Settings");
     }
     else{
-        imageLabel->state = -1;
+        canvas->state = -1;
         dockWidget->close();
     }
     updateActions();
@@ -348,13 +715,13 @@ void ImageViewer::paint()
 void ImageViewer::addText()
 {
     if(addTextAct->isChecked()){
-        imageLabel->state = 2;
+        canvas->state = 2;
         if(dockWidget != nullptr) dockWidget->close();
         initColorSizeWidget("Text Settings");
     }
     else{
         dockWidget->close();
-        imageLabel->state = -1;
+        canvas->state = -1;
     }
     updateActions();
 
@@ -362,8 +729,19 @@ void ImageViewer::addText()
 
 void ImageViewer::closeEvent(QCloseEvent *event)
 {
+    // Окно закрывается только после того, как фоновое сохранение допишет файлы
+    if (imageSaver->isBusy()) {
+        closeAfterSave = true;
+        statusBar()->showMessage(tr("Closing after the image is saved..."));
+        event->ignore();
+        return;
+    }
+    if (closeAfterSave) {
+        event->accept();
+        return;
+    }
 
-    if(!image.isNull()){
+    if(!document.isNull()){
         QMessageBox msgBox;
         msgBox.setText("The file has been modified.");
         msgBox.setInformativeText("Do you want to save your changes?");
@@ -372,8 +750,8 @@ void ImageViewer::closeEvent(QCloseEvent *event)
         int ret = msgBox.exec();
         switch (ret) {
           case QMessageBox::Save:
-              saveAs();
-              event->accept();
+              closeAfterSave = saveAs();
+              event->ignore();
               break;
           case QMessageBox::Discard:
                event->accept();
@@ -388,6 +766,346 @@ void ImageViewer::closeEvent(QCloseEvent *event)
 
     }
 }
+void ImageViewer::enforceUndoBudget()
+{
+    qint64 total = 0;
+    // Пиксели хранят только команды слоев; обрезка и операции хранят прямоугольники и списки и в бюджете не учитываются
+    for (int i = 0; i < undoStack->count(); ++i) {
+        const LayerCommand *command = dynamic_cast<const LayerCommand *>(undoStack->command(i));
+        if (command)
+            total += command->residentBytes();
+    }
+
+    for (int i = 0; i < undoStack->count() && total > undoMemoryBudget; ++i) {
+        LayerCommand *command = const_cast<LayerCommand *>(dynamic_cast<const LayerCommand *>(undoStack->command(i)));
+        if (!command)
+            continue;
+        const qint64 bytes = command->residentBytes();
+        if (bytes > 0 && command->spill())
+            total -= bytes;
+    }
+}
+
+void ImageViewer::changeUndoBudget()
+{
+    bool ok;
+    const int megabytes = QInputDialog::getInt(this, tr("Undo Memory Budget"), tr("Megabytes:"),
+                                               int(undoMemoryBudget / (1024 * 1024)), 16, 1024 * 1024, 64, &ok);
+    if (!ok)
+        return;
+    undoMemoryBudget = qint64(megabytes) * 1024 * 1024;
+    enforceUndoBudget();
+}
+
+void ImageViewer::changeDisplayProfile()
+{
+    const QStringList names = { QStringLiteral("sRGB"), QStringLiteral("Display P3"), QStringLiteral("Adobe RGB"),
+                                tr("From ICC File...") };
+    const QColorSpace current = ColorManager::instance().displayColorSpace();
+    const int currentIndex = current == QColorSpace(QColorSpace::DisplayP3) ? 1
+            : current == QColorSpace(QColorSpace::AdobeRgb) ? 2
+            : current == QColorSpace(QColorSpace::SRgb) ? 0 : 3;
+    bool ok;
+    const QString choice = QInputDialog::getItem(this, tr("Display Color Profile"), tr("Profile:"),
+                                                 names, currentIndex, false, &ok);
+    if (!ok)
+        return;
+    QColorSpace space;
+    switch (names.indexOf(choice)) {
+    case 0:
+        space = QColorSpace(QColorSpace::SRgb);
+        break;
+    case 1:
+        space = QColorSpace(QColorSpace::DisplayP3);
+        break;
+    case 2:
+        space = QColorSpace(QColorSpace::AdobeRgb);
+        break;
+    default: {
+        const QString fileName = QFileDialog::getOpenFileName(this, tr("Display Color Profile"), QString(),
+                                                              tr("ICC Profiles (*.icc *.icm)"));
+        if (fileName.isEmpty())
+            return;
+        QFile file(fileName);
+        if (file.open(QIODevice::ReadOnly))
+            space = QColorSpace::fromIccProfile(file.readAll());
+        if (!space.isValid()) {
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                     tr("Cannot use %1 as a display profile").arg(QDir::toNativeSeparators(fileName)));
+            return;
+        }
+        break;
+    }
+    }
+    ColorManager::instance().setDisplayColorSpace(space);
+    setColorSpace(colorSpace);
+}
+
+void ImageViewer::createEffectWindow()
+{
+    QImage empty;
+    w = new effectwindow(empty, empty, this);
+    w->setColorTransform(ColorManager::instance().displayTransform(colorSpace));
+    w->setModal(true);
+    w->setDeferredAccept(true);
+    QObject::connect(w, SIGNAL(finished (int)), this, SLOT(dialogIsFinished(int)));
+    QObject::connect(w, SIGNAL(acceptRequested()), this, SLOT(applyEffect()));
+    QObject::connect(this, SIGNAL(imageChanged()), w, SLOT(repaintEffectWindow()));
+    QObject::connect(filterEngine, SIGNAL(progress(int)), w, SLOT(setProgress(int)));
+    QObject::connect(filterEngine, SIGNAL(busyChanged(bool)), w, SLOT(setBusy(bool)));
+}
+
+void ImageViewer::createHistogramDock()
+{
+    histogramWidget = new HistogramWidget;
+    histogramDock = new QDockWidget(tr("Histogram"), this);
+    histogramDock->setObjectName(QStringLiteral("histogramDock"));
+    histogramDock->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+    histogramDock->setWidget(histogramWidget);
+    addDockWidget(Qt::RightDockWidgetArea, histogramDock);
+    QObject::connect(histogramDock, SIGNAL(visibilityChanged(bool)), this, SLOT(updateHistogram()));
+}
+
+void ImageViewer::updateHistogram(const QRect &dirty)
+{
+    if (!histogramDock->isVisible() || imageLoader->isLoading())
+        return;
+    histogramDirty |= dirty;
+    // Гистограмма описывает то, что видит пользователь, - результат операций и слоев над всей видимой областью
+    if (!showsRendered) {
+        histogramService.update(document, histogramDirty, cropRect);
+    } else {
+        // Операции досчитываются в рабочем потоке; гистограмма обновится, когда они будут готовы (adjustmentsEvaluated)
+        requestAdjustments(cropRect);
+        if (!adjustments.isEvaluated(document, cropRect))
+            return;
+        evaluateRendered(cropRect);
+        histogramService.update(rendered, histogramDirty, cropRect);
+    }
+    histogramDirty = QRect();
+    histogramWidget->setHistogram(histogramService.histogram());
+}
+
+void ImageViewer::createAdjustmentsDock()
+{
+    adjustmentsList = new QListWidget;
+    adjustmentsList->setContextMenuPolicy(Qt::ActionsContextMenu);
+    QAction *removeAct = new QAction(tr("&Remove"), adjustmentsList);
+    removeAct->setShortcut(QKeySequence::Delete);
+    removeAct->setShortcutContext(Qt::WidgetShortcut);
+    adjustmentsList->addAction(removeAct);
+    QObject::connect(removeAct, SIGNAL(triggered()), this, SLOT(removeAdjustment()));
+    QObject::connect(adjustmentsList, SIGNAL(itemActivated(QListWidgetItem*)), this, SLOT(retuneAdjustment()));
+
+    adjustmentsDock = new QDockWidget(tr("Adjustments"), this);
+    adjustmentsDock->setObjectName(QStringLiteral("adjustmentsDock"));
+    adjustmentsDock->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+    adjustmentsDock->setWidget(adjustmentsList);
+    addDockWidget(Qt::RightDockWidgetArea, adjustmentsDock);
+}
+
+void ImageViewer::updateAdjustmentsList()
+{
+    adjustmentsList->clear();
+    for (const Adjustment &adjustment : adjustments.adjustments()) {
+        QStringList values;
+        for (int value : adjustment.values)
+            values.append(QString::number(value));
+        adjustmentsList->addItem(values.isEmpty() ? adjustment.title
+                                                  : QStringLiteral("%1 (%2)").arg(adjustment.title, values.join(QStringLiteral(", "))));
+    }
+}
+
+void ImageViewer::retuneAdjustment()
+{
+    const int row = adjustmentsList->currentRow();
+    const QVector<Adjustment> list = currentAdjustments();
+    if (row < 0 || row >= list.size() || !list.at(row).adjustable)
+        return;
+    startEffect(list.at(row), row);
+}
+
+void ImageViewer::removeAdjustment()
+{
+    const int row = adjustmentsList->currentRow();
+    QVector<Adjustment> list = currentAdjustments();
+    if (row < 0 || row >= list.size())
+        return;
+    list.remove(row);
+    undoStack->push(new AdjustmentCommand(list, this));
+}
+
+void ImageViewer::createLayersDock()
+{
+    layersList = new QListWidget;
+    layersList->setContextMenuPolicy(Qt::ActionsContextMenu);
+    QAction *addAct = new QAction(tr("&New Layer"), layersList);
+    layersList->addAction(addAct);
+    QObject::connect(addAct, SIGNAL(triggered()), this, SLOT(addLayer()));
+    QAction *removeAct = new QAction(tr("&Remove Layer"), layersList);
+    removeAct->setShortcut(QKeySequence::Delete);
+    removeAct->setShortcutContext(Qt::WidgetShortcut);
+    layersList->addAction(removeAct);
+    QObject::connect(removeAct, SIGNAL(triggered()), this, SLOT(removeLayer()));
+    QAction *raiseAct = new QAction(tr("Move &Up"), layersList);
+    layersList->addAction(raiseAct);
+    QObject::connect(raiseAct, SIGNAL(triggered()), this, SLOT(raiseLayer()));
+    QAction *lowerAct = new QAction(tr("Move &Down"), layersList);
+    layersList->addAction(lowerAct);
+    QObject::connect(lowerAct, SIGNAL(triggered()), this, SLOT(lowerLayer()));
+    QObject::connect(layersList, SIGNAL(currentRowChanged(int)), this, SLOT(selectLayer(int)));
+    QObject::connect(layersList, SIGNAL(itemChanged(QListWidgetItem*)), this, SLOT(changeLayerVisibility(QListWidgetItem*)));
+
+    blendModeBox = new QComboBox;
+    blendModeBox->addItems(Layer::modeNames());
+    QObject::connect(blendModeBox, SIGNAL(activated(int)), this, SLOT(changeBlendMode(int)));
+    opacitySlider = new QSlider(Qt::Horizontal);
+    opacitySlider->setRange(0, 100);
+    QObject::connect(opacitySlider, SIGNAL(valueChanged(int)), this, SLOT(changeLayerOpacity(int)));
+
+    QWidget *panel = new QWidget;
+    QFormLayout *form = new QFormLayout;
+    form->addRow(tr("Mode"), blendModeBox);
+    form->addRow(tr("Opacity"), opacitySlider);
+    QVBoxLayout *layout = new QVBoxLayout(panel);
+    layout->addLayout(form);
+    layout->addWidget(layersList);
+
+    layersDock = new QDockWidget(tr("Layers"), this);
+    layersDock->setObjectName(QStringLiteral("layersDock"));
+    layersDock->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+    layersDock->setWidget(panel);
+    addDockWidget(Qt::RightDockWidgetArea, layersDock);
+    updateLayersList();
+}
+
+void ImageViewer::updateLayersList()
+{
+    const QSignalBlocker blocker(layersList);
+    layersList->clear();
+    // Верхний слой - первая строка, фон (сам документ) - последняя
+    const QVector<Layer> &list = layers.layers();
+    for (int i = list.size() - 1; i >= 0; --i) {
+        QListWidgetItem *item = new QListWidgetItem(list.at(i).name, layersList);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(list.at(i).visible ? Qt::Checked : Qt::Unchecked);
+    }
+    new QListWidgetItem(tr("Background"), layersList);
+    layersList->setCurrentRow(activeLayer < 0 ? list.size() : list.size() - 1 - activeLayer);
+    updateLayerControls();
+}
+
+void ImageViewer::updateLayerControls()
+{
+    const bool layer = activeLayer >= 0 && activeLayer < layers.count();
+    const QSignalBlocker modeBlocker(blendModeBox);
+    const QSignalBlocker opacityBlocker(opacitySlider);
+    blendModeBox->setEnabled(layer);
+    opacitySlider->setEnabled(layer);
+    blendModeBox->setCurrentIndex(layer ? layers.layers().at(activeLayer).mode : Layer::Normal);
+    opacitySlider->setValue(layer ? qRound(layers.layers().at(activeLayer).opacity * 100 / 255.0) : 100);
+}
+
+void ImageViewer::selectLayer(int row)
+{
+    activeLayer = row >= 0 && row < layers.count() ? layers.count() - 1 - row : -1;
+    updateLayerControls();
+}
+
+void ImageViewer::changeLayerVisibility(QListWidgetItem *item)
+{
+    const int row = layersList->row(item);
+    if (row < 0 || row >= layers.count())
+        return;
+    QVector<Layer> list = layers.layers();
+    Layer &layer = list[layers.count() - 1 - row];
+    const bool visible = item->checkState() == Qt::Checked;
+    if (layer.visible == visible)
+        return;
+    layer.visible = visible;
+    pushLayers(list);
+}
+
+void ImageViewer::addLayer()
+{
+    QVector<Layer> list = layers.layers();
+    activeLayer = activeLayer + 1;
+    list.insert(activeLayer, Layer::create(tr("Layer %1").arg(list.size() + 1), document.size()));
+    pushLayers(list);
+}
+
+void ImageViewer::removeLayer()
+{
+    if (activeLayer < 0 || activeLayer >= layers.count())
+        return;
+    QVector<Layer> list = layers.layers();
+    list.remove(activeLayer);
+    activeLayer = qMin(activeLayer, list.size() - 1);
+    pushLayers(list);
+}
+
+void ImageViewer::raiseLayer()
+{
+    if (activeLayer < 0 || activeLayer + 1 >= layers.count())
+        return;
+    QVector<Layer> list = layers.layers();
+    std::swap(list[activeLayer], list[activeLayer + 1]);
+    ++activeLayer;
+    pushLayers(list);
+}
+
+void ImageViewer::lowerLayer()
+{
+    if (activeLayer <= 0 || activeLayer >= layers.count())
+        return;
+    QVector<Layer> list = layers.layers();
+    std::swap(list[activeLayer], list[activeLayer - 1]);
+    --activeLayer;
+    pushLayers(list);
+}
+
+void ImageViewer::changeBlendMode(int mode)
+{
+    if (activeLayer < 0 || activeLayer >= layers.count() || layers.layers().at(activeLayer).mode == mode)
+        return;
+    QVector<Layer> list = layers.layers();
+    list[activeLayer].mode = static_cast<Layer::BlendMode>(mode);
+    pushLayers(list);
+}
+
+void ImageViewer::changeLayerOpacity(int percent)
+{
+    if (activeLayer < 0 || activeLayer >= layers.count())
+        return;
+    QVector<Layer> list = layers.layers();
+    list[activeLayer].opacity = qRound(percent * 255 / 100.0);
+    pushLayers(list, activeLayer);
+}
+
+void ImageViewer::pushLayers(const QVector<Layer> &list, int mergeKey)
+{
+    undoStack->push(new LayerCommand(layers.layers(), list, this, mergeKey));
+}
+
+void ImageViewer::beginAnnotation(const QString &name)
+{
+    layersBeforeStroke = layers.layers();
+    if (activeLayer >= 0 && activeLayer < layers.count())
+        return;
+    // Аннотации никогда не рисуются в сам документ: для них создается отдельный слой
+    QVector<Layer> list = layersBeforeStroke;
+    list.append(Layer::create(name, document.size()));
+    activeLayer = list.size() - 1;
+    layers.setLayers(list);
+    updateLayersList();
+}
+
+void ImageViewer::finishAnnotation()
+{
+    undoStack->push(new LayerCommand(layersBeforeStroke, layers.layers(), this));
+    layersBeforeStroke.clear();
+}
+
 void ImageViewer::initColorSizeWidget(QString title)
 {
     colorSizeWidget = new ColorSize;
@@ -406,203 +1124,231 @@ void ImageViewer::initColorSizeWidget(QString title)
 
 
 
-void ImageViewer::showBrightnessEffect()
+namespace {
+
+// Длина ядра размытия для документа, уменьшенного в scale раз
+int kernelLength(int value, int scale)
 {
-    changeImage(image);
-    QObject::connect(w->slider, SIGNAL(sliderReleased()), this, SLOT(brightnessAlgorithm()));
-    w->show();
+    const int m = value / scale;
+    return m < 2 ? 2 : m; //Регулировка интенсивности
 }
 
-void ImageViewer::showSepia()
+// Окрестность размытия в полном разрешении: половина ядра
+int blurHalo(const QVector<int> &values)
 {
-    cv::Mat src = Convert::QImageToCvMat(image);
-    cv::Mat dst ;
-    cv::Mat kern = (cv::Mat_<float>(4,4) <<  0.272, 0.534, 0.131, 0,
-                                                 0.349, 0.686, 0.168, 0,
-                                                 0.393, 0.769, 0.189, 0,
-                                                 0, 0, 0, 1);
-    cv::transform(src, dst, kern);
-    cv::Mat temp;
-    cvtColor(dst, temp,CV_BGR2RGB);
-    QImage dest((const uchar *) temp.data, int(temp.cols), int(temp.rows), int(temp.step), QImage::Format_RGB888);
-    dest.bits();
-    imageAfterEffect = dest;
-    changeImage(imageAfterEffect);
-    w->slider->setEnabled(false);
-    w->show();
+    return Filters::kernelSize(kernelLength(values.value(0), 1)) / 2;
 }
 
-void ImageViewer::brightnessAlgorithm()
+Adjustment makeAdjustment(const QString &name, const QString &title, const Adjustment::Effect &effect,
+                          bool adjustable, const Adjustment::Halo &halo = Adjustment::Halo())
 {
+    Adjustment adjustment;
+    adjustment.name = name;
+    adjustment.title = title;
+    adjustment.effect = effect;
+    adjustment.adjustable = adjustable;
+    adjustment.halo = halo;
+    return adjustment;
+}
 
-    int beta = w->slider->value();
-    if(beta != 0){
-
-
-        cv::Mat main_image = Convert::QImageToCvMat(image);
-        cv::Mat temp;
-        cvtColor(main_image, temp,CV_BGR2RGB);
-        QImage dest((const uchar *) temp.data, int(temp.cols), int(temp.rows), int(temp.step), QImage::Format_RGB888);
-        dest.bits();
-        image = dest;
-        main_image = Convert::QImageToCvMat(image);
-        cv::Mat new_image = cv::Mat::zeros( main_image.size(), main_image.type() );
-
-
-        double alpha = 1.8;
-        for( int y = 0; y < main_image.rows; y++ ) {
-                for( int x = 0; x < main_image.cols; x++ ) {
-                    for( int c = 0; c < main_image.channels(); c++ ) {
-
-                            new_image.at<cv::Vec3b>(y,x)[c] =
-                              cv::saturate_cast<uchar>( alpha*main_image.at<cv::Vec3b>(y,x)[c] + beta );
+}
 
+void ImageViewer::showBrightnessEffect()
+{
+    startEffect(makeAdjustment("brightness", tr("Brightness"),
+                               [](const TiledImage &source, const QVector<int> &values, int, const Filters::Progress &progress) {
+        const int value = values.value(0);
+        return value != 0 ? Filters::brightness(source, 1.8, value, progress) : source;
+    }, true));
+}
 
-                    }
-                }
-        }
+void ImageViewer::showSepia()
+{
+    startEffect(makeAdjustment("sepia", tr("Sepia"),
+                               [](const TiledImage &source, const QVector<int> &, int, const Filters::Progress &progress) {
+        return Filters::sepia(source, progress);
+    }, false));
+}
 
-        imageAfterEffect = Convert::cvMatToQImage(new_image);
-        changeImage(imageAfterEffect);
-    }
-    else{
-        changeImage(image);
+void ImageViewer::showColorLut()
+{
+    const QString fileName = QFileDialog::getOpenFileName(this, tr("Color LUT"), lutDirectory,
+                                                          tr("3D LUTs (*.cube *.3dl)"));
+    if (fileName.isEmpty())
+        return;
+    lutDirectory = QFileInfo(fileName).absolutePath();
+    QString error;
+    const std::shared_ptr<const ColorLut> lut = LutFile::load(fileName, &error);
+    if (!lut) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot load %1: %2").arg(QDir::toNativeSeparators(fileName), error));
+        return;
     }
+    // Путь и время изменения файла в имени операции отличают таблицы друг от друга в кэше результатов
+    const QFileInfo info(fileName);
+    startEffect(makeAdjustment(QStringLiteral("lut:%1:%2").arg(info.absoluteFilePath())
+                               .arg(info.lastModified().toMSecsSinceEpoch()),
+                               tr("LUT %1").arg(info.fileName()),
+                               [lut](const TiledImage &source, const QVector<int> &, int, const Filters::Progress &progress) {
+        return Filters::colorLut(source, *lut, progress);
+    }, false));
 }
+
 void ImageViewer::showHomogeneousEffect(){
-    changeImage(image);
-    QObject::connect(w->slider, SIGNAL(sliderReleased()), this, SLOT(homogeneousAlgorithm()));
-    w->show();
-}
-void ImageViewer::homogeneousAlgorithm(){
-    int m = w->slider->value();
-    if(m < 2) m = 2;
-    int MAX_KERNEL_LENGTH = m; //Регулировка интенсивности
-    cv::Mat dst;
-    cv::Mat src = Convert::QImageToCvMat(image);
-    for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 )
-        {
-            blur( src, dst, cv::Size( i, i ), cv::Point(-1,-1) );
-        }
-    imageAfterEffect = Convert::cvMatToQImage(dst);
-    changeImage(imageAfterEffect);
+    startEffect(makeAdjustment("homogeneous", tr("Homogeneous Blur"),
+                               [](const TiledImage &source, const QVector<int> &values, int scale, const Filters::Progress &progress) {
+        return Filters::homogeneous(source, kernelLength(values.value(0), scale), progress);
+    }, true, blurHalo));
 }
+
 void ImageViewer::showGaussianEffect(){
-    changeImage(image);
-    QObject::connect(w->slider, SIGNAL(sliderReleased()), this, SLOT(gaussianAlgorithm()));
-    w->show();
+    startEffect(makeAdjustment("gaussian", tr("Gaussian Blur"),
+                               [](const TiledImage &source, const QVector<int> &values, int scale, const Filters::Progress &progress) {
+        return Filters::gaussian(source, kernelLength(values.value(0), scale), progress);
+    }, true, blurHalo));
 }
 
-void ImageViewer::gaussianAlgorithm(){
-    int m = w->slider->value();
-    if(m < 2) m = 2;
-    int MAX_KERNEL_LENGTH = m; //Регулировка интенсивности
-    cv::Mat dst;
-    cv::Mat src = Convert::QImageToCvMat(image);
-    for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 ){
-            GaussianBlur( src, dst, cv::Size( i, i ), 0, 0 );
-     }
-    imageAfterEffect = Convert::cvMatToQImage(dst);
-    changeImage(imageAfterEffect);
-}
 void ImageViewer::showMedianEffect(){
-    changeImage(image);
-    QObject::connect(w->slider, SIGNAL(sliderReleased()), this, SLOT(medianAlgorithm()));
-    w->show();
+    startEffect(makeAdjustment("median", tr("Median Blur"),
+                               [](const TiledImage &source, const QVector<int> &values, int scale, const Filters::Progress &progress) {
+        return Filters::median(source, kernelLength(values.value(0), scale), progress);
+    }, true, blurHalo));
 }
 
-void ImageViewer::medianAlgorithm(){
-    int m = w->slider->value();
-    if(m < 2) m = 2;
-    int MAX_KERNEL_LENGTH = m;
-    cv::Mat dst;
-    cv::Mat src = Convert::QImageToCvMat(image);
-    for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 ){
-            medianBlur ( src, dst, i );
-    }
-    imageAfterEffect = Convert::cvMatToQImage(dst);
-    changeImage(imageAfterEffect);
-}
 void ImageViewer::showBilateralEffect(){
-    changeImage(image);
-    QObject::connect(w->slider, SIGNAL(sliderReleased()), this, SLOT(bilateralAlgorithm()));
-    w->show();
-
+    startEffect(makeAdjustment("bilateral", tr("Bilateral Blur"),
+                               [](const TiledImage &source, const QVector<int> &values, int scale, const Filters::Progress &progress) {
+        return Filters::bilateral(source, kernelLength(values.value(0), scale), progress);
+    }, true, blurHalo));
 }
-void ImageViewer::bilateralAlgorithm(){
-    int m = w->slider->value();
-    if(m < 2) m = 2;
-    int MAX_KERNEL_LENGTH = m; //Регулировка интенсивности
-    cv::Mat dst;
-    cv::Mat src = Convert::QImageToCvMat(image);
-
-    cv::Mat temp;
-    cvtColor(src, temp,CV_BGR2RGB);
-    QImage dest((const uchar *) temp.data, int(temp.cols), int(temp.rows), int(temp.step), QImage::Format_RGB888);
-    dest.bits();
-    image = dest;
-
-    src = Convert::QImageToCvMat(image);
 
+void ImageViewer::startEffect(const Adjustment &adjustment, int index)
+{
+    retuneIndex = index;
+    prepareEffectWindow();
+    pendingAdjustment = adjustment;
+    currentEffect = adjustment.effect;
+    // Результаты перенастройки считаются на другом входе, поэтому кэшируются отдельно
+    currentEffectName = index < 0 ? adjustment.name : QStringLiteral("%1@%2").arg(adjustment.name).arg(index);
+    w->setParameters(adjustment.parameters);
+    if (index >= 0)
+        w->setValues(adjustment.values);
+    w->slider->setEnabled(adjustment.adjustable);
+    if (adjustment.adjustable)
+        QObject::connect(w, SIGNAL(valuesChanged()), this, SLOT(previewEffect()));
+    // Значения параметров плагина по умолчанию и значения перенастраиваемой операции уже дают результат
+    if (!adjustment.adjustable || !adjustment.parameters.isEmpty() || index >= 0)
+        previewEffect();
+    w->show();
+}
 
-    for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 ){
-            bilateralFilter ( src, dst, i, i*2, i/2 );
-    }
-    imageAfterEffect = Convert::cvMatToQImage(dst);
-    changeImage(imageAfterEffect);
+void ImageViewer::showPluginEffect(FilterPlugin *plugin)
+{
+    Adjustment adjustment = makeAdjustment(QStringLiteral("plugin:") + plugin->id(), plugin->title(),
+                                           [plugin](const TiledImage &source, const QVector<int> &values, int scale, const Filters::Progress &progress) {
+        return FilterRegistry::apply(plugin, source, FilterRegistry::scaledValues(plugin, values, scale), progress);
+    }, false, [plugin](const QVector<int> &values) { return plugin->isTileable() ? plugin->halo(values) : -1; });
+    adjustment.parameters = plugin->parameters();
+    adjustment.adjustable = !adjustment.parameters.isEmpty();
+    startEffect(adjustment);
 }
 
-cv::Mat ImageViewer::generateHistogram(const cv::Mat &inputImage){
-    std::vector<cv::Mat> bgr_planes;
-    cv::split( inputImage, bgr_planes );
-    int histSize = 256;
-    float range[] = { 0, 256 }; //the upper boundary is exclusive
-    const float* histRange = { range };
-    bool uniform = true, accumulate = false;
-    cv::Mat b_hist, g_hist, r_hist;
-    cv::calcHist( &bgr_planes[0], 1, 0, cv::Mat(), b_hist, 1, &histSize, &histRange, uniform, accumulate );
-    cv::calcHist( &bgr_planes[1], 1, 0, cv::Mat(), g_hist, 1, &histSize, &histRange, uniform, accumulate );
-    cv::calcHist( &bgr_planes[2], 1, 0, cv::Mat(), r_hist, 1, &histSize, &histRange, uniform, accumulate );
-    int hist_w = 512, hist_h = 400;
-    int bin_w = cvRound( (double) hist_w/histSize );
-    cv::Mat histImage( hist_h, hist_w, CV_8UC3, cv::Scalar( 0,0,0) );
-    cv::normalize(b_hist, b_hist, 0, histImage.rows, cv::NORM_MINMAX, -1, cv::Mat() );
-    cv::normalize(g_hist, g_hist, 0, histImage.rows, cv::NORM_MINMAX, -1, cv::Mat() );
-    cv::normalize(r_hist, r_hist, 0, histImage.rows, cv::NORM_MINMAX, -1, cv::Mat() );
-        for( int i = 1; i < histSize; i++ )
-        {
-            line( histImage, cv::Point( bin_w*(i-1), hist_h - cvRound(b_hist.at<float>(i-1)) ),
-                  cv::Point( bin_w*(i), hist_h - cvRound(b_hist.at<float>(i)) ),
-                  cv::Scalar( 255, 0, 0), 2, 8, 0  );
-            line( histImage, cv::Point( bin_w*(i-1), hist_h - cvRound(g_hist.at<float>(i-1)) ),
-                  cv::Point( bin_w*(i), hist_h - cvRound(g_hist.at<float>(i)) ),
-                  cv::Scalar( 0, 255, 0), 2, 8, 0  );
-            line( histImage, cv::Point( bin_w*(i-1), hist_h - cvRound(r_hist.at<float>(i-1)) ),
-                  cv::Point( bin_w*(i), hist_h - cvRound(r_hist.at<float>(i)) ),
-                  cv::Scalar( 0, 0, 255), 2, 8, 0  );
+void ImageViewer::createPluginActions(QMenu *filterMenu)
+{
+    const QStringList errors = filterRegistry.load();
+    for (const QString &error : errors)
+        qWarning() << "filter plugin:" << error;
+    if (filterRegistry.plugins().isEmpty())
+        return;
+
+    filterMenu->addSeparator();
+    QMap<QString, QMenu *> categories;
+    for (FilterPlugin *plugin : filterRegistry.plugins()) {
+        QMenu *menu = filterMenu;
+        const QString category = plugin->category();
+        if (!category.isEmpty()) {
+            if (!categories.contains(category))
+                categories.insert(category, filterMenu->addMenu(category));
+            menu = categories.value(category);
         }
-
-     return histImage;
+        QAction *action = menu->addAction(plugin->title(), this, [this, plugin]() { showPluginEffect(plugin); });
+        action->setEnabled(false);
+        pluginActions.append(action);
+    }
 }
-void ImageViewer::showHistogramEqualization(){
-    cv::Mat src = Convert::QImageToCvMat(image);
-    cv::Mat ycrcb;
 
-    cv::cvtColor(src,ycrcb, CV_BGR2YCrCb);
+void ImageViewer::computeEffect(const TiledImage &source, int scale, const FilterEngine::Callback &callback)
+{
+    EffectCache::Key key;
+    key.revision = documentRevision;
+    key.effect = currentEffectName;
+    key.values = w->values();
+    key.scale = scale;
+
+    TiledImage cached;
+    if (effectCache.find(key, &cached)) {
+        filterEngine->cancel();
+        callback(cached);
+        return;
+    }
+    const Effect effect = currentEffect;
+    const QVector<int> values = key.values;
+    filterEngine->run([effect, source, values, scale](FilterJob &job) {
+        return effect(source, values, scale, job.progress());
+    }, [this, key, callback](const TiledImage &result) {
+        effectCache.insert(key, result);
+        callback(result);
+    });
+}
 
-    std::vector<cv::Mat> channels;
-    cv::split(ycrcb,channels);
+void ImageViewer::previewEffect()
+{
+    // Уменьшенная копия еще считается: предпросмотр начнется, когда она будет готова
+    if (!isEffectProxyReady()) {
+        effectPreviewPending = true;
+        return;
+    }
+    computeEffect(effectProxy, effectProxyScale, [this](const TiledImage &result) { setEffectResult(result); });
+}
 
-    cv::equalizeHist(channels[0], channels[0]);
+void ImageViewer::applyEffect()
+{
+    w->accept();
+}
 
-    cv::Mat dst;
-    cv::merge(channels,ycrcb);
+void ImageViewer::showHistogramEqualization(){
+    // Операция эквализирует результат предыдущих операций над всем документом, поэтому и предпросмотр
+    // считается по нему, а показывается только видимая область
+    const std::shared_ptr<AdjustmentStack> stack = std::make_shared<AdjustmentStack>(adjustments);
+    const TiledImage source = document;
+    const QRect crop = cropRect;
+    statusBar()->showMessage(tr("Equalizing histogram..."));
+    filterEngine->run([stack, source](FilterJob &job) {
+        stack->evaluate(source, source.rect());
+        return Filters::histogramEqualization(stack->output(source), job.progress());
+    }, [this, stack, source, crop](const TiledImage &result) {
+        const TiledImage input = stack->output(source);
+        showHistogramResult(crop == input.rect() ? input : input.copyRegion(crop),
+                            crop == result.rect() ? result : result.copyRegion(crop));
+    });
+}
 
-    cv::cvtColor(ycrcb,dst,CV_YCrCb2BGR);
-    imageAfterEffect = Convert::cvMatToQImage(dst);
-    QImage histogramBefore = Convert::cvMatToQImage(generateHistogram(src));
-    QImage histogramAfter = Convert::cvMatToQImage(generateHistogram(dst));
-    effectwindow *hw = new effectwindow(image, imageAfterEffect, histogramBefore, histogramAfter);
+void ImageViewer::showHistogramResult(const TiledImage &source, const TiledImage &result){
+    statusBar()->clearMessage();
+    QImage image = source.toImage();
+    // Эквализация зависит от гистограммы всего документа, поэтому пересчитывается целиком при любом изменении
+    pendingAdjustment = makeAdjustment("equalize", tr("Histogram Equalization"),
+                                       [](const TiledImage &source, const QVector<int> &, int, const Filters::Progress &progress) {
+        return Filters::histogramEqualization(source, progress);
+    }, false, [](const QVector<int> &) { return -1; });
+    retuneIndex = -1;
+    imageAfterEffect = result.toImage();
+    const QSize histogramSize(512, 400);
+    QImage histogramBefore = HistogramWidget::render(HistogramService::compute(source), histogramSize);
+    QImage histogramAfter = HistogramWidget::render(HistogramService::compute(result), histogramSize);
+    effectwindow *hw = new effectwindow(image, imageAfterEffect, histogramBefore, histogramAfter, this);
+    hw->setColorTransform(ColorManager::instance().displayTransform(colorSpace));
+    hw->setAttribute(Qt::WA_DeleteOnClose);
     QObject::connect(hw, SIGNAL(finished (int)), this, SLOT(dialogIsFinished(int)));
     hw->show();
 }
@@ -619,6 +1365,8 @@ void ImageViewer::createActions()
     saveAsAct->setEnabled(false);
     saveAsAct->setShortcut(tr("Ctrl+S"));
 
+    fileMenu->addAction(tr("Save Se&ttings..."), this, &ImageViewer::changeSaveSettings);
+    fileMenu->addAction(tr("Export Performance T&race..."), this, &ImageViewer::exportTrace);
 
     fileMenu->addSeparator();
 
@@ -641,6 +1389,12 @@ void ImageViewer::createActions()
     redoAction->setIcon(QPixmap(":/icons/redo.png"));
     editMenu->addAction( undoAction);
     editMenu->addAction(redoAction);
+    undoBudgetAct = editMenu->addAction(tr("Undo &Memory Budget..."), this, &ImageViewer::changeUndoBudget);
+    // Действует на следующие открытые файлы; выключение вдвое уменьшает память 16-битных документов
+    QAction *highBitDepthAct = editMenu->addAction(tr("Keep &16 Bits per Channel"));
+    highBitDepthAct->setCheckable(true);
+    highBitDepthAct->setChecked(true);
+    QObject::connect(highBitDepthAct, SIGNAL(toggled(bool)), imageLoader, SLOT(setHighBitDepth(bool)));
 
 
     QAction *pasteAct = editMenu->addAction(QPixmap(":/icons/paste.png"), tr("&Paste"), this, &ImageViewer::paste);
@@ -688,6 +1442,15 @@ void ImageViewer::createActions()
     fitToWindowAct->setCheckable(true);
     fitToWindowAct->setShortcut(tr("Ctrl+F"));
 
+    viewMenu->addSeparator();
+    viewMenu->addAction(histogramDock->toggleViewAction());
+    viewMenu->addAction(adjustmentsDock->toggleViewAction());
+    viewMenu->addAction(layersDock->toggleViewAction());
+    QAction *timingsAct = viewMenu->addAction(tr("Show &Timings"));
+    timingsAct->setCheckable(true);
+    QObject::connect(timingsAct, SIGNAL(toggled(bool)), timingOverlay, SLOT(setVisible(bool)));
+    viewMenu->addAction(tr("Display Color &Profile..."), this, &ImageViewer::changeDisplayProfile);
+
     QMenu *filterMenu = menuBar()->addMenu(tr("&Filter"));
     brightnessAct = filterMenu->addAction(QPixmap(":/icons/brightness.png"), tr("Brightness"),this,&ImageViewer::showBrightnessEffect);
     brightnessAct->setShortcut(tr("Ctrl+B"));
@@ -702,6 +1465,9 @@ void ImageViewer::createActions()
     sepiaAct->setShortcut(tr("Ctrl+A"));
     sepiaAct->setEnabled(false);
 
+    lutAct = filterMenu->addAction(QPixmap(":/icons/effect.png"), tr("Color &LUT..."), this, &ImageViewer::showColorLut);
+    lutAct->setEnabled(false);
+
     QMenu *blurSection = filterMenu->addMenu(tr("&Blur"));
     blurHAct = blurSection->addAction(tr("Homogeneus Blur"),this,&ImageViewer::showHomogeneousEffect);
     blurHAct->setShortcut(tr("Ctrl+L"));
@@ -719,40 +1485,37 @@ void ImageViewer::createActions()
     blurBAct->setShortcut(tr("Ctrl+T"));
     blurBAct->setEnabled(false);
 
+    createPluginActions(filterMenu);
+
 }
 
 void ImageViewer::updateActions()
 {
-    saveAsAct->setEnabled(!image.isNull());
-    copyAct->setEnabled(!image.isNull());
-    brightnessAct->setEnabled(!image.isNull());
-    sepiaAct->setEnabled(!image.isNull());
-    histAct->setEnabled(!image.isNull());
-    blurHAct->setEnabled(!image.isNull());
-    blurGAct->setEnabled(!image.isNull());
-    blurMAct->setEnabled(!image.isNull());
-    blurBAct->setEnabled(!image.isNull());
-
-    cropAct->setEnabled(!image.isNull());
-    paintAct->setEnabled(!image.isNull());
-    addTextAct->setEnabled(!image.isNull());
-    zoomInAct->setEnabled(!image.isNull());
-    zoomOutAct->setEnabled(!image.isNull());
-    fitToWindowAct->setEnabled(!image.isNull());
-    normalSizeAct->setEnabled(!image.isNull());
-    if(imageLabel->state == 0 || imageLabel->state == 1 || imageLabel->state == 2){
-        if(fitToWindowAct->isChecked() || countOfScales != 0){
-            fitToWindowAct->setChecked(false);
-            fitToWindow();
-        }
-
-    }
-    if(fitToWindowAct->isChecked()){
-       paintAct->setChecked(false);
-       addTextAct->setChecked(false);
-       cropAct->setChecked(false);
-    }
-    switch (imageLabel->state) {
+    // Пока файл загружается, редактировать нечего: в документе только запрошенные области
+    const bool editable = !document.isNull() && !imageLoader->isLoading();
+    saveAsAct->setEnabled(editable);
+    copyAct->setEnabled(editable);
+    brightnessAct->setEnabled(editable);
+    sepiaAct->setEnabled(editable);
+    lutAct->setEnabled(editable);
+    histAct->setEnabled(editable);
+    blurHAct->setEnabled(editable);
+    blurGAct->setEnabled(editable);
+    blurMAct->setEnabled(editable);
+    blurBAct->setEnabled(editable);
+    for (QAction *action : pluginActions)
+        action->setEnabled(editable);
+    adjustmentsList->setEnabled(editable);
+    layersDock->widget()->setEnabled(editable);
+
+    cropAct->setEnabled(editable);
+    paintAct->setEnabled(editable);
+    addTextAct->setEnabled(editable);
+    zoomInAct->setEnabled(!document.isNull());
+    zoomOutAct->setEnabled(!document.isNull());
+    fitToWindowAct->setEnabled(!document.isNull());
+    normalSizeAct->setEnabled(!document.isNull());
+    switch (canvas->state) {
     case 0: {
         if(paintAct->isChecked()){
             paintAct->setChecked(false);
@@ -762,7 +1525,7 @@ void ImageViewer::updateActions()
             addTextAct->setChecked(false);
             addText();
         }
-        imageLabel->state = 0;
+        canvas->state = 0;
         break;
     }
     case 1: {
@@ -774,7 +1537,7 @@ void ImageViewer::updateActions()
             addTextAct->setChecked(false);
             addText();
         }
-        imageLabel->state = 1;
+        canvas->state = 1;
         break;
     }
     case 2: {
@@ -786,18 +1549,17 @@ void ImageViewer::updateActions()
             paintAct->setChecked(false);
             paint();
         }
-        imageLabel->state = 2;
+        canvas->state = 2;
         break;
     }
     default:
         break;
     }
 
-    zoomInAct->setEnabled(!cropAct->isChecked() && !fitToWindowAct->isChecked() &&
-                          !paintAct->isChecked() && !addTextAct->isChecked() && countOfScales < 5);
-    zoomOutAct->setEnabled(!cropAct->isChecked() && !fitToWindowAct->isChecked() &&
-                           !paintAct->isChecked() && !addTextAct->isChecked() && countOfScales > -5);
-    normalSizeAct->setEnabled(countOfScales!=0);
+    // Холст переводит координаты мыши через текущий масштаб, поэтому инструменты работают при любом масштабе
+    zoomInAct->setEnabled(!document.isNull() && !fitToWindowAct->isChecked() && canvas->zoom() < ImageCanvas::MaxZoom);
+    zoomOutAct->setEnabled(!document.isNull() && !fitToWindowAct->isChecked() && canvas->zoom() > ImageCanvas::MinZoom);
+    normalSizeAct->setEnabled(!qFuzzyCompare(canvas->zoom(), 1));
 
 }
 
@@ -805,26 +1567,85 @@ void ImageViewer::updateActions()
 
 void ImageViewer::scaleImage(double factor)
 {
-    scaleFactor *= factor;
-    imageLabel->resize(scaleFactor * imageLabel->pixmap(Qt::ReturnByValue).size());
-
-    adjustScrollBar(scrollArea->horizontalScrollBar(), factor);
-    adjustScrollBar(scrollArea->verticalScrollBar(), factor);
+    canvas->setZoom(canvas->zoom() * factor);
     updateActions();
 
 }
 
-void ImageViewer::adjustScrollBar(QScrollBar *scrollBar, double factor)
+void ImageViewer::changeImage(QImage &newImage)
+{
+    w->imageAfter = newImage;
+    emit imageChanged();
+}
+
+void ImageViewer::prepareEffectWindow()
+{
+    QObject::disconnect(w, SIGNAL(valuesChanged()), this, SLOT(previewEffect()));
+    currentEffect = Effect();
+    currentEffectName.clear();
+    effectPreviewPending = false;
+    updateEffectProxy();
+}
+
+bool ImageViewer::isEffectProxyReady() const
+{
+    return effectProxyRevision == documentRevision && effectProxyStage == retuneIndex && !effectProxy.isNull();
+}
 
+void ImageViewer::showEffectProxy()
 {
-    scrollBar->setValue(int(factor * scrollBar->value()
-                            + ((factor - 1) * scrollBar->pageStep()/2)));
+    imageAfterEffect = effectProxy.toImage();
+    w->setImages(imageAfterEffect, imageAfterEffect);
 }
 
-void ImageViewer::changeImage(QImage &newImage)
+void ImageViewer::updateEffectProxy()
 {
-    w->imageAfter = newImage;
-    emit imageChanged();
+    if (isEffectProxyReady()) {
+        showEffectProxy();
+        return;
+    }
+    const QSize target = w->previewSize();
+    int scale = 1;
+    while (scale < TiledImage::TileSize
+           && (cropRect.width() / scale > target.width() || cropRect.height() / scale > target.height()))
+        scale *= 2;
+    effectProxy = TiledImage();
+    releaseEffectImages();
+
+    // Перенастраиваемая операция применяется к результату предыдущих операций; они досчитываются над копией списка
+    const std::shared_ptr<AdjustmentStack> stack = std::make_shared<AdjustmentStack>(adjustments);
+    const TiledImage source = document;
+    const QRect crop = cropRect;
+    const int count = retuneIndex;
+    const quint64 revision = documentRevision;
+    filterEngine->run([stack, source, crop, count, scale](FilterJob &) {
+        stack->evaluate(source, crop, count);
+        const TiledImage &output = stack->output(source, count);
+        const TiledImage input = crop == output.rect() ? output : output.copyRegion(crop);
+        return scale == 1 ? input : TiledImage::fromImage(input.downscaled(scale));
+    }, [this, count, revision, scale](const TiledImage &proxy) {
+        effectProxy = proxy;
+        effectProxyScale = scale;
+        effectProxyRevision = revision;
+        effectProxyStage = count;
+        showEffectProxy();
+        if (effectPreviewPending) {
+            effectPreviewPending = false;
+            previewEffect();
+        }
+    });
+}
+
+void ImageViewer::setEffectResult(const TiledImage &result)
+{
+    imageAfterEffect = result.toImage();
+    changeImage(imageAfterEffect);
+}
+
+void ImageViewer::releaseEffectImages()
+{
+    imageAfterEffect = QImage();
+    w->setImages(QImage(), QImage());
 }
 
 
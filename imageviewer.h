@@ -12,17 +12,28 @@
 #include <QUndoStack>
 #include <QUndoCommand>
 #include "effectwindow.h"
-#include "imagelabelwithrubberband.h"
+#include "imagecanvas.h"
 #include <QPen>
 #include <QColorDialog>
 #include <QPainter>
 #include <QLayout>
 #include "colorsize.h"
+#include "tiledimage.h"
+#include "filterengine.h"
+#include "filters.h"
+#include "effectcache.h"
+#include "histogramservice.h"
+#include "histogramwidget.h"
+#include "imageloader.h"
+#include "imagesaver.h"
+#include "filterregistry.h"
+#include "timingoverlay.h"
+#include "adjustmentstack.h"
+#include "layerstack.h"
 #include <QMenuBar>
 #include <QMessageBox>
 #include <QMimeData>
 #include <QScreen>
-#include <QScrollArea>
 #include <QScrollBar>
 #include <QStandardPaths>
 #include <QStatusBar>
@@ -31,6 +42,11 @@
 #include <effectwindow.h>
 #include <QDockWidget>
 #include <QPainterPath>
+#include <QTimer>
+#include <QProgressBar>
+#include <QListWidget>
+#include <QComboBox>
+#include <QSlider>
 
 #if defined(QT_PRINTSUPPORT_LIB)
 #endif
@@ -39,7 +55,6 @@ QT_BEGIN_NAMESPACE
 class QAction;
 class QLabel;
 class QMenu;
-class QScrollArea;
 class QScrollBar;
 QT_END_NAMESPACE
 
@@ -57,13 +72,65 @@ public:
      */
     ImageViewer(QWidget *parent = nullptr);
     /*!
-     * \brief setImage устанавливает изображение в ImageLabelWithRubberBand,
-     * делает активным основные инструменты, соединяет сигнал изменения изображения со слотом перерисовки окно эффектов,
-     * соединяет сигнал завершения окна эффектов с методом dialogIsFinished(int),
-     * устанавливает начальные значения масштаба.
+     * \brief setImage устанавливает изображение в ImageCanvas,
+     * делает активным основные инструменты, устанавливает начальные значения масштаба.
      * \param newImage
      */
     void setImage(const QImage &newImage);
+    /*!
+     * \brief setImage устанавливает документ, уже разбитый на тайлы.
+     * Копирование TiledImage не копирует пиксели: тайлы разделяются.
+     * \param newDocument
+     * \param crop видимая область документа; пустой прямоугольник - весь документ
+     */
+    void setImage(const TiledImage &newDocument, const QRect &crop = QRect());
+    /*!
+     * \brief updateDocument заменяет документ новой версией (например, догруженной загрузчиком).
+     * Если размер не изменился, перерисовывается только прямоугольник changed, а масштаб и окно эффектов
+     * остаются прежними, поэтому завершение мазка кисти не зависит от размера изображения.
+     * Иначе работает как setImage.
+     * \param newDocument документ после действия
+     * \param changed область изменившихся пикселей в координатах документа
+     * \param crop видимая область документа после действия; пустой прямоугольник - весь документ
+     */
+    void updateDocument(const TiledImage &newDocument, const QRect &changed, const QRect &crop = QRect());
+    /*!
+     * \brief currentDocument возвращает текущий документ.
+     * После обрезки это по-прежнему документ целиком, видимая часть - currentCrop.
+     */
+    const TiledImage &currentDocument() const { return document; }
+    /*!
+     * \brief currentCrop видимая область документа в координатах документа
+     */
+    QRect currentCrop() const { return cropRect; }
+    /*!
+     * \brief setCrop меняет видимую область документа без копирования пикселей (используется стэком действий)
+     */
+    void setCrop(const QRect &crop);
+    /*!
+     * \brief currentAdjustments операции неразрушающего редактирования (используется стэком действий)
+     */
+    QVector<Adjustment> currentAdjustments() const { return adjustments.adjustments(); }
+    /*!
+     * \brief setAdjustments заменяет список операций. Пересчитываются только изменившиеся операции
+     * и следующие за ними, и только в видимой части документа (используется стэком действий).
+     */
+    void setAdjustments(const QVector<Adjustment> &list);
+    /*!
+     * \brief flattenDocument функция, собирающая видимую область документа после операций вместе с наложенными слоями
+     * (используется сохранением и копированием). Захватывает копии документа, операций и слоев на момент вызова,
+     * поэтому вызывается в рабочем потоке и не мешает редактированию.
+     */
+    ImageSaver::Render flattenDocument() const;
+    /*!
+     * \brief currentLayers слои аннотаций (используется стэком действий)
+     */
+    const QVector<Layer> &currentLayers() const { return layers.layers(); }
+    /*!
+     * \brief setLayers заменяет слои аннотаций; перерисовываются только тайлы, в которых слои различаются
+     * (используется стэком действий)
+     */
+    void setLayers(const QVector<Layer> &list);
 private slots:
     /*!
      * \brief open Срабатывает при нажатии на кнопку открытия файла,
@@ -73,8 +140,17 @@ private slots:
     /*!
      * \brief saveAs Срабатывает при нажатии на кнопку сохранения файла,
      * открывает файловое окно, передает полученный путь в saveFile
+     * \return false, если пользователь отказался от выбора файла
+     */
+    bool saveAs();
+    /*!
+     * \brief changeSaveSettings открывает окно настроек кодировщиков и дополнительных форматов и размеров
+     */
+    void changeSaveSettings();
+    /*!
+     * \brief exportTrace сохраняет записанные профилировщиком события в JSON-файл формата Chrome trace
      */
-    void saveAs();
+    void exportTrace();
     /*!
      * \brief copy загружает изображение в буффер обмена
      */
@@ -100,12 +176,12 @@ private slots:
      */
     void fitToWindow();
     /*!
-     * \brief crop устанавливает imageLabel в режим обрезки и отключает его при повторном нажатии.
+     * \brief crop устанавливает canvas в режим обрезки и отключает его при повторном нажатии.
      * После этого обновляет состояния всех кнопок.
      */
     void crop();
     /*!
-     * \brief paint устанавливает imageLabel в режим рисования и отключает его при повторном нажатии.
+     * \brief paint устанавливает canvas в режим рисования и отключает его при повторном нажатии.
      * Вызывает метод, инициализирующий виджет для изменения цвета и размера кисти.
      */
     void paint();
@@ -115,16 +191,16 @@ private slots:
      */
     void showSelectedArea();
     /*!
-     * \brief paintPoint рисует линию на изображении по двум точкам, координаты которых берутся из
-     * объекта класса ImageLabelWithRubberBand в режиме рисования. Если val равен 2
-     * сохраняет нарисованную линию в стэк действий.
+     * \brief paintPoint рисует линию на выбранном слое по двум точкам, координаты которых берутся из
+     * объекта класса ImageCanvas в режиме рисования. Если выбран фон, для мазка создается новый слой.
+     * Если val равен 2 сохраняет нарисованную линию в стэк действий.
      * \param val отвечает за статус рисования, если val равен 2, значит линия дорисована
      */
     void paintPoint(int val);
     /*!
-     * \brief paintText рисует текст на изображении, координаты которого берутся из
-     * объекта класса ImageLabelWithRubberBand в режиме наложения текста
-     * \param text текст приходящий из сигнала класса ImageLabelWithRubberBand
+     * \brief paintText рисует текст на выбранном слое (или на новом слое, если выбран фон), координаты
+     * которого берутся из объекта класса ImageCanvas в режиме наложения текста
+     * \param text текст приходящий из сигнала класса ImageCanvas
      */
     void paintText(QString text);
     /*!
@@ -135,11 +211,22 @@ private slots:
      * \brief showSepia открывает effectwindow, в котором измененной картинкой является изображение с эффектом сепии
      */
     void showSepia();
+    /*!
+     * \brief showColorLut загружает таблицу цветокоррекции (.cube, .3dl) и открывает effectwindow с ее результатом
+     */
+    void showColorLut();
     /*!
      * \brief showHistogramEqualization открывает effectwindow с двумя гистограммами, измененной картинкой
      *  является изображение с эквализированной гистограммой
      */
     void showHistogramEqualization();
+    /*!
+     * \brief showHistogramResult открывает effectwindow с двумя гистограммами после того,
+     *  как эквализация выполнена в рабочем потоке
+     * \param source видимая область документа до эквализации
+     * \param result та же область после эквализации
+     */
+    void showHistogramResult(const TiledImage &source, const TiledImage &result);
     /*!
      * \brief showHomogeneousEffect открывает effectwindow, в котором измененной картинкой является
      *  изображение с эффектом гомогенного размытия
@@ -147,8 +234,7 @@ private slots:
     void showHomogeneousEffect();
     /*!
      * \brief showGaussianEffect открывает effectwindow, в котором измененной картинкой является
-     *  изображение с эффектом гауссова размытия,
-     *  соединяет слайдер окна эффектов с методом homogeneousAlgorithm
+     *  изображение с эффектом гауссова размытия
      */
     void showGaussianEffect();
     /*!
@@ -162,30 +248,67 @@ private slots:
      */
     void showBilateralEffect();
     /*!
-     * \brief brightnessAlgorithm Применяет алгоритм увелчичения яркости к текущему изображению
+     * \brief previewEffect Применяет выбранный эффект к уменьшенной копии изображения при каждом
+     *  изменении слайдера. Вычисление идет в рабочем потоке, устаревшие вычисления отменяются.
+     */
+    void previewEffect();
+    /*!
+     * \brief applyEffect Срабатывает при нажатии "Accept" в окне эффектов и закрывает окно.
+     *  В полном разрешении эффект вычисляется позже и только для видимых тайлов (см. AdjustmentStack).
      */
-    void brightnessAlgorithm();
+    void applyEffect();
     /*!
-     * \brief homogeneousAlgorithm Применяет гомогенное размытие
+     * \brief dialogIsFinished Слот, который срабатывает в момент закрытия окна эффектов.
+     * Если пользователь принял изменения, то добавляет эффект в список операций (или меняет значения
+     * перенастраиваемой операции) через стэк сделанных действий.
      */
-    void homogeneousAlgorithm();
+    void dialogIsFinished(int);
     /*!
-     * \brief gaussianAlgorithm Применяет гауссово размытие
+     * \brief retuneAdjustment открывает окно эффектов для выбранной в списке операции;
+     * предпросмотр строится на результате предыдущих операций
      */
-    void gaussianAlgorithm();
+    void retuneAdjustment();
     /*!
-     * \brief medianAlgorithm Применяет медианный алгоритм размытия
+     * \brief removeAdjustment удаляет выбранную в списке операцию
      */
-    void medianAlgorithm();
+    void removeAdjustment();
     /*!
-     * \brief bilateralAlgorithm Применяет двусторонний алгоритм размытия
+     * \brief evaluateVisibleAdjustments досчитывает операции и наложение слоев для тайлов,
+     * ставших видимыми при прокрутке или масштабировании
      */
-    void bilateralAlgorithm();
+    void evaluateVisibleAdjustments();
     /*!
-     * \brief dialogIsFinished Слот, который срабатывает в момент закрытия окна эффектов.
-     * Если пользователь принял изменения, то добавляет измененное изображение в стэк сделанных действий.
+     * \brief selectLayer делает слой в строке row списка слоев выбранным для рисования
      */
-    void dialogIsFinished(int);
+    void selectLayer(int row);
+    /*!
+     * \brief changeLayerVisibility срабатывает при переключении флажка видимости слоя в списке
+     */
+    void changeLayerVisibility(QListWidgetItem *item);
+    /*!
+     * \brief addLayer добавляет пустой слой над выбранным
+     */
+    void addLayer();
+    /*!
+     * \brief removeLayer удаляет выбранный слой
+     */
+    void removeLayer();
+    /*!
+     * \brief raiseLayer поднимает выбранный слой на одну позицию
+     */
+    void raiseLayer();
+    /*!
+     * \brief lowerLayer опускает выбранный слой на одну позицию
+     */
+    void lowerLayer();
+    /*!
+     * \brief changeBlendMode устанавливает режим наложения выбранного слоя
+     */
+    void changeBlendMode(int mode);
+    /*!
+     * \brief changeLayerOpacity устанавливает непрозрачность выбранного слоя в процентах
+     */
+    void changeLayerOpacity(int percent);
     /*!
      * \brief changeColor Слот, который срабатывает при нажатии на кнопку изменения цвета.
      * Устанавливает цвет кисти.
@@ -204,6 +327,59 @@ private slots:
      * \param event Событие закрытия формы
      */
     void closeEvent(QCloseEvent *event);
+    /*!
+     * \brief enforceUndoBudget выгружает во временные файлы самые старые команды стэка действий,
+     * пока занятая ими оперативная память превышает undoMemoryBudget
+     */
+    void enforceUndoBudget();
+    /*!
+     * \brief changeUndoBudget запрашивает у пользователя лимит памяти стэка действий в мегабайтах
+     */
+    void changeUndoBudget();
+    /*!
+     * \brief changeDisplayProfile загружает профиль ICC экрана, в пространство которого переводится показываемый документ
+     */
+    void changeDisplayProfile();
+    /*!
+     * \brief updateHistogram обновляет гистограмму в доке, пересчитывая только измененные тайлы.
+     * Пока док скрыт, ничего не делает.
+     * \param dirty прямоугольник, в котором рисовали без смены буферов тайлов (см. HistogramService::update)
+     */
+    void updateHistogram(const QRect &dirty = QRect());
+    /*!
+     * \brief documentLoaded заменяет загружаемый документ полным изображением, сохраняя масштаб
+     */
+    void documentLoaded(const QString &fileName, const TiledImage &loaded, int depth, const QColorSpace &space);
+    /*!
+     * \brief documentLoadFailed сообщает об ошибке фонового чтения файла
+     */
+    void documentLoadFailed(const QString &fileName, const QString &error);
+    /*!
+     * \brief requestVisibleRegion пока файл загружается, запрашивает видимую область в полном разрешении,
+     * если при текущем масштабе предпросмотра не хватает
+     */
+    void requestVisibleRegion();
+    /*!
+     * \brief regionLoaded записывает декодированную область в загружаемый документ
+     */
+    void regionLoaded(const QRect &rect, const QImage &image);
+    /*!
+     * \brief fileSaved сообщает в строке состояния о записанном файле
+     */
+    void fileSaved(const QString &fileName);
+    /*!
+     * \brief fileSaveFailed сообщает об ошибке фоновой записи файла
+     */
+    void fileSaveFailed(const QString &fileName, const QString &error);
+    /*!
+     * \brief savingFinished скрывает индикатор сохранения; закрывает окно, если закрытие ждало конца сохранения
+     */
+    void savingFinished(bool ok);
+    /*!
+     * \brief updateActions обновляет все кнопки в соответсвии с возможностью ими пользоваться
+     * в той или иной ситуации
+     */
+    void updateActions();
 signals:
     /*!
      * \brief imageChanged сообщает об изменении изображения. Используется для перерисовки виджета с эффектом.
@@ -220,11 +396,6 @@ private:
      * \return в случае успешной загрузки возвращает true, иначе false
      */
     bool loadFile(const QString &fileName);
-    /*!
-     * \brief updateActions обновляет все кнопки в соответсвии с возможностью ими пользоваться
-     * в той или иной ситуации
-     */
-    void updateActions();
     /*!
      * \brief createToolBar создает ToolBar с необходимыми инструментами
      * \return возвращает указатель на созданный ToolBar
@@ -237,50 +408,228 @@ private:
      */
     void initColorSizeWidget(QString);
     /*!
-     * \brief saveFile сохраняет изображение в одном из необходимых пользователю форматах по заданному пути директории
+     * \brief saveFile начинает фоновое сохранение изображения по заданному пути, а также в дополнительных
+     * форматах и размерах из настроек сохранения. Редактирование во время сохранения не блокируется.
      * \param fileName путь директории сохранения файла
-     * \return
+     * \return false, если сохранение уже нельзя начать (нет документа)
      */
     bool saveFile(const QString &fileName);
     /*!
-     * \brief scaleImage увеличивает масштаб изображения в factor раз, устанавливает подходящие значения для ScrollBar
+     * \brief scaleImage увеличивает масштаб изображения в factor раз относительно центра окна
      * \param factor коэффициент увеличения или уменьшения масштаба изображения
      */
     void scaleImage(double factor);
-    /*!
-     * \brief adjustScrollBar устанавливает подходящее значение для scrollBar в зависимости от масштаба изображения
-     * \param scrollBar
-     * \param factor
-     */
-    void adjustScrollBar(QScrollBar *scrollBar, double factor);
     /*!
      * \brief changeImage сообщает об изменении изображения, после чего окно эффектов перерисовывается.
      * \param newImage Новое изображение, полученное после применения эффекта к старому изображению.
      */
     void changeImage(QImage &newImage);
     /*!
-     * \brief generateHistogram генерирует гистограмму с использованием фукнций OpenCV
-     * \param inputImage Изображение, из которого небходимо сгенерировать гистограмму
-     * \return
+     * \brief prepareEffectWindow заполняет окно эффектов текущим документом перед показом.
+     * Непрерывные копии изображения существуют только пока открыто окно эффектов.
+     */
+    void prepareEffectWindow();
+    typedef Adjustment::Effect Effect;
+    /*!
+     * \brief startEffect открывает окно эффектов для операции adjustment.
+     * Если эффект управляется слайдером (adjustment.adjustable), предпросмотр пересчитывается при изменении слайдеров,
+     * иначе вычисляется сразу.
+     * \param adjustment эффект, его параметры и значения
+     * \param index номер перенастраиваемой операции в списке; -1 - новая операция в конце списка
+     */
+    void startEffect(const Adjustment &adjustment, int index = -1);
+    /*!
+     * \brief showPluginEffect открывает effectwindow для фильтра-плагина
+     */
+    void showPluginEffect(FilterPlugin *plugin);
+    /*!
+     * \brief createPluginActions загружает фильтры-плагины и добавляет их в меню фильтров
+     * (в подменю по категории фильтра)
+     */
+    void createPluginActions(QMenu *filterMenu);
+    /*!
+     * \brief computeEffect применяет текущий эффект с текущим значением слайдера к source.
+     * Результат берется из effectCache, если он там есть, иначе вычисляется в рабочем потоке и запоминается.
+     * \param source документ (полный или уменьшенный)
+     * \param scale во сколько раз source меньше документа
+     * \param callback получает результат в потоке интерфейса
+     */
+    void computeEffect(const TiledImage &source, int scale, const FilterEngine::Callback &callback);
+    /*!
+     * \brief updateEffectProxy пересчитывает уменьшенную копию документа под размер окна эффектов,
+     * если документ изменился с момента прошлого пересчета. Операции до перенастраиваемой досчитываются
+     * в рабочем потоке; пока копия не готова, окно эффектов показывает прогресс, а предпросмотр откладывается.
      */
-    cv::Mat generateHistogram(const cv::Mat& inputImage);
-    QImage image;
+    void updateEffectProxy();
+    /*!
+     * \brief isEffectProxyReady true, если уменьшенная копия соответствует текущему документу и перенастраиваемой операции
+     */
+    bool isEffectProxyReady() const;
+    /*!
+     * \brief showEffectProxy показывает уменьшенную копию в окне эффектов как изображение до и после эффекта
+     */
+    void showEffectProxy();
+    /*!
+     * \brief setEffectResult запоминает результат эффекта и показывает его в окне эффектов.
+     * \param result документ после применения эффекта
+     */
+    void setEffectResult(const TiledImage &result);
+    /*!
+     * \brief releaseEffectImages освобождает изображения предпросмотра после закрытия окна эффектов.
+     */
+    void releaseEffectImages();
+    /*!
+     * \brief createEffectWindow создает окно эффектов. Окно одно на все время работы
+     * и переиспользуется для всех документов и эффектов.
+     */
+    void createEffectWindow();
+    /*!
+     * \brief createHistogramDock создает постоянно видимый док с гистограммой документа
+     */
+    void createHistogramDock();
+    /*!
+     * \brief createAdjustmentsDock создает док со списком операций неразрушающего редактирования
+     */
+    void createAdjustmentsDock();
+    /*!
+     * \brief updateAdjustmentsList перезаполняет список операций в доке
+     */
+    void updateAdjustmentsList();
+    /*!
+     * \brief createLayersDock создает док со списком слоев, режимом наложения и непрозрачностью выбранного слоя
+     */
+    void createLayersDock();
+    /*!
+     * \brief updateLayersList перезаполняет список слоев в доке
+     */
+    void updateLayersList();
+    /*!
+     * \brief updateLayerControls показывает режим наложения и непрозрачность выбранного слоя
+     */
+    void updateLayerControls();
+    /*!
+     * \brief pushLayers заменяет слои через стэк действий
+     * \param mergeKey номер слоя, изменения которого сливаются в одно действие (перетаскивание слайдера); -1 - не сливать
+     */
+    void pushLayers(const QVector<Layer> &list, int mergeKey = -1);
+    /*!
+     * \brief beginAnnotation запоминает слои до мазка или текста и, если выбран фон, создает для них слой name
+     */
+    void beginAnnotation(const QString &name);
+    /*!
+     * \brief finishAnnotation сохраняет мазок или текст в стэк действий
+     */
+    void finishAnnotation();
+    /*!
+     * \brief evaluateRendered запрашивает досчет операций в прямоугольнике rect документа (requestAdjustments),
+     * накладывает слои на уже посчитанные тайлы и обновляет rendered
+     * \return область документа, тайлы наложения которой были пересчитаны
+     */
+    QRect evaluateRendered(const QRect &rect);
+    /*!
+     * \brief requestAdjustments досчитывает операции в прямоугольнике rect документа в рабочем потоке (renderEngine).
+     * Пока задача выполняется, новые запросы копятся и запускаются одной задачей после нее.
+     */
+    void requestAdjustments(const QRect &rect);
+    /*!
+     * \brief adjustmentsEvaluated забирает тайлы, досчитанные задачей requestAdjustments, и перерисовывает их
+     */
+    void adjustmentsEvaluated(const AdjustmentStack &evaluated, const QRect &rect);
+    /*!
+     * \brief updateRendered сообщает об изменении пикселей документа в прямоугольнике changed
+     * (в координатах документа), досчитывает операции и слои в видимой части и перерисовывает холст.
+     */
+    void updateRendered(const QRect &changed);
+    /*!
+     * \brief updateComposite то же, что updateRendered, но изменились только слои над результатом операций.
+     * Если операций нет и слои не видны, холст показывает сам документ, иначе - rendered.
+     */
+    void updateComposite(const QRect &changed);
+    /*!
+     * \brief setColorSpace запоминает цветовое пространство документа и настраивает его перевод в пространство экрана
+     */
+    void setColorSpace(const QColorSpace &space);
+    /*!
+     * \brief document Текущее изображение, хранящееся в виде тайлов
+     */
+    TiledImage document;
+    /*!
+     * \brief colorSpace цветовое пространство пикселей документа (недействительное - считается sRGB)
+     */
+    QColorSpace colorSpace;
+    /*!
+     * \brief lutDirectory каталог, из которого в последний раз загружалась таблица цветокоррекции
+     */
+    QString lutDirectory;
+    /*!
+     * \brief cropRect видимая область документа. Обрезка только сужает ее, а отмена обрезки восстанавливает,
+     * поэтому пиксели вне области сохраняются, пока действие, меняющее размер документа, не заменит его
+     */
+    QRect cropRect;
+    /*!
+     * \brief layersBeforeStroke Слои на момент начала мазка кисти или наложения текста
+     */
+    QVector<Layer> layersBeforeStroke;
     QImage imageAfterEffect;
-    QPixmap *pixmapForPainting = nullptr;
-    QPainter *painter = nullptr;
+    /*!
+     * \brief adjustments операции неразрушающего редактирования над документом
+     */
+    AdjustmentStack adjustments;
+    /*!
+     * \brief layers слои аннотаций над результатом операций
+     */
+    LayerStack layers;
+    /*!
+     * \brief activeLayer номер слоя, на котором рисуют кисть и текст; -1 - фон (документ)
+     */
+    int activeLayer = -1;
+    /*!
+     * \brief rendered результат операций и наложения слоев; актуальны тайлы видимой части документа
+     */
+    TiledImage rendered;
+    /*!
+     * \brief showsRendered true, если холст показывает rendered, а не сам документ
+     */
+    bool showsRendered = false;
+    /*!
+     * \brief pendingAdjustment операция, открытая в окне эффектов
+     */
+    Adjustment pendingAdjustment;
+    /*!
+     * \brief retuneIndex номер перенастраиваемой операции или -1, если в окне эффектов новая операция
+     */
+    int retuneIndex = -1;
+    /*!
+     * \brief documentRevision Счетчик изменений документа
+     */
+    quint64 documentRevision = 0;
+    /*!
+     * \brief currentEffect Эффект, открытый в окне эффектов (пустой, если окно закрыто)
+     */
+    Effect currentEffect;
+    QString currentEffectName;
+    /*!
+     * \brief effectCache Недавние результаты эффектов по ключу (ревизия, эффект, значение, масштаб)
+     */
+    EffectCache effectCache;
+    /*!
+     * \brief effectProxy Уменьшенная в effectProxyScale раз копия документа для предпросмотра
+     */
+    TiledImage effectProxy;
+    int effectProxyScale = 1;
+    quint64 effectProxyRevision = 0;
+    int effectProxyStage = -1;
+    /*!
+     * \brief effectPreviewPending предпросмотр запрошен, пока уменьшенная копия еще считалась
+     */
+    bool effectPreviewPending = false;
     QPen pen;
     QColor color;
     int penWidth = 0;
-    ImageLabelWithRubberBand *imageLabel = nullptr;
-    QScrollArea *scrollArea = nullptr;
-    double scaleFactor = 1;
     /*!
-     * \brief countOfScales Количество приближений. Используется для контроля приближения и отдаления изображения.
-     * Если равно нулю, то изображение находится в исходном положении.
-     * Если меньше нуля, то отдалено.
-     * Если больше нуля, то приближено.
+     * \brief canvas Область просмотра документа; масштаб и положение хранятся в ней
      */
-    int countOfScales = 0;
+    ImageCanvas *canvas = nullptr;
     ColorSize *colorSizeWidget = nullptr;
     QAction *saveAsAct = nullptr;
     QAction *copyAct = nullptr;
@@ -296,6 +645,7 @@ private:
     QAction *blurBAct = nullptr;
     QAction *histAct = nullptr;
     QAction *sepiaAct = nullptr;
+    QAction *lutAct = nullptr;
     QAction *undoAction = nullptr;
     QAction *redoAction = nullptr;
     QAction *cropAct = nullptr;
@@ -303,8 +653,60 @@ private:
     QAction *changeColorAct = nullptr;
     effectwindow *w = nullptr;
     QDockWidget *dockWidget = nullptr;
+    QDockWidget *histogramDock = nullptr;
+    QDockWidget *adjustmentsDock = nullptr;
+    QListWidget *adjustmentsList = nullptr;
+    QDockWidget *layersDock = nullptr;
+    QListWidget *layersList = nullptr;
+    QComboBox *blendModeBox = nullptr;
+    QSlider *opacitySlider = nullptr;
+    HistogramWidget *histogramWidget = nullptr;
+    HistogramService histogramService;
     QUndoStack *undoStack = nullptr;
+    FilterEngine *filterEngine = nullptr;
+    /*!
+     * \brief renderEngine досчитывает операции неразрушающего редактирования для показа (отдельно от задач окна эффектов)
+     */
+    FilterEngine *renderEngine = nullptr;
+    /*!
+     * \brief pendingAdjustmentsRect область, досчет которой запрошен, пока renderEngine занят
+     */
+    QRect pendingAdjustmentsRect;
+    /*!
+     * \brief histogramDirty области рисования, накопившиеся, пока гистограмма ждет досчета операций
+     */
+    QRect histogramDirty;
+    ImageLoader *imageLoader = nullptr;
+    ImageSaver *imageSaver = nullptr;
+    /*!
+     * \brief extraSaveFormats форматы, в которых вместе с основным файлом сохраняются копии
+     */
+    QStringList extraSaveFormats;
+    /*!
+     * \brief extraSaveSizes длинные стороны уменьшенных копий, сохраняемых вместе с основным файлом
+     */
+    QList<int> extraSaveSizes;
+    QProgressBar *saveProgress = nullptr;
+    /*!
+     * \brief timingOverlay время отрисовки и последних операций в строке состояния (View > Show Timings)
+     */
+    TimingOverlay *timingOverlay = nullptr;
+    /*!
+     * \brief closeAfterSave окно закрывается, как только завершится фоновое сохранение
+     */
+    bool closeAfterSave = false;
+    /*!
+     * \brief regionTimer откладывает запрос видимой области до окончания прокрутки или масштабирования
+     */
+    QTimer *regionTimer = nullptr;
+    /*!
+     * \brief undoMemoryBudget Лимит оперативной памяти (в байтах) для данных стэка действий
+     */
+    qint64 undoMemoryBudget = 512ll * 1024 * 1024;
+    QAction *undoBudgetAct = nullptr;
     QAction *addTextAct = nullptr;
+    FilterRegistry filterRegistry;
+    QVector<QAction *> pluginActions;
 };
 
 #endif
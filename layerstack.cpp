@@ -0,0 +1,419 @@
+#include "layerstack.h"
+#include "imagepool.h"
+#include "profiler.h"
+
+#include <QCoreApplication>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace {
+
+// Каналы хранятся в целых числах 0..255 (скалярный путь) или в 16-битных векторах (по 8 каналов).
+// Сложение и вычитание насыщающие, окончательное значение обрезается до 255 при записи.
+
+inline int mul255(int a, int b)
+{
+    const int x = a * b + 128;
+    return (x + (x >> 8)) >> 8;
+}
+inline int sum(int a, int b) { return a + b; }
+inline int diff(int a, int b) { return a > b ? a - b : 0; }
+inline int inverse(int a) { return 255 - a; }
+inline int overlayPick(int below, int belowAlpha, int dark, int light) { return 2 * below <= belowAlpha ? dark : light; }
+
+// 16-битный результат (RGBA64_Premultiplied) смешивается теми же формулами, но максимум канала - 65535
+struct Deep
+{
+    qint64 value;
+};
+
+inline Deep mul255(Deep a, Deep b)
+{
+    const qint64 x = a.value * b.value + 32768;
+    return { (x + (x >> 16)) >> 16 };
+}
+inline Deep sum(Deep a, Deep b) { return { a.value + b.value }; }
+inline Deep diff(Deep a, Deep b) { return { a.value > b.value ? a.value - b.value : 0 }; }
+inline Deep inverse(Deep a) { return { 65535 - a.value }; }
+inline Deep overlayPick(Deep below, Deep belowAlpha, Deep dark, Deep light)
+{
+    return 2 * below.value <= belowAlpha.value ? dark : light;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 mul255(const cv::v_uint16x8 &a, const cv::v_uint16x8 &b)
+{
+    const cv::v_uint16x8 x = cv::v_mul_wrap(a, b) + cv::v_setall_u16(128);
+    return (x + (x >> 8)) >> 8;
+}
+inline cv::v_uint16x8 sum(const cv::v_uint16x8 &a, const cv::v_uint16x8 &b) { return a + b; }
+inline cv::v_uint16x8 diff(const cv::v_uint16x8 &a, const cv::v_uint16x8 &b) { return a - b; }
+inline cv::v_uint16x8 inverse(const cv::v_uint16x8 &a) { return cv::v_setall_u16(255) - a; }
+inline cv::v_uint16x8 overlayPick(const cv::v_uint16x8 &below, const cv::v_uint16x8 &belowAlpha,
+                                  const cv::v_uint16x8 &dark, const cv::v_uint16x8 &light)
+{
+    return cv::v_select((below + below) <= belowAlpha, dark, light);
+}
+#endif
+
+/*
+ * Наложение премультиплицированного пикселя s на премультиплицированный пиксель d (формулы W3C Compositing):
+ * c = s * (1 - ad) + d * (1 - as) + as * ad * B(d / ad, s / as), деление на альфу при этом сокращается.
+ * Одна и та же функция компилируется для скаляров и для векторов.
+ */
+template <int Mode, typename T>
+inline void blendPixel(T &blue, T &green, T &red, T &alpha, const T &sourceBlue, const T &sourceGreen,
+                       const T &sourceRed, const T &sourceAlpha)
+{
+    T *channels[3] = { &blue, &green, &red };
+    const T *sources[3] = { &sourceBlue, &sourceGreen, &sourceRed };
+    const T keepBelow = inverse(sourceAlpha);
+    const T belowAlpha = alpha;
+    for (int i = 0; i < 3; ++i) {
+        const T d = *channels[i];
+        const T s = *sources[i];
+        switch (Mode) {
+        case Layer::Multiply:
+            *channels[i] = sum(sum(mul255(s, inverse(belowAlpha)), mul255(d, keepBelow)), mul255(s, d));
+            break;
+        case Layer::Screen:
+            *channels[i] = diff(sum(s, d), mul255(s, d));
+            break;
+        case Layer::Overlay: {
+            const T product = mul255(s, d);
+            const T rest = mul255(diff(belowAlpha, d), diff(sourceAlpha, s));
+            const T dark = sum(product, product);
+            const T light = diff(mul255(sourceAlpha, belowAlpha), sum(rest, rest));
+            *channels[i] = sum(sum(mul255(s, inverse(belowAlpha)), mul255(d, keepBelow)),
+                               overlayPick(d, belowAlpha, dark, light));
+            break;
+        }
+        case Layer::Add:
+            *channels[i] = sum(s, d);
+            break;
+        default:
+            *channels[i] = sum(s, mul255(d, keepBelow));
+            break;
+        }
+    }
+    alpha = Mode == Layer::Add ? sum(sourceAlpha, belowAlpha) : sum(sourceAlpha, mul255(belowAlpha, keepBelow));
+}
+
+template <int Mode>
+void blendRowImpl(uchar *destination, const uchar *source, int width, int opacity)
+{
+    int x = 0;
+#if CV_SIMD128
+    const cv::v_uint16x8 scale = cv::v_setall_u16(static_cast<ushort>(opacity));
+    const cv::v_uint8x16 transparent = cv::v_setzero_u8();
+    for (; x <= width - 16; x += 16) {
+        cv::v_uint8x16 below[4];
+        cv::v_uint8x16 above[4];
+        cv::v_load_deinterleave(source + x * 4, above[0], above[1], above[2], above[3]);
+        // Мазки и текст занимают малую часть тайла: полностью прозрачные блоки пропускаются
+        if (cv::v_check_all(above[3] == transparent))
+            continue;
+        cv::v_load_deinterleave(destination + x * 4, below[0], below[1], below[2], below[3]);
+        cv::v_uint16x8 low[4], high[4], sourceLow[4], sourceHigh[4];
+        for (int c = 0; c < 4; ++c) {
+            cv::v_expand(below[c], low[c], high[c]);
+            cv::v_expand(above[c], sourceLow[c], sourceHigh[c]);
+            if (opacity != 255) {
+                sourceLow[c] = mul255(sourceLow[c], scale);
+                sourceHigh[c] = mul255(sourceHigh[c], scale);
+            }
+        }
+        blendPixel<Mode>(low[0], low[1], low[2], low[3], sourceLow[0], sourceLow[1], sourceLow[2], sourceLow[3]);
+        blendPixel<Mode>(high[0], high[1], high[2], high[3], sourceHigh[0], sourceHigh[1], sourceHigh[2], sourceHigh[3]);
+        cv::v_store_interleave(destination + x * 4, cv::v_pack(low[0], high[0]), cv::v_pack(low[1], high[1]),
+                               cv::v_pack(low[2], high[2]), cv::v_pack(low[3], high[3]));
+    }
+#endif
+    for (; x < width; ++x) {
+        const uchar *above = source + x * 4;
+        if (above[3] == 0)
+            continue;
+        uchar *below = destination + x * 4;
+        int s[4] = { above[0], above[1], above[2], above[3] };
+        if (opacity != 255) {
+            for (int c = 0; c < 4; ++c)
+                s[c] = mul255(s[c], opacity);
+        }
+        int d[4] = { below[0], below[1], below[2], below[3] };
+        blendPixel<Mode>(d[0], d[1], d[2], d[3], s[0], s[1], s[2], s[3]);
+        for (int c = 0; c < 4; ++c)
+            below[c] = static_cast<uchar>(qMin(d[c], 255));
+    }
+}
+
+// Строка RGBA64_Premultiplied хранит каналы в порядке R, G, B, A; слой остается 8-битным
+template <int Mode>
+void blendRow64Impl(quint16 *destination, const uchar *source, int width, int opacity)
+{
+    const Deep scale = { opacity * 257 };
+    for (int x = 0; x < width; ++x) {
+        const uchar *above = source + x * 4;
+        if (above[3] == 0)
+            continue;
+        quint16 *below = destination + x * 4;
+        Deep s[4] = { { above[0] * 257 }, { above[1] * 257 }, { above[2] * 257 }, { above[3] * 257 } };
+        if (opacity != 255) {
+            for (int c = 0; c < 4; ++c)
+                s[c] = mul255(s[c], scale);
+        }
+        Deep d[4] = { { below[2] }, { below[1] }, { below[0] }, { below[3] } };
+        blendPixel<Mode>(d[0], d[1], d[2], d[3], s[0], s[1], s[2], s[3]);
+        below[0] = static_cast<quint16>(qMin<qint64>(d[2].value, 65535));
+        below[1] = static_cast<quint16>(qMin<qint64>(d[1].value, 65535));
+        below[2] = static_cast<quint16>(qMin<qint64>(d[0].value, 65535));
+        below[3] = static_cast<quint16>(qMin<qint64>(d[3].value, 65535));
+    }
+}
+
+// Тайл документа в формате результата; его пиксели перезаписываются при наложении
+QImage backdrop(const QImage &tile, const QSize &size, QImage::Format format, QRgb background)
+{
+    if (tile.isNull()) {
+        QImage filled = ImagePool::instance().acquire(size, format);
+        filled.fill(QColor::fromRgba(background));
+        return filled;
+    }
+    if (tile.format() == format)
+        return ImagePool::instance().copy(tile);
+    return tile.convertToFormat(format);
+}
+
+}
+
+Layer Layer::create(const QString &name, const QSize &size)
+{
+    Layer layer;
+    layer.name = name;
+    layer.image = TiledImage(size, QImage::Format_ARGB32_Premultiplied, qRgba(0, 0, 0, 0));
+    return layer;
+}
+
+QStringList Layer::modeNames()
+{
+    return QStringList()
+            << QCoreApplication::translate("Layer", "Normal")
+            << QCoreApplication::translate("Layer", "Multiply")
+            << QCoreApplication::translate("Layer", "Screen")
+            << QCoreApplication::translate("Layer", "Overlay")
+            << QCoreApplication::translate("Layer", "Add");
+}
+
+bool LayerStack::isShown() const
+{
+    for (const Layer &layer : list) {
+        if (layer.isShown())
+            return true;
+    }
+    return false;
+}
+
+QRect LayerStack::setLayers(const QVector<Layer> &layers)
+{
+    QRect changed;
+    const int total = qMax(list.size(), layers.size());
+    for (int i = 0; i < total; ++i) {
+        const Layer *before = i < list.size() && list.at(i).isShown() ? &list.at(i) : nullptr;
+        const Layer *after = i < layers.size() && layers.at(i).isShown() ? &layers.at(i) : nullptr;
+        if (!before && !after)
+            continue;
+        if (before && after && before->image.size() != after->image.size()) {
+            invalidateTiles(after->image.rect());
+            changed |= after->image.rect();
+            continue;
+        }
+        const bool sameLook = before && after && before->mode == after->mode && before->opacity == after->opacity;
+        // Невыделенный тайл прозрачен, поэтому достаточно сравнить выделенные тайлы обоих слоев
+        const TiledImage &grid = before ? before->image : after->image;
+        for (int row = 0; row < grid.tileRows(); ++row) {
+            for (int column = 0; column < grid.tileColumns(); ++column) {
+                const qint64 beforeKey = before ? before->image.tile(column, row).cacheKey() : 0;
+                const qint64 afterKey = after ? after->image.tile(column, row).cacheKey() : 0;
+                if ((sameLook && beforeKey == afterKey) || (beforeKey == 0 && afterKey == 0))
+                    continue;
+                const QRect bounds = grid.tileRect(column, row);
+                invalidateTiles(bounds);
+                changed |= bounds;
+            }
+        }
+    }
+    list = layers;
+    return changed;
+}
+
+void LayerStack::paint(int index, const QRect &rect, const std::function<void(QPainter &)> &function)
+{
+    if (index < 0 || index >= list.size())
+        return;
+    list[index].image.paint(rect, function);
+    invalidateTiles(rect);
+}
+
+void LayerStack::invalidate(const QRect &rect)
+{
+    invalidateTiles(rect);
+}
+
+void LayerStack::invalidateTiles(const QRect &rect)
+{
+    if (cache.isNull())
+        return;
+    const QRect range = cache.tilesIn(rect);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column)
+            valid[row * cache.tileColumns() + column] = false;
+    }
+}
+
+void LayerStack::reset()
+{
+    cache = TiledImage();
+    valid.clear();
+}
+
+QImage::Format LayerStack::outputFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+        // В RGB32 альфа всегда 0xFF, поэтому такой тайл уже является непрозрачным премультиплицированным пикселем
+        return QImage::Format_RGB32;
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+    case QImage::Format_Grayscale16:
+        // 16-битный документ не теряет разрядность из-за слоев: сохранение и копирование берут результат наложения
+        return QImage::Format_RGBA64_Premultiplied;
+    default:
+        return QImage::Format_ARGB32_Premultiplied;
+    }
+}
+
+QRect LayerStack::composite(const TiledImage &base, const QRect &rect)
+{
+    if (base.isNull())
+        return QRect();
+    TRACE_SCOPE("LayerStack::composite");
+    const QImage::Format format = outputFormat(base.format());
+    if (cache.size() != base.size() || cache.format() != format || cache.background() != base.background()) {
+        cache = TiledImage(base.size(), format, base.background());
+        valid = QVector<bool>(cache.tileColumns() * cache.tileRows(), false);
+    }
+    const int columns = cache.tileColumns();
+    const QRect range = cache.tilesIn(rect);
+    QVector<int> stale;
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            if (!valid.at(row * columns + column))
+                stale.append(row * columns + column);
+        }
+    }
+    if (stale.isEmpty())
+        return QRect();
+
+    QVector<const Layer *> shown;
+    for (const Layer &layer : list) {
+        if (layer.isShown() && layer.image.size() == base.size()
+                && layer.image.format() == QImage::Format_ARGB32_Premultiplied)
+            shown.append(&layer);
+    }
+
+    QVector<QImage> results(stale.size());
+    QImage *target = results.data();
+    cv::parallel_for_(cv::Range(0, stale.size()), [&](const cv::Range &part) {
+        for (int i = part.start; i < part.end; ++i) {
+            const int column = stale.at(i) % columns;
+            const int row = stale.at(i) / columns;
+            const QImage below = base.tile(column, row);
+            bool covered = false;
+            for (const Layer *layer : shown)
+                covered = covered || layer->image.isTileAllocated(column, row);
+            if (!covered && (below.isNull() || below.format() == format)) {
+                // Над тайлом нет ни одного мазка: результат разделяет буфер документа
+                target[i] = below;
+                continue;
+            }
+            QImage output = backdrop(below, cache.tileRect(column, row).size(), format, base.background());
+            if (!covered) {
+                target[i] = output;
+                continue;
+            }
+            const int width = output.width();
+            const bool deep = format == QImage::Format_RGBA64_Premultiplied;
+            for (const Layer *layer : shown) {
+                if (!layer->image.isTileAllocated(column, row))
+                    continue;
+                const QImage above = layer->image.tile(column, row);
+                for (int y = 0; y < output.height(); ++y) {
+                    if (deep)
+                        blendRow64(reinterpret_cast<quint16 *>(output.scanLine(y)), above.constScanLine(y), width,
+                                   layer->mode, layer->opacity);
+                    else
+                        blendRow(output.scanLine(y), above.constScanLine(y), width, layer->mode, layer->opacity);
+                }
+            }
+            target[i] = output;
+        }
+    });
+
+    QRect recomputed;
+    for (int i = 0; i < stale.size(); ++i) {
+        const int column = stale.at(i) % columns;
+        const int row = stale.at(i) / columns;
+        cache.setTile(column, row, results.at(i));
+        valid[stale.at(i)] = true;
+        recomputed |= cache.tileRect(column, row);
+    }
+    return recomputed;
+}
+
+void LayerStack::blendRow(uchar *destination, const uchar *source, int width, Layer::BlendMode mode, int opacity)
+{
+    if (opacity <= 0)
+        return;
+    opacity = qMin(opacity, 255);
+    switch (mode) {
+    case Layer::Multiply:
+        blendRowImpl<Layer::Multiply>(destination, source, width, opacity);
+        break;
+    case Layer::Screen:
+        blendRowImpl<Layer::Screen>(destination, source, width, opacity);
+        break;
+    case Layer::Overlay:
+        blendRowImpl<Layer::Overlay>(destination, source, width, opacity);
+        break;
+    case Layer::Add:
+        blendRowImpl<Layer::Add>(destination, source, width, opacity);
+        break;
+    default:
+        blendRowImpl<Layer::Normal>(destination, source, width, opacity);
+        break;
+    }
+}
+
+void LayerStack::blendRow64(quint16 *destination, const uchar *source, int width, Layer::BlendMode mode, int opacity)
+{
+    if (opacity <= 0)
+        return;
+    opacity = qMin(opacity, 255);
+    switch (mode) {
+    case Layer::Multiply:
+        blendRow64Impl<Layer::Multiply>(destination, source, width, opacity);
+        break;
+    case Layer::Screen:
+        blendRow64Impl<Layer::Screen>(destination, source, width, opacity);
+        break;
+    case Layer::Overlay:
+        blendRow64Impl<Layer::Overlay>(destination, source, width, opacity);
+        break;
+    case Layer::Add:
+        blendRow64Impl<Layer::Add>(destination, source, width, opacity);
+        break;
+    default:
+        blendRow64Impl<Layer::Normal>(destination, source, width, opacity);
+        break;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef LAYERSTACK_H
+#define LAYERSTACK_H
+
+#include <QRect>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "tiledimage.h"
+
+/*!
+ * \brief The Layer struct слой аннотаций (мазки кисти, текст), накладываемый поверх документа
+ */
+struct Layer
+{
+    enum BlendMode { Normal, Multiply, Screen, Overlay, Add, BlendModeCount };
+
+    QString name;
+    TiledImage image;      //!< Format_ARGB32_Premultiplied, невыделенные тайлы прозрачны
+    BlendMode mode = Normal;
+    int opacity = 255;     //!< непрозрачность слоя, 0..255
+    bool visible = true;
+
+    /*!
+     * \brief create создает пустой прозрачный слой размера size
+     */
+    static Layer create(const QString &name, const QSize &size);
+    /*!
+     * \brief modeNames названия режимов наложения в порядке BlendMode
+     */
+    static QStringList modeNames();
+    /*!
+     * \brief isShown true, если слой влияет на результат наложения
+     */
+    bool isShown() const { return visible && opacity > 0; }
+};
+
+/*!
+ * \brief The LayerStack class накладывает слои на документ и кэширует результат по тайлам.
+ *
+ * Слои хранятся в той же сетке тайлов, что и документ. Пересчитываются только тайлы, помеченные
+ * как измененные (invalidate, смена списка слоев) и попавшие в запрошенную область; тайлы
+ * обрабатываются параллельно. Невыделенный тайл слоя прозрачен и не меняет результат ни в одном
+ * режиме, поэтому тайл, в котором нет ни одного выделенного тайла видимых слоев, берется из документа
+ * без копирования. Строки смешиваются векторными инструкциями OpenCV (по 16 пикселей за раз).
+ * 16-битный документ накладывается в RGBA64_Premultiplied, чтобы результат не терял разрядность.
+ */
+class LayerStack
+{
+public:
+    LayerStack() = default;
+
+    bool isEmpty() const { return list.isEmpty(); }
+    int count() const { return list.size(); }
+    const QVector<Layer> &layers() const { return list; }
+    /*!
+     * \brief isShown true, если хотя бы один слой виден; иначе результат совпадает с документом
+     */
+    bool isShown() const;
+    /*!
+     * \brief setLayers заменяет список слоев. Сбрасываются только тайлы, в которых слои различаются
+     * (тайлы сравниваются по общему буферу, поэтому отмена мазка сбрасывает лишь тайлы мазка).
+     * \return область документа, результат наложения в которой изменился
+     */
+    QRect setLayers(const QVector<Layer> &layers);
+    /*!
+     * \brief paint рисует на слое index (см. TiledImage::paint) и сбрасывает тайлы rect
+     */
+    void paint(int index, const QRect &rect, const std::function<void(QPainter &)> &function);
+    /*!
+     * \brief invalidate сообщает об изменении документа под слоями в прямоугольнике rect
+     */
+    void invalidate(const QRect &rect);
+    /*!
+     * \brief reset сбрасывает весь кэш результата
+     */
+    void reset();
+    /*!
+     * \brief composite досчитывает наложение слоев на base в тайлах, пересекающих rect
+     * \return область, тайлы которой были пересчитаны
+     */
+    QRect composite(const TiledImage &base, const QRect &rect);
+    /*!
+     * \brief output результат наложения; актуальны только тайлы, уже досчитанные composite
+     */
+    const TiledImage &output() const { return cache; }
+    /*!
+     * \brief outputFormat формат результата для документа в формате format
+     */
+    static QImage::Format outputFormat(QImage::Format format);
+    /*!
+     * \brief blendRow накладывает строку source (ARGB32_Premultiplied) на строку destination на месте
+     * \param destination строка результата в формате ARGB32_Premultiplied или RGB32
+     * \param source строка слоя
+     * \param width число пикселей
+     * \param mode режим наложения
+     * \param opacity непрозрачность слоя, 0..255
+     */
+    static void blendRow(uchar *destination, const uchar *source, int width, Layer::BlendMode mode, int opacity);
+    /*!
+     * \brief blendRow64 то же, что blendRow, для строки результата в формате RGBA64_Premultiplied
+     */
+    static void blendRow64(quint16 *destination, const uchar *source, int width, Layer::BlendMode mode, int opacity);
+
+private:
+    void invalidateTiles(const QRect &rect);
+
+    QVector<Layer> list;
+    TiledImage cache;
+    QVector<bool> valid;
+};
+
+#endif // LAYERSTACK_H
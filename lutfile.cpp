@@ -0,0 +1,220 @@
+#include "lutfile.h"
+#include "profiler.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+QMutex LutFile::mutex;
+QCache<QString, LutFile::Entry> LutFile::cache(LutFile::MaxCacheKilobytes);
+
+namespace {
+
+// Числа строки; toFloat не зависит от локали, в отличие от strtod
+bool parseNumbers(const QByteArray &line, QVector<float> *values)
+{
+    values->clear();
+    const QList<QByteArray> tokens = line.simplified().split(' ');
+    for (const QByteArray &token : tokens) {
+        bool ok;
+        const float value = token.toFloat(&ok);
+        if (!ok)
+            return false;
+        values->append(value);
+    }
+    return true;
+}
+
+// Строка заголовка начинается не с числа: LUT_3D_SIZE, TITLE, 3DMESH, Mesh, LUT8 ...
+bool startsWithKeyword(const QByteArray &line)
+{
+    const int space = line.indexOf(' ');
+    const int tab = line.indexOf('\t');
+    const int end = space < 0 ? tab : tab < 0 ? space : qMin(space, tab);
+    bool ok;
+    line.left(end).toFloat(&ok);
+    return !ok;
+}
+
+}
+
+std::shared_ptr<const ColorLut> LutFile::load(const QString &fileName, QString *error)
+{
+    const QFileInfo info(fileName);
+    const QString key = info.absoluteFilePath();
+    {
+        QMutexLocker locker(&mutex);
+        const Entry *found = cache.object(key);
+        if (found && found->modified == info.lastModified() && found->size == info.size())
+            return found->lut;
+    }
+
+    TRACE_SCOPE("LutFile::load");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = file.errorString();
+        return nullptr;
+    }
+    const QByteArray data = file.readAll();
+    const std::shared_ptr<const ColorLut> lut = info.suffix().compare(QLatin1String("3dl"), Qt::CaseInsensitive) == 0
+            ? parse3dl(data, error) : parseCube(data, error);
+    if (!lut)
+        return nullptr;
+
+    Entry *entry = new Entry;
+    entry->modified = info.lastModified();
+    entry->size = info.size();
+    entry->lut = lut;
+    const qint64 bytes = qint64(lut->size()) * lut->size() * lut->size() * 3 * sizeof(float);
+    QMutexLocker locker(&mutex);
+    // Таблица больше всего кэша не сохраняется (QCache сразу удаляет такую запись)
+    cache.insert(key, entry, int(qMax<qint64>(1, bytes / 1024)));
+    return lut;
+}
+
+std::shared_ptr<const ColorLut> LutFile::parseCube(const QByteArray &data, QString *error)
+{
+    int size = 0;
+    std::vector<float> table;
+    QVector<float> values;
+    const QList<QByteArray> lines = data.split('\n');
+    for (int number = 0; number < lines.size(); ++number) {
+        const QByteArray line = lines.at(number).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        if (startsWithKeyword(line)) {
+            const QByteArray simple = line.simplified();
+            const int space = simple.indexOf(' ');
+            const QByteArray keyword = simple.left(space);
+            const QByteArray arguments = space < 0 ? QByteArray() : simple.mid(space + 1);
+            if (keyword == "LUT_3D_SIZE") {
+                size = arguments.trimmed().toInt();
+                if (size < MinSize || size > MaxSize) {
+                    *error = QStringLiteral("line %1: LUT_3D_SIZE %2 is out of range %3..%4")
+                            .arg(number + 1).arg(size).arg(MinSize).arg(MaxSize);
+                    return nullptr;
+                }
+                table.reserve(size_t(size) * size * size * 3);
+            } else if (keyword == "LUT_1D_SIZE") {
+                *error = QStringLiteral("1D LUTs are not supported");
+                return nullptr;
+            } else if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX" || keyword == "LUT_3D_INPUT_RANGE") {
+                // Таблица всегда строится по входу 0..1
+                const float expected = keyword == "DOMAIN_MIN" ? 0.0f : 1.0f;
+                if (!parseNumbers(arguments, &values)
+                        || (keyword == "LUT_3D_INPUT_RANGE" ? values != QVector<float>({ 0.0f, 1.0f })
+                                                             : values != QVector<float>(3, expected))) {
+                    *error = QStringLiteral("line %1: only the 0..1 input domain is supported").arg(number + 1);
+                    return nullptr;
+                }
+            }
+            // TITLE и прочие ключевые слова не влияют на таблицу
+            continue;
+        }
+        if (size == 0) {
+            *error = QStringLiteral("line %1: data before LUT_3D_SIZE").arg(number + 1);
+            return nullptr;
+        }
+        if (!parseNumbers(line, &values) || values.size() != 3) {
+            *error = QStringLiteral("line %1: expected three numbers").arg(number + 1);
+            return nullptr;
+        }
+        table.insert(table.end(), values.constBegin(), values.constEnd());
+    }
+    if (size == 0) {
+        *error = QStringLiteral("LUT_3D_SIZE is missing");
+        return nullptr;
+    }
+    const size_t expected = size_t(size) * size * size * 3;
+    if (table.size() != expected) {
+        *error = QStringLiteral("expected %1 entries, found %2").arg(expected / 3).arg(table.size() / 3);
+        return nullptr;
+    }
+    // В .cube быстрее всего меняется красный - тот же порядок, что у ColorLut
+    return std::make_shared<const ColorLut>(size, std::move(table));
+}
+
+std::shared_ptr<const ColorLut> LutFile::parse3dl(const QByteArray &data, QString *error)
+{
+    int size = 0;
+    int outputMaximum = 0;
+    bool inputGrid = false;
+    std::vector<float> entries;
+    QVector<float> values;
+    const QList<QByteArray> lines = data.split('\n');
+    for (int number = 0; number < lines.size(); ++number) {
+        const QByteArray line = lines.at(number).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        if (startsWithKeyword(line)) {
+            // Заголовок Lustre: "Mesh <бит входа> <бит выхода>", сетка из 2^n + 1 узлов
+            if (line.startsWith("Mesh") && parseNumbers(line.mid(4), &values) && values.size() == 2
+                    && values.at(0) >= 1 && values.at(0) <= 8 && values.at(1) >= 8 && values.at(1) <= 16) {
+                size = (1 << int(values.at(0))) + 1;
+                outputMaximum = (1 << int(values.at(1))) - 1;
+            }
+            continue;
+        }
+        if (!parseNumbers(line, &values)) {
+            *error = QStringLiteral("line %1: expected numbers").arg(number + 1);
+            return nullptr;
+        }
+        if (values.size() != 3) {
+            // Строка узлов входной сетки, например "0 64 128 ... 1023"; у Lustre идет после заголовка Mesh
+            if (!inputGrid && entries.empty()) {
+                if (size != 0 && values.size() != size) {
+                    *error = QStringLiteral("line %1: input grid has %2 nodes, Mesh expects %3")
+                            .arg(number + 1).arg(values.size()).arg(size);
+                    return nullptr;
+                }
+                size = values.size();
+                inputGrid = true;
+                continue;
+            }
+            *error = QStringLiteral("line %1: expected three numbers").arg(number + 1);
+            return nullptr;
+        }
+        entries.insert(entries.end(), values.constBegin(), values.constEnd());
+    }
+    const size_t count = entries.size() / 3;
+    if (size == 0)
+        size = qRound(std::cbrt(double(count)));
+    if (size < MinSize || size > MaxSize) {
+        *error = QStringLiteral("grid size %1 is out of range %2..%3").arg(size).arg(MinSize).arg(MaxSize);
+        return nullptr;
+    }
+    if (count != size_t(size) * size * size) {
+        *error = QStringLiteral("expected %1 entries, found %2").arg(size_t(size) * size * size).arg(count);
+        return nullptr;
+    }
+    if (outputMaximum == 0) {
+        // Разрядность выхода не указана: берется наименьшая из обычных (10, 12, 16 бит), вмещающая данные
+        const float largest = *std::max_element(entries.begin(), entries.end());
+        outputMaximum = largest <= 1023 ? 1023 : largest <= 4095 ? 4095 : 65535;
+    }
+
+    // В .3dl быстрее всего меняется синий: порядок переставляется под ColorLut
+    std::vector<float> table(entries.size());
+    const float scale = 1.0f / outputMaximum;
+    size_t source = 0;
+    for (int r = 0; r < size; ++r) {
+        for (int g = 0; g < size; ++g) {
+            for (int b = 0; b < size; ++b) {
+                float *target = table.data() + ((size_t(b) * size + g) * size + r) * 3;
+                for (int c = 0; c < 3; ++c)
+                    target[c] = entries[source++] * scale;
+            }
+        }
+    }
+    return std::make_shared<const ColorLut>(size, std::move(table));
+}
+
+void LutFile::clearCache()
+{
+    QMutexLocker locker(&mutex);
+    cache.clear();
+}
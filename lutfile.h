@@ -0,0 +1,66 @@
+#ifndef LUTFILE_H
+#define LUTFILE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <memory>
+#include "colormanager.h"
+
+/*!
+ * \brief The LutFile class читает трехмерные таблицы цветокоррекции (.cube, .3dl) и хранит прочитанные таблицы.
+ *
+ * Поддерживаются файлы .cube (Adobe/Resolve: LUT_3D_SIZE, значения 0..1, быстрее всего меняется красный)
+ * и .3dl (Autodesk: строка узлов сетки и/или заголовок Lustre "3DMESH" + "Mesh", целые значения 10/12/16 бит,
+ * быстрее всего меняется синий).
+ * Таблица файла разбирается один раз: повторное открытие того же неизмененного файла берет ее из кэша
+ * (давно не использованные таблицы вытесняются, когда кэш превышает MaxCacheKilobytes).
+ * Методы потокобезопасны.
+ */
+class LutFile
+{
+public:
+    /*!
+     * \brief MinSize, MaxSize допустимое число узлов сетки по каждой оси
+     */
+    static const int MinSize = 2;
+    static const int MaxSize = 256;
+    /*!
+     * \brief MaxCacheKilobytes объем таблиц в кэше (таблица из 65^3 узлов занимает около 3 Мб, из 256^3 - 192 Мб)
+     */
+    static const int MaxCacheKilobytes = 256 * 1024;
+
+    /*!
+     * \brief load читает таблицу из файла (или берет ее из кэша, если файл не менялся)
+     * \param error сюда записывается описание ошибки
+     * \return nullptr, если файл не удалось прочитать или разобрать
+     */
+    static std::shared_ptr<const ColorLut> load(const QString &fileName, QString *error);
+    /*!
+     * \brief parseCube разбирает содержимое файла .cube
+     */
+    static std::shared_ptr<const ColorLut> parseCube(const QByteArray &data, QString *error);
+    /*!
+     * \brief parse3dl разбирает содержимое файла .3dl
+     */
+    static std::shared_ptr<const ColorLut> parse3dl(const QByteArray &data, QString *error);
+    /*!
+     * \brief clearCache забывает все прочитанные таблицы
+     */
+    static void clearCache();
+
+private:
+    struct Entry
+    {
+        QDateTime modified;
+        qint64 size = 0;
+        std::shared_ptr<const ColorLut> lut;
+    };
+
+    static QMutex mutex;
+    static QCache<QString, Entry> cache;
+};
+
+#endif // LUTFILE_H
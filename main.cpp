@@ -1,10 +1,105 @@
-
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
 
+#include "batchprocessor.h"
 #include "imageviewer.h"
 
+namespace {
+
+bool hasBatchOption(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--batch") == 0 || qstrncmp(argv[i], "--batch=", 8) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Пакетный режим без интерфейса: cmakeImageEditor --batch <рецепт> --in <каталог> --out <каталог>
+int runBatch(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Applies a chain of effects to every image in a directory."));
+    parser.addHelpOption();
+    const QCommandLineOption batchOption(QStringLiteral("batch"),
+            QStringLiteral("Recipe file or inline recipe, e.g. \"brightness:1.8:40, gaussian:9, sepia\"."),
+            QStringLiteral("recipe"));
+    const QCommandLineOption inOption(QStringLiteral("in"), QStringLiteral("Input directory."), QStringLiteral("dir"));
+    const QCommandLineOption outOption(QStringLiteral("out"), QStringLiteral("Output directory."), QStringLiteral("dir"));
+    const QCommandLineOption jobsOption(QStringLiteral("jobs"),
+            QStringLiteral("Worker threads (default: number of cores)."), QStringLiteral("n"));
+    const QCommandLineOption queueOption(QStringLiteral("queue"),
+            QStringLiteral("Maximum number of files in flight (default: twice the workers)."), QStringLiteral("n"));
+    const QCommandLineOption qualityOption(QStringLiteral("quality"),
+            QStringLiteral("JPEG quality, 0..100 (default: 90)."), QStringLiteral("q"));
+    const QCommandLineOption compressionOption(QStringLiteral("compression"),
+            QStringLiteral("PNG compression level, 0..9 (default: 6)."), QStringLiteral("level"));
+    parser.addOptions({ batchOption, inOption, outOption, jobsOption, queueOption, qualityOption, compressionOption });
+    parser.process(app);
+
+    if (!parser.isSet(inOption) || !parser.isSet(outOption)) {
+        err << "--in and --out are required" << Qt::endl;
+        return 2;
+    }
+
+    QString recipeText = parser.value(batchOption);
+    QFile recipeFile(recipeText);
+    if (QFileInfo(recipeText).isFile()) {
+        if (!recipeFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            err << "cannot read recipe " << recipeText << ": " << recipeFile.errorString() << Qt::endl;
+            return 2;
+        }
+        recipeText = QString::fromUtf8(recipeFile.readAll());
+    }
+    QString error;
+    const Recipe recipe = Recipe::parse(recipeText, &error);
+    if (recipe.isEmpty()) {
+        err << "bad recipe: " << error << Qt::endl;
+        return 2;
+    }
+
+    const QString inputDirectory = parser.value(inOption);
+    const QString outputDirectory = parser.value(outOption);
+    if (!QFileInfo(inputDirectory).isDir()) {
+        err << "no such directory " << inputDirectory << Qt::endl;
+        return 2;
+    }
+    if (QFileInfo(inputDirectory).canonicalFilePath() == QFileInfo(outputDirectory).canonicalFilePath()) {
+        err << "--out must differ from --in" << Qt::endl;
+        return 2;
+    }
+    if (!QDir().mkpath(outputDirectory)) {
+        err << "cannot create " << outputDirectory << Qt::endl;
+        return 2;
+    }
+
+    BatchProcessor processor(recipe, outputDirectory);
+    processor.setThreadCount(parser.value(jobsOption).toInt());
+    processor.setMaxInFlight(parser.value(queueOption).toInt());
+    ImageSaver::Settings saveSettings;
+    if (parser.isSet(qualityOption))
+        saveSettings.jpegQuality = parser.value(qualityOption).toInt();
+    if (parser.isSet(compressionOption))
+        saveSettings.pngCompression = parser.value(compressionOption).toInt();
+    processor.setSaveSettings(saveSettings);
+    err << "recipe: " << recipe.toString() << Qt::endl;
+    const BatchProcessor::Statistics statistics = processor.run(BatchProcessor::imageFiles(inputDirectory), err);
+    return statistics.failed > 0 ? 1 : 0;
+}
+
+}
+
 int main(int argc, char *argv[])
 {
+    if (hasBatchOption(argc, argv))
+        return runBatch(argc, argv);
 
     QApplication app(argc, argv);
     QGuiApplication::setApplicationDisplayName(ImageViewer::tr("Image Editor"));
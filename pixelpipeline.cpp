@@ -0,0 +1,252 @@
+#include "pixelpipeline.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <cstring>
+
+namespace {
+
+// Размер пикселя и смещения байт B, G, R внутри него (little-endian)
+struct Layout
+{
+    int bytesPerPixel;
+    int blue;
+    int green;
+    int red;
+};
+
+bool layoutFor(QImage::Format format, Layout *layout)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        *layout = { 4, 0, 1, 2 };
+        return true;
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBX8888:
+        *layout = { 4, 2, 1, 0 };
+        return true;
+    case QImage::Format_RGB888:
+        *layout = { 3, 2, 1, 0 };
+        return true;
+    case QImage::Format_BGR888:
+        *layout = { 3, 0, 1, 2 };
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Премультиплицированные форматы обрабатываются в непремультиплицированном формате с той же раскладкой:
+// матрица и таблицы рассчитаны на цвет, не умноженный на альфу
+QImage::Format straightFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+        return QImage::Format_ARGB32;
+    case QImage::Format_RGBA8888_Premultiplied:
+        return QImage::Format_RGBA8888;
+    default:
+        return format;
+    }
+}
+
+#if CV_SIMD128
+inline void widen(const cv::v_uint8x16 &plane, cv::v_float32x4 *out)
+{
+    cv::v_uint16x8 low, high;
+    cv::v_expand(plane, low, high);
+    cv::v_uint32x4 parts[4];
+    cv::v_expand(low, parts[0], parts[1]);
+    cv::v_expand(high, parts[2], parts[3]);
+    for (int i = 0; i < 4; ++i)
+        out[i] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(parts[i]));
+}
+
+// Округление к ближайшему четному и насыщение - как у cv::saturate_cast<uchar>(float)
+inline cv::v_uint8x16 narrow(const cv::v_float32x4 *in)
+{
+    return cv::v_pack(cv::v_pack_u(cv::v_round(in[0]), cv::v_round(in[1])),
+                      cv::v_pack_u(cv::v_round(in[2]), cv::v_round(in[3])));
+}
+#endif
+
+}
+
+void PixelPipeline::addMatrix(const float matrix[12])
+{
+    Stage stage;
+    stage.type = Stage::Matrix;
+    std::memcpy(stage.matrix, matrix, sizeof(stage.matrix));
+    addStage(stage);
+}
+
+void PixelPipeline::addLut(const uchar blue[256], const uchar green[256], const uchar red[256])
+{
+    Stage stage;
+    stage.type = Stage::Lut;
+    std::memcpy(stage.lut[0], blue, 256);
+    std::memcpy(stage.lut[1], green, 256);
+    std::memcpy(stage.lut[2], red, 256);
+    addStage(stage);
+}
+
+void PixelPipeline::addLut(const uchar table[256])
+{
+    addLut(table, table, table);
+}
+
+void PixelPipeline::addChannelSwap(int blue, int green, int red)
+{
+    Stage stage;
+    stage.type = Stage::Matrix;
+    stage.permutation = true;
+    const int sources[3] = { blue, green, red };
+    for (int i = 0; i < 3; ++i)
+        stage.matrix[i * 4 + qBound(0, sources[i], 2)] = 1.0f;
+    addStage(stage);
+}
+
+void PixelPipeline::append(const PixelPipeline &other)
+{
+    for (const Stage &stage : other.stages)
+        addStage(stage);
+}
+
+void PixelPipeline::addStage(const Stage &stage)
+{
+    if (!stages.isEmpty()) {
+        Stage &last = stages.last();
+        if (last.type == Stage::Lut && stage.type == Stage::Lut) {
+            // Композиция таблиц: last, затем stage
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < 256; ++i)
+                    last.lut[c][i] = stage.lut[c][last.lut[c][i]];
+            }
+            return;
+        }
+        if (last.type == Stage::Matrix && stage.type == Stage::Matrix && (last.permutation || stage.permutation)) {
+            // Композиция stage * last; округление между ними ничего не меняет, т.к. одна из них - перестановка
+            float composed[12];
+            for (int r = 0; r < 3; ++r) {
+                for (int k = 0; k < 4; ++k) {
+                    float sum = k == 3 ? stage.matrix[r * 4 + 3] : 0.0f;
+                    for (int j = 0; j < 3; ++j)
+                        sum += stage.matrix[r * 4 + j] * last.matrix[j * 4 + k];
+                    composed[r * 4 + k] = sum;
+                }
+            }
+            std::memcpy(last.matrix, composed, sizeof(composed));
+            last.permutation = last.permutation && stage.permutation;
+            return;
+        }
+    }
+    stages.append(stage);
+}
+
+bool PixelPipeline::supports(QImage::Format format)
+{
+    Layout layout;
+    return layoutFor(straightFormat(format), &layout);
+}
+
+void PixelPipeline::run(QImage &image) const
+{
+    const QImage::Format format = image.format();
+    if (straightFormat(format) != format) {
+        QImage straight = image.convertToFormat(straightFormat(format));
+        run(straight);
+        image = straight.convertToFormat(format);
+        return;
+    }
+    Layout layout;
+    if (stages.isEmpty() || !layoutFor(format, &layout))
+        return;
+    const Stage *first = stages.constData();
+    const Stage *end = first + stages.size();
+    const int width = image.width();
+    for (int y = 0; y < image.height(); ++y) {
+        uchar *pixel = image.scanLine(y);
+        int x = 0;
+#if CV_SIMD128
+        // По 16 пикселей: каналы раскладываются в отдельные векторы, матрицы считаются в float по 4 значения,
+        // таблицы применяются через буфер (у 8-битных векторов нет выборки по индексам)
+        for (; x <= width - 16; x += 16, pixel += 16 * layout.bytesPerPixel) {
+            cv::v_uint8x16 planes[4];
+            if (layout.bytesPerPixel == 4)
+                cv::v_load_deinterleave(pixel, planes[0], planes[1], planes[2], planes[3]);
+            else
+                cv::v_load_deinterleave(pixel, planes[0], planes[1], planes[2]);
+            cv::v_uint8x16 value[3] = { planes[layout.blue], planes[layout.green], planes[layout.red] };
+            for (const Stage *stage = first; stage != end; ++stage) {
+                if (stage->type == Stage::Lut) {
+                    uchar buffer[16];
+                    for (int c = 0; c < 3; ++c) {
+                        cv::v_store(buffer, value[c]);
+                        for (int i = 0; i < 16; ++i)
+                            buffer[i] = stage->lut[c][buffer[i]];
+                        value[c] = cv::v_load(buffer);
+                    }
+                } else {
+                    const float *m = stage->matrix;
+                    cv::v_float32x4 input[3][4];
+                    for (int c = 0; c < 3; ++c)
+                        widen(value[c], input[c]);
+                    for (int c = 0; c < 3; ++c) {
+                        cv::v_float32x4 output[4];
+                        for (int i = 0; i < 4; ++i) {
+                            output[i] = input[0][i] * cv::v_setall_f32(m[c * 4]) + input[1][i] * cv::v_setall_f32(m[c * 4 + 1])
+                                    + input[2][i] * cv::v_setall_f32(m[c * 4 + 2]) + cv::v_setall_f32(m[c * 4 + 3]);
+                        }
+                        value[c] = narrow(output);
+                    }
+                }
+            }
+            planes[layout.blue] = value[0];
+            planes[layout.green] = value[1];
+            planes[layout.red] = value[2];
+            if (layout.bytesPerPixel == 4)
+                cv::v_store_interleave(pixel, planes[0], planes[1], planes[2], planes[3]);
+            else
+                cv::v_store_interleave(pixel, planes[0], planes[1], planes[2]);
+        }
+#endif
+        for (; x < width; ++x, pixel += layout.bytesPerPixel) {
+            uchar value[3] = { pixel[layout.blue], pixel[layout.green], pixel[layout.red] };
+            for (const Stage *stage = first; stage != end; ++stage) {
+                if (stage->type == Stage::Lut) {
+                    value[0] = stage->lut[0][value[0]];
+                    value[1] = stage->lut[1][value[1]];
+                    value[2] = stage->lut[2][value[2]];
+                } else {
+                    const float *m = stage->matrix;
+                    const float b = value[0];
+                    const float g = value[1];
+                    const float r = value[2];
+                    value[0] = cv::saturate_cast<uchar>(m[0] * b + m[1] * g + m[2] * r + m[3]);
+                    value[1] = cv::saturate_cast<uchar>(m[4] * b + m[5] * g + m[6] * r + m[7]);
+                    value[2] = cv::saturate_cast<uchar>(m[8] * b + m[9] * g + m[10] * r + m[11]);
+                }
+            }
+            pixel[layout.blue] = value[0];
+            pixel[layout.green] = value[1];
+            pixel[layout.red] = value[2];
+        }
+    }
+}
+
+TiledImage PixelPipeline::apply(const TiledImage &source, const std::function<bool(int, int)> &progress) const
+{
+    if (stages.isEmpty() || source.isNull())
+        return source;
+    if (supports(source.format()))
+        return source.transform([this](QImage &tile) { run(tile); }, progress);
+
+    // Серые и 16-битные документы: одно приведение к 32-битному формату вместе с проходом конвейера
+    const QImage::Format format = QImage::Format_ARGB32;
+    return source.map(0, [this, format](const QImage &region) -> QImage {
+        QImage converted = region.convertToFormat(format);
+        run(converted);
+        return converted;
+    }, progress);
+}
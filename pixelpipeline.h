@@ -0,0 +1,92 @@
+#ifndef PIXELPIPELINE_H
+#define PIXELPIPELINE_H
+
+#include <QImage>
+#include <QVector>
+#include <functional>
+#include "tiledimage.h"
+
+/*!
+ * \brief The PixelPipeline class объединяет цепочку попиксельных операций в один проход по памяти.
+ *
+ * Вместо того чтобы каждая операция (цветовая матрица, таблица LUT, перестановка каналов) создавала
+ * промежуточное изображение, все стадии выполняются над пикселем подряд, пока он находится в регистрах,
+ * и каждый тайл документа читается и записывается ровно один раз.
+ *
+ * При добавлении стадии соседние стадии сливаются, если это не меняет результат:
+ * подряд идущие LUT заменяются одной таблицей, перестановка каналов встраивается в соседнюю матрицу.
+ * Между остальными стадиями значения округляются до 8 бит, так что результат побитно совпадает
+ * с последовательным применением операций по отдельности.
+ *
+ * Каналы во всех стадиях указываются в порядке B, G, R (как в OpenCV) независимо от формата тайлов;
+ * альфа-канал не меняется. Работает на месте с 8-битными цветными форматами (см. supports);
+ * премультиплицированные тайлы на время прохода переводятся в непремультиплицированный формат.
+ * Пиксели обрабатываются векторными инструкциями OpenCV по 16 за раз.
+ */
+class PixelPipeline
+{
+public:
+    PixelPipeline() = default;
+    /*!
+     * \brief addMatrix добавляет аффинное преобразование цвета: out[i] = m[i][0]*B + m[i][1]*G + m[i][2]*R + m[i][3]
+     * \param matrix 3 строки по 4 коэффициента (выходные каналы B, G, R)
+     */
+    void addMatrix(const float matrix[12]);
+    /*!
+     * \brief addLut добавляет отдельные таблицы для каналов B, G, R
+     */
+    void addLut(const uchar blue[256], const uchar green[256], const uchar red[256]);
+    /*!
+     * \brief addLut добавляет одну таблицу для всех трех каналов
+     */
+    void addLut(const uchar table[256]);
+    /*!
+     * \brief addChannelSwap переставляет каналы: выходной канал B берется из входного канала blue и т.д.
+     * \param blue номер входного канала (0 - B, 1 - G, 2 - R)
+     */
+    void addChannelSwap(int blue, int green, int red);
+    /*!
+     * \brief append добавляет в конец все стадии other (со слиянием на стыке)
+     */
+    void append(const PixelPipeline &other);
+
+    bool isEmpty() const { return stages.isEmpty(); }
+    /*!
+     * \brief stageCount число стадий после слияния
+     */
+    int stageCount() const { return stages.size(); }
+
+    /*!
+     * \brief supports true, если конвейер может работать с форматом на месте
+     */
+    static bool supports(QImage::Format format);
+    /*!
+     * \brief run применяет стадии к изображению на месте; формат должен поддерживаться (см. supports)
+     */
+    void run(QImage &image) const;
+    /*!
+     * \brief apply применяет стадии к документу одним проходом по каждому тайлу (см. TiledImage::transform).
+     * Документы в неподдерживаемых форматах сначала приводятся к 32-битному формату.
+     */
+    TiledImage apply(const TiledImage &source,
+                     const std::function<bool(int, int)> &progress = std::function<bool(int, int)>()) const;
+
+private:
+    /*!
+     * \brief The Stage struct одна стадия: матрица 3x4 или таблицы для трех каналов
+     */
+    struct Stage
+    {
+        enum Type { Matrix, Lut };
+        Type type = Matrix;
+        bool permutation = false; //!< матрица только переставляет каналы (слияние с ней точное)
+        float matrix[12] = {};
+        uchar lut[3][256] = {};
+    };
+
+    void addStage(const Stage &stage);
+
+    QVector<Stage> stages;
+};
+
+#endif // PIXELPIPELINE_H
@@ -0,0 +1,127 @@
+#include "profiler.h"
+
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QSaveFile>
+#include <QThread>
+#include <algorithm>
+
+Profiler &Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+    : enabled(true)
+{
+    clock.start();
+}
+
+void Profiler::record(const char *name, qint64 start, qint64 duration)
+{
+    Event event;
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.thread = reinterpret_cast<quintptr>(QThread::currentThreadId());
+
+    QMutexLocker locker(&mutex);
+    if (ring.size() < Capacity) {
+        ring.append(event);
+    } else {
+        ring[next] = event;
+        wrapped = true;
+    }
+    next = (next + 1) % Capacity;
+    Totals &entry = totals[name];
+    entry.last = duration;
+    entry.total += duration;
+    ++entry.count;
+    entry.finished = start + duration;
+}
+
+QVector<Profiler::Event> Profiler::events() const
+{
+    QMutexLocker locker(&mutex);
+    if (!wrapped)
+        return ring;
+    // Самые старые события начинаются с позиции next
+    QVector<Event> result;
+    result.reserve(ring.size());
+    for (int i = 0; i < ring.size(); ++i)
+        result.append(ring.at((next + i) % ring.size()));
+    return result;
+}
+
+QVector<Profiler::Summary> Profiler::summary() const
+{
+    // Одинаковые литералы из разных единиц трансляции могут иметь разные адреса, поэтому сводка объединяется по тексту
+    QMap<QString, Summary> merged;
+    {
+        QMutexLocker locker(&mutex);
+        for (auto it = totals.constBegin(); it != totals.constEnd(); ++it) {
+            const QString name = QString::fromLatin1(it.key());
+            Summary &entry = merged[name];
+            entry.name = name;
+            entry.total += it->total;
+            entry.count += it->count;
+            if (it->finished >= entry.finished) {
+                entry.finished = it->finished;
+                entry.last = it->last;
+            }
+        }
+    }
+    QVector<Summary> result;
+    for (const Summary &entry : merged)
+        result.append(entry);
+    std::sort(result.begin(), result.end(), [](const Summary &a, const Summary &b) { return a.finished > b.finished; });
+    return result;
+}
+
+void Profiler::clear()
+{
+    QMutexLocker locker(&mutex);
+    ring.clear();
+    next = 0;
+    wrapped = false;
+    totals.clear();
+}
+
+bool Profiler::writeChromeTrace(const QString &fileName, QString *error) const
+{
+    const QVector<Event> recorded = events();
+    const qint64 pid = QCoreApplication::applicationPid();
+    // Идентификаторы потоков заменяются номерами в порядке появления, чтобы дорожки в просмотрщике были короткими
+    QHash<quint64, int> threads;
+    QJsonArray trace;
+    for (const Event &event : recorded) {
+        if (!threads.contains(event.thread))
+            threads.insert(event.thread, threads.size() + 1);
+        QJsonObject object;
+        object.insert(QStringLiteral("name"), QString::fromLatin1(event.name));
+        object.insert(QStringLiteral("cat"), QStringLiteral("ImageEditor"));
+        object.insert(QStringLiteral("ph"), QStringLiteral("X"));
+        object.insert(QStringLiteral("ts"), double(event.start));
+        object.insert(QStringLiteral("dur"), double(event.duration));
+        object.insert(QStringLiteral("pid"), double(pid));
+        object.insert(QStringLiteral("tid"), threads.value(event.thread));
+        trace.append(object);
+    }
+    QJsonObject root;
+    root.insert(QStringLiteral("traceEvents"), trace);
+    root.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0
+            || !file.commit()) {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+/*!
+ * \brief The Profiler class записывает длительность участков кода, размеченных макросом TRACE_SCOPE.
+ *
+ * Последние Capacity событий хранятся в кольцевом буфере и выгружаются в формате Chrome trace
+ * (открывается в chrome://tracing или https://ui.perfetto.dev). Для каждого имени участка также
+ * накапливается сводка: длительность последнего вызова, суммарное время и число вызовов.
+ * Запись одного события - это два чтения монотонных часов и одна короткая блокировка, поэтому
+ * разметка оставлена включенной; размечать стоит операции целиком, а не отдельные пиксели.
+ * Методы потокобезопасны.
+ */
+class Profiler
+{
+public:
+    static const int Capacity = 65536;
+
+    /*!
+     * \brief The Event struct завершенный участок кода; время в микросекундах от запуска программы
+     */
+    struct Event
+    {
+        const char *name = nullptr;
+        qint64 start = 0;
+        qint64 duration = 0;
+        quint64 thread = 0;
+    };
+
+    /*!
+     * \brief The Summary struct сводка по одному имени участка
+     */
+    struct Summary
+    {
+        QString name;
+        qint64 last = 0;     //!< длительность последнего вызова, мкс
+        qint64 total = 0;    //!< суммарная длительность, мкс
+        quint64 count = 0;   //!< число вызовов
+        qint64 finished = 0; //!< время окончания последнего вызова, мкс
+    };
+
+    /*!
+     * \brief The Scope class записывает событие от создания до разрушения объекта
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name)
+            : name(name), start(Profiler::instance().enabled ? Profiler::instance().now() : -1) {}
+        ~Scope()
+        {
+            if (start >= 0)
+                Profiler::instance().record(name, start, Profiler::instance().now() - start);
+        }
+
+    private:
+        Q_DISABLE_COPY(Scope)
+        const char *name;
+        qint64 start;
+    };
+
+    /*!
+     * \brief instance общий профилировщик приложения
+     */
+    static Profiler &instance();
+
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() const { return enabled; }
+    /*!
+     * \brief now текущее время в микросекундах от запуска программы
+     */
+    qint64 now() const { return clock.nsecsElapsed() / 1000; }
+    /*!
+     * \brief record добавляет событие
+     * \param name имя участка; должно жить до конца программы (строковый литерал)
+     */
+    void record(const char *name, qint64 start, qint64 duration);
+
+    QVector<Event> events() const;
+    /*!
+     * \brief summary сводка по всем именам участков в порядке окончания последнего вызова (последние - первыми)
+     */
+    QVector<Summary> summary() const;
+    /*!
+     * \brief clear удаляет записанные события и сводку
+     */
+    void clear();
+    /*!
+     * \brief writeChromeTrace сохраняет события в JSON-файл формата Chrome trace
+     * \param error описание ошибки, если файл не удалось записать
+     */
+    bool writeChromeTrace(const QString &fileName, QString *error = nullptr) const;
+
+    Profiler();
+
+private:
+    Q_DISABLE_COPY(Profiler)
+
+    struct Totals
+    {
+        qint64 last = 0;
+        qint64 total = 0;
+        quint64 count = 0;
+        qint64 finished = 0;
+    };
+
+    QElapsedTimer clock;
+    std::atomic<bool> enabled;
+    mutable QMutex mutex;
+    QVector<Event> ring;
+    int next = 0;
+    bool wrapped = false;
+    QHash<const char *, Totals> totals;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+/*!
+ * \brief TRACE_SCOPE записывает длительность выполнения до конца текущего блока под именем name (строковый литерал)
+ */
+#define TRACE_SCOPE(name) const Profiler::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // PROFILER_H
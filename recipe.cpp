@@ -0,0 +1,148 @@
+#include "recipe.h"
+
+#include <QStringList>
+
+namespace {
+
+// Имя шага, минимальное и максимальное количество параметров
+struct StepSpec
+{
+    const char *name;
+    int minArguments;
+    int maxArguments;
+};
+
+const StepSpec stepSpecs[] = {
+    { "brightness", 0, 2 },
+    { "sepia", 0, 0 },
+    { "homogeneous", 1, 1 },
+    { "gaussian", 1, 1 },
+    { "median", 1, 1 },
+    { "bilateral", 1, 1 },
+    { "equalize", 0, 0 },
+};
+
+const StepSpec *findSpec(const QString &name)
+{
+    for (const StepSpec &spec : stepSpecs) {
+        if (name == QLatin1String(spec.name))
+            return &spec;
+    }
+    return nullptr;
+}
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+}
+
+Recipe Recipe::parse(const QString &text, QString *error)
+{
+    Recipe recipe;
+    QStringList items;
+    for (const QString &line : text.split(QLatin1Char('\n'))) {
+        const QString trimmed = line.trimmed();
+        if (trimmed.isEmpty() || trimmed.startsWith(QLatin1Char('#')))
+            continue;
+        items += trimmed.split(QLatin1Char(','), Qt::SkipEmptyParts);
+    }
+
+    for (const QString &item : items) {
+        const QStringList parts = item.trimmed().split(QLatin1Char(':'));
+        Step step;
+        step.name = parts.first().trimmed().toLower();
+        const StepSpec *spec = findSpec(step.name);
+        if (!spec) {
+            setError(error, QStringLiteral("unknown step \"%1\"").arg(step.name));
+            return Recipe();
+        }
+        for (int i = 1; i < parts.size(); ++i) {
+            bool ok = false;
+            const double value = parts.at(i).trimmed().toDouble(&ok);
+            if (!ok) {
+                setError(error, QStringLiteral("bad parameter \"%1\" in step \"%2\"").arg(parts.at(i), step.name));
+                return Recipe();
+            }
+            step.arguments.append(value);
+        }
+        if (step.arguments.size() < spec->minArguments || step.arguments.size() > spec->maxArguments) {
+            setError(error, QStringLiteral("step \"%1\" takes %2 to %3 parameters")
+                     .arg(step.name).arg(spec->minArguments).arg(spec->maxArguments));
+            return Recipe();
+        }
+        recipe.steps.append(step);
+    }
+    if (recipe.steps.isEmpty())
+        setError(error, QStringLiteral("recipe is empty"));
+    return recipe;
+}
+
+QString Recipe::toString() const
+{
+    QStringList items;
+    for (const Step &step : steps) {
+        QString item = step.name;
+        for (double argument : step.arguments)
+            item += QLatin1Char(':') + QString::number(argument);
+        items.append(item);
+    }
+    return items.join(QStringLiteral(", "));
+}
+
+TiledImage Recipe::apply(const TiledImage &source, const Filters::Progress &progress) const
+{
+    TiledImage result = source;
+    int i = 0;
+    while (i < steps.size()) {
+        // Подряд идущие попиксельные шаги выполняются одним проходом
+        PixelPipeline pipeline;
+        int next = i;
+        while (next < steps.size() && PixelPipeline::supports(result.format()) && appendPointStep(steps.at(next), &pipeline))
+            ++next;
+        if (next - i > 1) {
+            result = pipeline.apply(result);
+        } else {
+            next = i + 1;
+            result = applyStep(steps.at(i), result);
+        }
+        i = next;
+        if (result.isNull() || (progress && !progress(i, steps.size())))
+            return TiledImage();
+    }
+    return result;
+}
+
+bool Recipe::appendPointStep(const Step &step, PixelPipeline *pipeline)
+{
+    const QVector<double> &a = step.arguments;
+    if (step.name == QLatin1String("brightness"))
+        pipeline->append(Filters::brightnessPipeline(a.size() > 0 ? a[0] : 1.8, a.size() > 1 ? a[1] : 0));
+    else if (step.name == QLatin1String("sepia"))
+        pipeline->append(Filters::sepiaPipeline());
+    else
+        return false;
+    return true;
+}
+
+TiledImage Recipe::applyStep(const Step &step, const TiledImage &source)
+{
+    const QVector<double> &a = step.arguments;
+    if (step.name == QLatin1String("brightness"))
+        return Filters::brightness(source, a.size() > 0 ? a[0] : 1.8, a.size() > 1 ? a[1] : 0);
+    if (step.name == QLatin1String("sepia"))
+        return Filters::sepia(source);
+    if (step.name == QLatin1String("homogeneous"))
+        return Filters::homogeneous(source, qRound(a[0]));
+    if (step.name == QLatin1String("gaussian"))
+        return Filters::gaussian(source, qRound(a[0]));
+    if (step.name == QLatin1String("median"))
+        return Filters::median(source, qRound(a[0]));
+    if (step.name == QLatin1String("bilateral"))
+        return Filters::bilateral(source, qRound(a[0]));
+    if (step.name == QLatin1String("equalize"))
+        return Filters::histogramEqualization(source);
+    return TiledImage();
+}
@@ -0,0 +1,66 @@
+#ifndef RECIPE_H
+#define RECIPE_H
+
+#include <QString>
+#include <QVector>
+#include "filters.h"
+#include "pixelpipeline.h"
+#include "tiledimage.h"
+
+/*!
+ * \brief The Recipe class описывает цепочку эффектов, применяемую к изображению без интерфейса.
+ *
+ * Текстовая запись - шаги через запятую или с новой строки, параметры шага через двоеточие:
+ * \code
+ * brightness:1.8:40, gaussian:9, sepia, equalize
+ * \endcode
+ * Поддерживаемые шаги: brightness[:alpha[:beta]], sepia, homogeneous:k, gaussian:k, median:k,
+ * bilateral:k, equalize. Для размытий k - значение слайдера (см. Filters::kernelSize).
+ * Строки, начинающиеся с #, считаются комментариями.
+ */
+class Recipe
+{
+public:
+    Recipe() = default;
+    /*!
+     * \brief parse разбирает текстовую запись рецепта
+     * \param text текст рецепта
+     * \param error если не nullptr, сюда записывается описание ошибки разбора
+     * \return пустой рецепт, если разобрать текст не удалось
+     */
+    static Recipe parse(const QString &text, QString *error = nullptr);
+    bool isEmpty() const { return steps.isEmpty(); }
+    /*!
+     * \brief toString текстовая запись рецепта в том же формате, который принимает parse
+     */
+    QString toString() const;
+    /*!
+     * \brief apply применяет шаги рецепта по порядку. Подряд идущие попиксельные шаги (brightness, sepia)
+     * для 8-битных цветных документов сливаются в один PixelPipeline и выполняются одним проходом.
+     * \param source исходный документ
+     * \param progress вызывается с номером выполненного шага и общим числом шагов;
+     * если возвращает false, применение прерывается и возвращается пустой документ
+     */
+    TiledImage apply(const TiledImage &source, const Filters::Progress &progress = Filters::Progress()) const;
+
+private:
+    /*!
+     * \brief The Step struct один шаг рецепта
+     */
+    struct Step
+    {
+        QString name;
+        QVector<double> arguments;
+    };
+
+    static TiledImage applyStep(const Step &step, const TiledImage &source);
+    /*!
+     * \brief appendPointStep добавляет шаг в pipeline, если он попиксельный
+     * \return false, если шаг нельзя выполнить в PixelPipeline
+     */
+    static bool appendPointStep(const Step &step, PixelPipeline *pipeline);
+
+    QVector<Step> steps;
+};
+
+#endif // RECIPE_H
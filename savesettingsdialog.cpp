@@ -0,0 +1,93 @@
+#include "savesettingsdialog.h"
+
+#include <QCheckBox>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QLineEdit>
+#include <QSpinBox>
+
+SaveSettingsDialog::SaveSettingsDialog(QWidget *parent)
+    : QDialog(parent)
+{
+    setWindowTitle(tr("Save Settings"));
+
+    jpegQuality = new QSpinBox;
+    jpegQuality->setRange(0, 100);
+    pngCompression = new QSpinBox;
+    pngCompression->setRange(0, 9);
+    optimize = new QCheckBox(tr("Optimized encoding"));
+    progressive = new QCheckBox(tr("Progressive JPEG"));
+    formats = new QLineEdit;
+    formats->setPlaceholderText(tr("e.g. png, webp"));
+    sizes = new QLineEdit;
+    sizes->setPlaceholderText(tr("longest side in px, e.g. 2048, 512"));
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    QObject::connect(buttons, SIGNAL(accepted()), this, SLOT(accept()));
+    QObject::connect(buttons, SIGNAL(rejected()), this, SLOT(reject()));
+
+    QFormLayout *layout = new QFormLayout(this);
+    layout->addRow(tr("JPEG quality:"), jpegQuality);
+    layout->addRow(tr("PNG compression:"), pngCompression);
+    layout->addRow(QString(), optimize);
+    layout->addRow(QString(), progressive);
+    layout->addRow(tr("Also save as:"), formats);
+    layout->addRow(tr("Also save sizes:"), sizes);
+    layout->addRow(buttons);
+
+    setSettings(ImageSaver::Settings());
+}
+
+void SaveSettingsDialog::setSettings(const ImageSaver::Settings &settings)
+{
+    jpegQuality->setValue(settings.jpegQuality);
+    pngCompression->setValue(settings.pngCompression);
+    optimize->setChecked(settings.optimize);
+    progressive->setChecked(settings.progressive);
+}
+
+ImageSaver::Settings SaveSettingsDialog::settings() const
+{
+    ImageSaver::Settings settings;
+    settings.jpegQuality = jpegQuality->value();
+    settings.pngCompression = pngCompression->value();
+    settings.optimize = optimize->isChecked();
+    settings.progressive = progressive->isChecked();
+    return settings;
+}
+
+void SaveSettingsDialog::setExtraFormats(const QStringList &list)
+{
+    formats->setText(list.join(QStringLiteral(", ")));
+}
+
+QStringList SaveSettingsDialog::extraFormats() const
+{
+    QStringList result;
+    for (const QString &item : formats->text().split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        const QString format = item.trimmed().toLower();
+        if (!format.isEmpty())
+            result.append(format);
+    }
+    return result;
+}
+
+void SaveSettingsDialog::setExtraSizes(const QList<int> &list)
+{
+    QStringList items;
+    for (int size : list)
+        items.append(QString::number(size));
+    sizes->setText(items.join(QStringLiteral(", ")));
+}
+
+QList<int> SaveSettingsDialog::extraSizes() const
+{
+    QList<int> result;
+    for (const QString &item : sizes->text().split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const int size = item.trimmed().toInt(&ok);
+        if (ok && size > 0)
+            result.append(size);
+    }
+    return result;
+}
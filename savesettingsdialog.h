@@ -0,0 +1,46 @@
+#ifndef SAVESETTINGSDIALOG_H
+#define SAVESETTINGSDIALOG_H
+
+#include <QDialog>
+#include <QList>
+#include <QStringList>
+#include "imagesaver.h"
+
+class QCheckBox;
+class QLineEdit;
+class QSpinBox;
+
+/*!
+ * \brief The SaveSettingsDialog class окно настроек сохранения: параметры кодировщиков
+ * и дополнительные форматы и размеры, которые записываются вместе с основным файлом.
+ */
+class SaveSettingsDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit SaveSettingsDialog(QWidget *parent = nullptr);
+
+    void setSettings(const ImageSaver::Settings &settings);
+    ImageSaver::Settings settings() const;
+    /*!
+     * \brief setExtraFormats форматы, в которых рядом с основным файлом сохраняются копии (например "png", "webp")
+     */
+    void setExtraFormats(const QStringList &formats);
+    QStringList extraFormats() const;
+    /*!
+     * \brief setExtraSizes длины длинной стороны уменьшенных копий в формате основного файла
+     */
+    void setExtraSizes(const QList<int> &sizes);
+    QList<int> extraSizes() const;
+
+private:
+    QSpinBox *jpegQuality = nullptr;
+    QSpinBox *pngCompression = nullptr;
+    QCheckBox *optimize = nullptr;
+    QCheckBox *progressive = nullptr;
+    QLineEdit *formats = nullptr;
+    QLineEdit *sizes = nullptr;
+};
+
+#endif // SAVESETTINGSDIALOG_H
@@ -0,0 +1,319 @@
+#include "tiledimage.h"
+#include "convert.h"
+#include "imagepool.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+QImage::Format paintableFormat(const QImage &image)
+{
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGB888:
+    case QImage::Format_BGR888:
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Grayscale16:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+    case QImage::Format_RGBX64:
+        return image.format();
+    default:
+        return image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    }
+}
+
+// Копирует прямоугольник sourceRect из source в target начиная с targetPos построчно.
+// Форматы изображений должны совпадать.
+void blit(const QImage &source, const QRect &sourceRect, QImage &target, const QPoint &targetPos)
+{
+    const int bytesPerPixel = source.depth() / 8;
+    const size_t bytes = static_cast<size_t>(sourceRect.width() * bytesPerPixel);
+    for (int y = 0; y < sourceRect.height(); ++y) {
+        std::memcpy(target.scanLine(targetPos.y() + y) + targetPos.x() * bytesPerPixel,
+                    source.constScanLine(sourceRect.y() + y) + sourceRect.x() * bytesPerPixel,
+                    bytes);
+    }
+}
+
+}
+
+TiledImage::TiledImage(const QSize &size, QImage::Format format, QRgb background)
+    : imageSize(size), imageFormat(format), backgroundColor(background)
+{
+    if (size.isEmpty())
+        return;
+    columns = (size.width() + TileSize - 1) / TileSize;
+    rows = (size.height() + TileSize - 1) / TileSize;
+    tiles.resize(columns * rows);
+}
+
+TiledImage TiledImage::fromImage(const QImage &image)
+{
+    if (image.isNull())
+        return TiledImage();
+    const QImage::Format format = paintableFormat(image);
+    const QImage source = format == image.format() ? image : image.convertToFormat(format);
+    TiledImage result(source.size(), format);
+    QImage *target = result.tiles.data();
+    cv::parallel_for_(cv::Range(0, result.tiles.size()), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i)
+            target[i] = ImagePool::instance().copy(source, result.tileRect(i % result.columns, i / result.columns));
+    });
+    return result;
+}
+
+QRect TiledImage::tileRect(int column, int row) const
+{
+    return QRect(column * TileSize, row * TileSize, TileSize, TileSize) & rect();
+}
+
+QRect TiledImage::tilesIn(const QRect &area) const
+{
+    const QRect clipped = area & rect();
+    if (clipped.isEmpty())
+        return QRect();
+    const int firstColumn = clipped.left() / TileSize;
+    const int firstRow = clipped.top() / TileSize;
+    const int lastColumn = clipped.right() / TileSize;
+    const int lastRow = clipped.bottom() / TileSize;
+    return QRect(firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1);
+}
+
+bool TiledImage::isTileAllocated(int column, int row) const
+{
+    return !tiles.at(index(column, row)).isNull();
+}
+
+QImage TiledImage::tile(int column, int row) const
+{
+    return tiles.at(index(column, row));
+}
+
+QImage &TiledImage::tileForWrite(int column, int row)
+{
+    QImage &result = tiles[index(column, row)];
+    if (result.isNull()) {
+        result = ImagePool::instance().acquire(tileRect(column, row).size(), imageFormat);
+        result.fill(QColor::fromRgba(backgroundColor));
+    } else if (!result.isDetached()) {
+        // Отделяем тайл сами, чтобы копия при записи тоже взяла буфер из пула
+        result = ImagePool::instance().copy(result);
+    }
+    return result;
+}
+
+void TiledImage::setTile(int column, int row, const QImage &tile)
+{
+    tiles[index(column, row)] = tile;
+}
+
+QImage TiledImage::copy(const QRect &area) const
+{
+    QImage result = ImagePool::instance().acquire(area.size(), imageFormat);
+    if (result.isNull())
+        return result;
+    const QRect range = tilesIn(area);
+    bool complete = (area & rect()) == area;
+    for (int row = range.top(); row <= range.bottom() && complete; ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            if (!isTileAllocated(column, row)) {
+                complete = false;
+                break;
+            }
+        }
+    }
+    if (!complete)
+        result.fill(QColor::fromRgba(backgroundColor));
+
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const QImage &source = tiles.at(index(column, row));
+            if (source.isNull())
+                continue;
+            const QRect bounds = tileRect(column, row);
+            const QRect part = bounds & area;
+            blit(source, part.translated(-bounds.topLeft()), result, part.topLeft() - area.topLeft());
+        }
+    }
+    return result;
+}
+
+QImage TiledImage::toImage() const
+{
+    return copy(rect());
+}
+
+QImage TiledImage::downscaled(int factor) const
+{
+    if (factor <= 1)
+        return toImage();
+    const QSize scaledSize((width() + factor - 1) / factor, (height() + factor - 1) / factor);
+    QImage result = ImagePool::instance().acquire(scaledSize, imageFormat);
+    if (result.isNull())
+        return result;
+    const int type = Convert::rawMatType(imageFormat);
+    const int bytesPerPixel = result.depth() / 8;
+    uchar *bits = result.bits();
+    const int bytesPerLine = result.bytesPerLine();
+
+    QImage background = ImagePool::instance().acquire(QSize(TileSize, TileSize), imageFormat);
+    background.fill(QColor::fromRgba(backgroundColor));
+
+    cv::parallel_for_(cv::Range(0, tiles.size()), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i) {
+            const QRect bounds = tileRect(i % columns, i / columns);
+            const QRect target = QRect(bounds.x() / factor, bounds.y() / factor,
+                                       (bounds.width() + factor - 1) / factor,
+                                       (bounds.height() + factor - 1) / factor) & result.rect();
+            const QImage &source = tiles.at(i).isNull() ? background : tiles.at(i);
+            const cv::Mat src(bounds.height(), bounds.width(), type,
+                              const_cast<uchar *>(source.constBits()),
+                              static_cast<size_t>(source.bytesPerLine()));
+            cv::Mat dst(target.height(), target.width(), type,
+                        bits + target.y() * bytesPerLine + target.x() * bytesPerPixel,
+                        static_cast<size_t>(bytesPerLine));
+            cv::resize(src, dst, dst.size(), 0, 0, cv::INTER_AREA);
+        }
+    });
+    return result;
+}
+
+void TiledImage::write(const QPoint &position, const QImage &source)
+{
+    if (source.isNull() || isNull())
+        return;
+    const QImage converted = source.format() == imageFormat ? source : source.convertToFormat(imageFormat);
+    const QRect area = QRect(position, converted.size()) & rect();
+    const QRect range = tilesIn(area);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const QRect bounds = tileRect(column, row);
+            const QRect part = bounds & area;
+            QImage &target = tileForWrite(column, row);
+            blit(converted, part.translated(-position), target, part.topLeft() - bounds.topLeft());
+        }
+    }
+}
+
+void TiledImage::paint(const QRect &area, const std::function<void(QPainter &)> &function)
+{
+    const QRect clipped = area & rect();
+    const QRect range = tilesIn(clipped);
+    for (int row = range.top(); row <= range.bottom(); ++row) {
+        for (int column = range.left(); column <= range.right(); ++column) {
+            const QRect bounds = tileRect(column, row);
+            QPainter painter(&tileForWrite(column, row));
+            painter.translate(-bounds.topLeft());
+            painter.setClipRect(clipped & bounds);
+            function(painter);
+        }
+    }
+}
+
+TiledImage TiledImage::copyRegion(const QRect &area) const
+{
+    const QRect clipped = area & rect();
+    TiledImage result(clipped.size(), imageFormat, backgroundColor);
+    if (result.isNull())
+        return result;
+    const bool aligned = clipped.x() % TileSize == 0 && clipped.y() % TileSize == 0;
+    for (int row = 0; row < result.rows; ++row) {
+        for (int column = 0; column < result.columns; ++column) {
+            const QRect target = result.tileRect(column, row);
+            const QRect sourceArea = target.translated(clipped.topLeft());
+            const QRect sourceTiles = tilesIn(sourceArea);
+            bool allocated = false;
+            for (int r = sourceTiles.top(); r <= sourceTiles.bottom() && !allocated; ++r) {
+                for (int c = sourceTiles.left(); c <= sourceTiles.right() && !allocated; ++c)
+                    allocated = isTileAllocated(c, r);
+            }
+            if (!allocated)
+                continue;
+            if (aligned) {
+                const QImage &source = tiles.at(index(sourceTiles.left(), sourceTiles.top()));
+                result.tiles[result.index(column, row)] = source.size() == target.size()
+                        ? source
+                        : ImagePool::instance().copy(source, QRect(QPoint(0, 0), target.size()));
+            } else {
+                result.tiles[result.index(column, row)] = copy(sourceArea);
+            }
+        }
+    }
+    return result;
+}
+
+TiledImage TiledImage::map(int halo, const std::function<QImage(const QImage &)> &function,
+                           const std::function<bool(int, int)> &progress) const
+{
+    if (isNull())
+        return TiledImage();
+    const int total = tiles.size();
+    QVector<QImage> results(total);
+    QImage *target = results.data();
+    std::atomic<int> completed(0);
+    std::atomic<bool> cancelled(false);
+    cv::parallel_for_(cv::Range(0, total), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end && !cancelled; ++i) {
+            const QRect bounds = tileRect(i % columns, i / columns);
+            const QRect region = bounds.adjusted(-halo, -halo, halo, halo) & rect();
+            const QImage output = function(copy(region));
+            target[i] = ImagePool::instance().copy(output, bounds.translated(-region.topLeft()));
+            if (progress && !progress(++completed, total))
+                cancelled = true;
+        }
+    });
+    if (cancelled)
+        return TiledImage();
+
+    TiledImage result(imageSize, results.first().format(), backgroundColor);
+    result.tiles = results;
+    return result;
+}
+
+TiledImage TiledImage::transform(const std::function<void(QImage &)> &function,
+                                 const std::function<bool(int, int)> &progress) const
+{
+    if (isNull())
+        return TiledImage();
+    QImage background(1, 1, imageFormat);
+    background.fill(QColor::fromRgba(backgroundColor));
+    function(background);
+
+    TiledImage result(*this);
+    result.backgroundColor = background.pixel(0, 0);
+    const int total = result.tiles.size();
+    QImage *target = result.tiles.data();
+    std::atomic<int> completed(0);
+    std::atomic<bool> cancelled(false);
+    cv::parallel_for_(cv::Range(0, total), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end && !cancelled; ++i) {
+            if (!target[i].isNull()) {
+                if (!target[i].isDetached())
+                    target[i] = ImagePool::instance().copy(target[i]);
+                function(target[i]);
+            }
+            if (progress && !progress(++completed, total))
+                cancelled = true;
+        }
+    });
+    if (cancelled)
+        return TiledImage();
+    return result;
+}
+
+qint64 TiledImage::residentBytes() const
+{
+    qint64 bytes = 0;
+    for (const QImage &allocated : tiles)
+        bytes += allocated.sizeInBytes();
+    return bytes;
+}
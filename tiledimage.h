@@ -0,0 +1,145 @@
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <QImage>
+#include <QPainter>
+#include <QVector>
+#include <functional>
+
+/*!
+ * \brief The TiledImage class хранит изображение документа в виде сетки тайлов TileSize x TileSize.
+ *
+ * Каждый тайл - отдельный QImage, поэтому копии TiledImage разделяют тайлы (copy-on-write):
+ * копирование документа стоит только массива ссылок, а запись отделяет лишь затронутые тайлы.
+ * Тайлы, в которые еще ничего не записывалось, не выделяются и считаются залитыми цветом фона,
+ * так что потребление памяти растет вместе с количеством затронутых тайлов.
+ * Буферы тайлов берутся из ImagePool и возвращаются в него, когда тайл больше никому не нужен.
+ */
+class TiledImage
+{
+public:
+    /*!
+     * \brief TileSize размер стороны тайла в пикселях
+     */
+    static const int TileSize = 256;
+
+    TiledImage() = default;
+    /*!
+     * \brief TiledImage создает документ заданного размера, все тайлы которого пока не выделены
+     * \param size размер изображения
+     * \param format формат пикселей тайлов
+     * \param background цвет невыделенных тайлов
+     */
+    TiledImage(const QSize &size, QImage::Format format, QRgb background = qRgb(255, 255, 255));
+    /*!
+     * \brief fromImage разрезает QImage на тайлы. Форматы, на которых нельзя рисовать
+     * (палитровые, монохромные и т.п.), приводятся к 32-битному формату.
+     * \param image исходное изображение
+     */
+    static TiledImage fromImage(const QImage &image);
+
+    bool isNull() const { return imageSize.isEmpty(); }
+    QSize size() const { return imageSize; }
+    int width() const { return imageSize.width(); }
+    int height() const { return imageSize.height(); }
+    QRect rect() const { return QRect(QPoint(0, 0), imageSize); }
+    QImage::Format format() const { return imageFormat; }
+    QRgb background() const { return backgroundColor; }
+    int tileColumns() const { return columns; }
+    int tileRows() const { return rows; }
+
+    /*!
+     * \brief tileRect прямоугольник тайла в координатах изображения (крайние тайлы могут быть меньше TileSize)
+     */
+    QRect tileRect(int column, int row) const;
+    /*!
+     * \brief tilesIn диапазон тайлов, пересекающих rect: x/y - первый столбец/строка, width/height - их количество
+     */
+    QRect tilesIn(const QRect &rect) const;
+    /*!
+     * \brief isTileAllocated true, если в тайл уже что-то записывалось
+     */
+    bool isTileAllocated(int column, int row) const;
+    /*!
+     * \brief tile возвращает тайл (разделяемую копию) или пустой QImage, если тайл не выделен
+     */
+    QImage tile(int column, int row) const;
+    /*!
+     * \brief tileForWrite возвращает тайл для изменения: выделяет его (заливая фоном), если он не был выделен,
+     * и отделяет от других документов при первой записи через QImage
+     */
+    QImage &tileForWrite(int column, int row);
+    /*!
+     * \brief setTile заменяет тайл готовым изображением; размер и формат должны совпадать с тайлом
+     */
+    void setTile(int column, int row, const QImage &tile);
+
+    /*!
+     * \brief copy собирает область документа в непрерывный QImage
+     * \param rect область в координатах изображения
+     */
+    QImage copy(const QRect &rect) const;
+    /*!
+     * \brief toImage собирает весь документ в непрерывный QImage
+     */
+    QImage toImage() const;
+    /*!
+     * \brief downscaled уменьшает документ в factor раз усреднением по площади.
+     * Каждый тайл обрабатывается отдельно и параллельно; factor должен быть степенью двойки
+     * не больше TileSize, тогда границы тайлов переходят в целые координаты результата.
+     * \param factor коэффициент уменьшения
+     */
+    QImage downscaled(int factor) const;
+    /*!
+     * \brief write записывает source в документ, начиная с точки position; меняются только затронутые тайлы
+     */
+    void write(const QPoint &position, const QImage &source);
+    /*!
+     * \brief paint вызывает function для каждого тайла, пересекающего rect, с QPainter,
+     * настроенным на координаты изображения и обрезанным по rect
+     */
+    void paint(const QRect &rect, const std::function<void(QPainter &)> &function);
+    /*!
+     * \brief copyRegion вырезает область в новый документ. Если область выровнена по сетке тайлов,
+     * внутренние тайлы разделяются без копирования пикселей.
+     */
+    TiledImage copyRegion(const QRect &rect) const;
+    /*!
+     * \brief map применяет function к каждому тайлу параллельно. Функция получает тайл,
+     * расширенный на halo пикселей с каждой стороны (в пределах изображения), и должна вернуть
+     * изображение того же размера; в результат попадает только сам тайл.
+     * \param halo ширина перекрытия, необходимая фильтру (радиус ядра)
+     * \param function операция над областью
+     * \param progress вызывается после каждого тайла с числом готовых и общим числом тайлов;
+     * если возвращает false, обработка прерывается и возвращается пустой документ
+     */
+    TiledImage map(int halo, const std::function<QImage(const QImage &)> &function,
+                   const std::function<bool(int, int)> &progress = std::function<bool(int, int)>()) const;
+    /*!
+     * \brief transform применяет к каждому выделенному тайлу попиксельную операцию на месте, параллельно.
+     * В отличие от map, тайлы не копируются в промежуточные изображения: function получает разделяемую
+     * копию тайла и меняет ее пиксели (буфер отделяется от исходного документа при первой записи).
+     * Невыделенные тайлы остаются невыделенными: операция применяется к цвету фона.
+     * Подходит только для операций, результат которых зависит лишь от самого пикселя.
+     * \param function операция над тайлом; формат и размер тайла менять нельзя
+     * \param progress см. map
+     */
+    TiledImage transform(const std::function<void(QImage &)> &function,
+                         const std::function<bool(int, int)> &progress = std::function<bool(int, int)>()) const;
+    /*!
+     * \brief residentBytes объем памяти, занятый выделенными тайлами
+     */
+    qint64 residentBytes() const;
+
+private:
+    int index(int column, int row) const { return row * columns + column; }
+
+    QSize imageSize;
+    QImage::Format imageFormat = QImage::Format_Invalid;
+    QRgb backgroundColor = qRgb(255, 255, 255);
+    int columns = 0;
+    int rows = 0;
+    QVector<QImage> tiles;
+};
+
+#endif // TILEDIMAGE_H
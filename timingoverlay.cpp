@@ -0,0 +1,65 @@
+#include "timingoverlay.h"
+#include "profiler.h"
+
+#include <QStringList>
+
+namespace {
+
+// Имя участка, которым размечена отрисовка области просмотра (ImageCanvas::paintEvent)
+const char *const FrameScope = "paint";
+// Сколько последних операций, кроме отрисовки, показывается в строке
+const int ShownOperations = 3;
+
+}
+
+TimingOverlay::TimingOverlay(QWidget *parent)
+    : QLabel(parent)
+{
+    timer = new QTimer(this);
+    timer->setInterval(500);
+    QObject::connect(timer, SIGNAL(timeout()), this, SLOT(refresh()));
+    setTextFormat(Qt::PlainText);
+}
+
+void TimingOverlay::showEvent(QShowEvent *event)
+{
+    QLabel::showEvent(event);
+    refresh();
+    timer->start();
+}
+
+void TimingOverlay::hideEvent(QHideEvent *event)
+{
+    timer->stop();
+    QLabel::hideEvent(event);
+}
+
+QString TimingOverlay::format(qint64 microseconds)
+{
+    if (microseconds >= 10000)
+        return tr("%1 ms").arg(microseconds / 1000);
+    return tr("%1 ms").arg(microseconds / 1000.0, 0, 'f', 1);
+}
+
+void TimingOverlay::refresh()
+{
+    const QVector<Profiler::Summary> summary = Profiler::instance().summary();
+    const qint64 now = Profiler::instance().now();
+    QStringList parts;
+    QStringList operations;
+    for (const Profiler::Summary &entry : summary) {
+        if (entry.name == QLatin1String(FrameScope)) {
+            // Частота кадров считается по числу отрисовок с прошлого обновления
+            const qint64 elapsed = now - lastRefresh;
+            const double fps = lastRefresh > 0 && elapsed > 0
+                    ? (entry.count - lastFrameCount) * 1e6 / elapsed : 0;
+            lastFrameCount = entry.count;
+            parts.prepend(tr("paint %1 (%2 fps)").arg(format(entry.last)).arg(fps, 0, 'f', 0));
+        } else if (operations.size() < ShownOperations) {
+            operations.append(QStringLiteral("%1 %2").arg(entry.name, format(entry.last)));
+        }
+    }
+    lastRefresh = now;
+    parts.append(operations);
+    setText(parts.join(QStringLiteral(" | ")));
+}
@@ -0,0 +1,37 @@
+#ifndef TIMINGOVERLAY_H
+#define TIMINGOVERLAY_H
+
+#include <QLabel>
+#include <QTimer>
+
+/*!
+ * \brief The TimingOverlay class показывает в строке состояния время последних операций из Profiler:
+ * длительность и частоту кадров отрисовки области просмотра и несколько последних завершенных операций.
+ * Пока виджет скрыт, сводка не опрашивается.
+ */
+class TimingOverlay : public QLabel
+{
+    Q_OBJECT
+
+public:
+    explicit TimingOverlay(QWidget *parent = nullptr);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private slots:
+    /*!
+     * \brief refresh перечитывает сводку профилировщика
+     */
+    void refresh();
+
+private:
+    static QString format(qint64 microseconds);
+
+    QTimer *timer = nullptr;
+    quint64 lastFrameCount = 0;
+    qint64 lastRefresh = 0;
+};
+
+#endif // TIMINGOVERLAY_H
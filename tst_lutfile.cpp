@@ -0,0 +1,104 @@
+#include <QtTest>
+#include "lutfile.h"
+
+namespace {
+
+const int MeshSize = 17;
+
+// Узел сетки в 12-битных единицах выхода, как в файлах Lustre
+int node(int index)
+{
+    return qRound(index * 4095.0 / (MeshSize - 1));
+}
+
+/*
+ * Таблица .3dl, меняющая местами красный и синий. Заголовок - как у файлов, которые пишет Autodesk Lustre:
+ * 3DMESH, Mesh <бит входа> <бит выхода>, строка узлов входной сетки (10 бит), в конце LUT8 и gamma.
+ */
+QByteArray swap3dl(const QByteArray &header)
+{
+    QByteArray data = header;
+    for (int r = 0; r < MeshSize; ++r) {
+        for (int g = 0; g < MeshSize; ++g) {
+            for (int b = 0; b < MeshSize; ++b)
+                data += QByteArray::number(node(b)) + ' ' + QByteArray::number(node(g)) + ' ' + QByteArray::number(node(r)) + '\n';
+        }
+    }
+    return data + "\nLUT8\ngamma 1.0\n";
+}
+
+QByteArray inputGrid(int nodes)
+{
+    QList<QByteArray> values;
+    for (int i = 0; i < nodes; ++i)
+        values.append(QByteArray::number(qRound(i * 1023.0 / (nodes - 1))));
+    return values.join(' ') + '\n';
+}
+
+// Цвет пикселя после таблицы
+QRgb applied(const ColorLut &lut, QRgb color)
+{
+    QImage image(1, 1, QImage::Format_RGB32);
+    image.setPixel(0, 0, color);
+    lut.apply(image);
+    return image.pixel(0, 0);
+}
+
+}
+
+class LutFileTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parse3dlLustre();
+    void parse3dlInputGridOnly();
+    void parse3dlInputGridMismatch();
+    void parseCube();
+};
+
+void LutFileTest::parse3dlLustre()
+{
+    QString error;
+    const std::shared_ptr<const ColorLut> lut = LutFile::parse3dl(swap3dl("3DMESH\nMesh 4 12\n" + inputGrid(MeshSize)), &error);
+    QVERIFY2(lut, qPrintable(error));
+    QCOMPARE(lut->size(), MeshSize);
+    QCOMPARE(applied(*lut, qRgb(255, 128, 0)), qRgb(0, 128, 255));
+    QCOMPARE(applied(*lut, qRgb(10, 200, 90)), qRgb(90, 200, 10));
+}
+
+void LutFileTest::parse3dlInputGridOnly()
+{
+    // Без Mesh размер сетки задается строкой узлов, а разрядность выхода определяется по данным
+    QString error;
+    const std::shared_ptr<const ColorLut> lut = LutFile::parse3dl(swap3dl(inputGrid(MeshSize)), &error);
+    QVERIFY2(lut, qPrintable(error));
+    QCOMPARE(lut->size(), MeshSize);
+    QCOMPARE(applied(*lut, qRgb(255, 128, 0)), qRgb(0, 128, 255));
+}
+
+void LutFileTest::parse3dlInputGridMismatch()
+{
+    QString error;
+    QVERIFY(!LutFile::parse3dl(swap3dl("3DMESH\nMesh 4 12\n" + inputGrid(9)), &error));
+    QVERIFY(error.contains(QLatin1String("Mesh expects 17")));
+}
+
+void LutFileTest::parseCube()
+{
+    QByteArray data = "# Created by hand\nTITLE \"swap\"\nLUT_3D_SIZE 2\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 1 1 1\n";
+    for (int b = 0; b < 2; ++b) {
+        for (int g = 0; g < 2; ++g) {
+            for (int r = 0; r < 2; ++r)
+                data += QByteArray::number(b) + ' ' + QByteArray::number(g) + ' ' + QByteArray::number(r) + '\n';
+        }
+    }
+    QString error;
+    const std::shared_ptr<const ColorLut> lut = LutFile::parseCube(data, &error);
+    QVERIFY2(lut, qPrintable(error));
+    QCOMPARE(lut->size(), 2);
+    QCOMPARE(applied(*lut, qRgb(255, 128, 0)), qRgb(0, 128, 255));
+}
+
+QTEST_GUILESS_MAIN(LutFileTest)
+#include "tst_lutfile.moc"